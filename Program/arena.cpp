@@ -0,0 +1,110 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// first block is big enough for a few rows of terrain scratch, later ones grow geometrically
+static const size_t kMinBlockSize = 64 * 1024;
+
+static char* AllocateBlock(size_t size)
+{
+    // over-allocate so the aligned pointer can be stored in front of the block
+    void* raw = malloc(size + 64 + sizeof(void*));
+    if (!raw)
+    {
+        throw std::bad_alloc();
+    }
+
+    uintptr_t aligned = ((uintptr_t)raw + sizeof(void*) + 63) & ~(uintptr_t)63;
+    ((void**)aligned)[-1] = raw;
+    return (char*)aligned;
+}
+
+static void FreeBlock(char* block)
+{
+    free(((void**)block)[-1]);
+}
+
+ScratchArena::~ScratchArena()
+{
+    for (Block& block : mBlocks)
+    {
+        FreeBlock(block.Memory);
+    }
+}
+
+void* ScratchArena::AllocateBytes(size_t bytes, size_t alignment)
+{
+    for (;;)
+    {
+        if (mCurrentBlock < mBlocks.size())
+        {
+            Block& block = mBlocks[mCurrentBlock];
+            size_t offset = (mOffset + alignment - 1) & ~(alignment - 1);
+            if (offset + bytes <= block.Size)
+            {
+                mOffset = offset + bytes;
+                return block.Memory + offset;
+            }
+
+            // doesn't fit, so try the next block before growing
+            if (mCurrentBlock + 1 < mBlocks.size())
+            {
+                mCurrentBlock++;
+                mOffset = 0;
+                continue;
+            }
+        }
+
+        size_t size = std::max(std::max(bytes + alignment, kMinBlockSize), GetCapacity());
+        mBlocks.push_back(Block{ AllocateBlock(size), size });
+        mCurrentBlock = mBlocks.size() - 1;
+        mOffset = 0;
+    }
+}
+
+void ScratchArena::Rewind(Marker marker)
+{
+    assert(marker.Block < mCurrentBlock || (marker.Block == mCurrentBlock && marker.Offset <= mOffset));
+
+    mCurrentBlock = marker.Block;
+    mOffset = marker.Offset;
+
+    // empty again: merge the blocks, so the next round of allocations fits in one
+    if (mCurrentBlock == 0 && mOffset == 0 && mBlocks.size() > 1)
+    {
+        size_t capacity = GetCapacity();
+        Release();
+        mBlocks.push_back(Block{ AllocateBlock(capacity), capacity });
+    }
+}
+
+void ScratchArena::Release()
+{
+    assert(mCurrentBlock == 0 && mOffset == 0);
+
+    for (Block& block : mBlocks)
+    {
+        FreeBlock(block.Memory);
+    }
+    mBlocks.clear();
+}
+
+size_t ScratchArena::GetCapacity() const
+{
+    size_t capacity = 0;
+    for (const Block& block : mBlocks)
+    {
+        capacity += block.Size;
+    }
+    return capacity;
+}
+
+ScratchArena& GetScratchArena()
+{
+    thread_local ScratchArena arena;
+    return arena;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Bump allocator for short-lived scratch memory (eg. the vertex/index arrays of a terrain that is being generated).
+// Allocations are released in LIFO order by rewinding to a marker, and the memory is kept for the next user,
+// so regenerating the same size of terrain doesn't touch the heap allocator at all.
+// Memory from an arena is uninitialized and is only valid until the arena is rewound past it.
+class ScratchArena
+{
+public:
+    struct Marker
+    {
+        size_t Block;
+        size_t Offset;
+    };
+
+private:
+    struct Block
+    {
+        char* Memory;
+        size_t Size;
+    };
+
+    // blocks are filled in order. Once the arena is empty again, they are merged into one block big enough for all of them.
+    std::vector<Block> mBlocks;
+    size_t mCurrentBlock = 0;
+    size_t mOffset = 0;
+
+    void* AllocateBytes(size_t bytes, size_t alignment);
+
+public:
+    ScratchArena() = default;
+    ~ScratchArena();
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    // count uninitialized Ts, aligned to a cache line
+    template<class T>
+    T* Allocate(size_t count)
+    {
+        return static_cast<T*>(AllocateBytes(count * sizeof(T), 64));
+    }
+
+    Marker GetMarker() const { return Marker{ mCurrentBlock, mOffset }; }
+
+    // releases everything allocated since the marker was taken
+    void Rewind(Marker marker);
+
+    // frees all the memory held by the arena. The arena must be empty.
+    void Release();
+
+    // bytes reserved from the heap
+    size_t GetCapacity() const;
+};
+
+// rewinds the arena when it goes out of scope
+class ScratchScope
+{
+    ScratchArena& mArena;
+    ScratchArena::Marker mMarker;
+
+public:
+    explicit ScratchScope(ScratchArena& arena)
+        : mArena(arena)
+        , mMarker(arena.GetMarker())
+    { }
+
+    ~ScratchScope() { mArena.Rewind(mMarker); }
+
+    ScratchScope(const ScratchScope&) = delete;
+    ScratchScope& operator=(const ScratchScope&) = delete;
+};
+
+// arena owned by the calling thread, so worker threads can use scratch memory without locking
+ScratchArena& GetScratchArena();
@@ -0,0 +1,597 @@
+// Microbenchmarks for the noise and terrain generation code.
+// CPU only: it never opens a window or creates a GL context, so it can run on a build machine.
+//
+// usage: bench [--baseline <file>] [--save] [--tolerance <percent>] [--quick]
+//
+// Every result is a time per unit of work, or for the adaptive meshes, a share of the full grid they keep (lower is better).
+// They are compared to the baseline file
+// (bench_baseline.csv in the working directory by default), and any that got slower by more than the tolerance
+// are flagged as regressions, which also makes the exit code 1. --save writes the results as the new baseline.
+// Baselines are only comparable on the same machine, with the same noise kernel and thread count.
+
+#include "scene.h"
+#include "cloud_noise.h"
+#include "fractal.h"
+#include "gridindex.h"
+#include "noise.h"
+#include "noise_simd.h"
+#include "rtin.h"
+#include "sculpt.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+struct BenchResult
+{
+    std::string Name;
+    std::string Unit;
+    double Value;
+};
+
+struct BenchSettings
+{
+    // best of this many timed runs
+    int Trials = 5;
+    // each timed run repeats the work until it takes at least this long
+    double MinRunMs = 20.0;
+};
+
+// results are added here so the compiler can't drop the work being timed
+static volatile float gSink;
+
+static void Consume(const float* values, size_t count)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; i += 61)
+    {
+        sum += values[i];
+    }
+    gSink = gSink + sum;
+}
+
+// nanoseconds per unit of work, where one call of body does unitsPerCall units
+template<class Body>
+static double MeasureNsPerUnit(const BenchSettings& settings, double unitsPerCall, Body&& body)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+
+    // warm up (page in the buffers, start the pool's threads) and find how many calls fill a run
+    int calls = 1;
+    for (;;)
+    {
+        auto start = Clock::now();
+        for (int i = 0; i < calls; i++)
+        {
+            body();
+        }
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (ms >= settings.MinRunMs || calls >= (1 << 20))
+        {
+            break;
+        }
+        calls *= 2;
+    }
+
+    double bestNs = 0.0;
+    for (int trial = 0; trial < settings.Trials; trial++)
+    {
+        auto start = Clock::now();
+        for (int i = 0; i < calls; i++)
+        {
+            body();
+        }
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (calls * unitsPerCall);
+        if (trial == 0 || ns < bestNs)
+        {
+            bestNs = ns;
+        }
+    }
+    return bestNs;
+}
+
+// scattered sample coordinates, so the reference functions don't get an unrealistically warm permutation table
+static void MakeSampleCoordinates(size_t count, std::vector<double>* x, std::vector<double>* y, std::vector<double>* z)
+{
+    x->resize(count);
+    y->resize(count);
+    z->resize(count);
+    uint64_t key = MakeRandomKey(1234);
+    for (size_t i = 0; i < count; i++)
+    {
+        (*x)[i] = SquaresRandom(i * 3 + 0, key) / 16777216.0;
+        (*y)[i] = SquaresRandom(i * 3 + 1, key) / 16777216.0;
+        (*z)[i] = SquaresRandom(i * 3 + 2, key) / 16777216.0;
+    }
+}
+
+static void BenchReferenceNoise(const BenchSettings& settings, std::vector<BenchResult>* results)
+{
+    PermutationTable perm(0);
+
+    const size_t count = 4096;
+    std::vector<double> x, y, z;
+    MakeSampleCoordinates(count, &x, &y, &z);
+
+    results->push_back({ "perlin2d", "ns/sample", MeasureNsPerUnit(settings, count, [&] {
+        double sum = 0.0;
+        for (size_t i = 0; i < count; i++)
+        {
+            sum += Perlin2(perm, x[i], y[i]);
+        }
+        gSink = gSink + (float)sum;
+    }) });
+
+    results->push_back({ "perlin2d_clamped", "ns/sample", MeasureNsPerUnit(settings, count, [&] {
+        double sum = 0.0;
+        for (size_t i = 0; i < count; i++)
+        {
+            sum += Perlin2Clamped(perm, x[i], y[i]);
+        }
+        gSink = gSink + (float)sum;
+    }) });
+
+    results->push_back({ "perlin3d", "ns/sample", MeasureNsPerUnit(settings, count, [&] {
+        double sum = 0.0;
+        for (size_t i = 0; i < count; i++)
+        {
+            sum += Perlin3(perm, x[i], y[i], z[i]);
+        }
+        gSink = gSink + (float)sum;
+    }) });
+}
+
+// the grid functions, with each kernel this CPU supports
+static void BenchGridNoise(const BenchSettings& settings, std::vector<BenchResult>* results)
+{
+    PermutationTable perm(0);
+
+    NoiseGrid grid2D;
+    grid2D.SizeX = 256;
+    grid2D.SizeY = 256;
+    grid2D.SamplesPerUnit = 64.0f;
+    size_t count2D = (size_t)grid2D.SizeX * grid2D.SizeY;
+
+    NoiseGrid grid3D;
+    grid3D.SizeX = 40;
+    grid3D.SizeY = 40;
+    grid3D.SizeZ = 40;
+    grid3D.SamplesPerUnit = 16.0f;
+    size_t count3D = (size_t)grid3D.SizeX * grid3D.SizeY * grid3D.SizeZ;
+
+    std::vector<float> out(std::max(count2D, count3D));
+    std::vector<float> outDx(count2D);
+    std::vector<float> outDy(count2D);
+
+    NoiseKernel previousKernel = GetNoiseKernel();
+    for (int kernel = (int)NoiseKernel::Scalar; kernel <= (int)GetBestNoiseKernel(); kernel++)
+    {
+        SetNoiseKernel((NoiseKernel)kernel);
+        std::string suffix = std::string("_") + GetNoiseKernelName((NoiseKernel)kernel);
+        std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
+
+        results->push_back({ "perlin2d_grid" + suffix, "ns/sample", MeasureNsPerUnit(settings, (double)count2D, [&] {
+            PerlinGrid2D(perm, grid2D, out.data());
+            Consume(out.data(), count2D);
+        }) });
+
+        results->push_back({ "perlin2d_deriv_grid" + suffix, "ns/sample", MeasureNsPerUnit(settings, (double)count2D, [&] {
+            PerlinGrid2DDeriv(perm, grid2D, out.data(), outDx.data(), outDy.data());
+            Consume(out.data(), count2D);
+            Consume(outDx.data(), count2D);
+        }) });
+
+        results->push_back({ "perlin3d_grid" + suffix, "ns/sample", MeasureNsPerUnit(settings, (double)count3D, [&] {
+            PerlinGrid3D(perm, grid3D, out.data());
+            Consume(out.data(), count3D);
+        }) });
+    }
+    SetNoiseKernel(previousKernel);
+}
+
+// the terrain's fractal alone, one grid row at a time like GenerateTerrainHeights, on one thread
+static void BenchFractal(const BenchSettings& settings, std::vector<BenchResult>* results)
+{
+    PermutationTable perm(0);
+    FractalFunction fractal = GetFractalFunction(FractalType::HybridMultifractal, 8);
+
+    for (int gridSize : { 128, 512, 2048 })
+    {
+        std::vector<float> value(gridSize + 1);
+        std::vector<float> valueDx(gridSize + 1);
+        std::vector<float> valueDy(gridSize + 1);
+
+        // a few rows are enough to be representative, and keep the big grids quick
+        int numRows = std::min(gridSize + 1, 64);
+        double numSamples = (double)numRows * (gridSize + 1);
+
+        results->push_back({ "hybrid_multifractal_" + std::to_string(gridSize), "ns/vertex", MeasureNsPerUnit(settings, numSamples, [&] {
+            for (int i = 0; i < numRows; i++)
+            {
+                NoiseGrid row;
+                row.OriginX = i;
+                row.SizeX = 1;
+                row.SizeY = gridSize + 1;
+                row.SamplesPerUnit = (float)gridSize;
+                fractal(perm, row, kTerrainSpectralTable, value.data(), valueDx.data(), valueDy.data());
+                Consume(value.data(), value.size());
+            }
+        }) });
+    }
+}
+
+// positions and normals from the fractal's values and derivatives
+static void BenchNormals(const BenchSettings& settings, std::vector<BenchResult>* results)
+{
+    PermutationTable perm(0);
+    FractalFunction fractal = GetFractalFunction(FractalType::HybridMultifractal, 8);
+
+    const int gridSize = 1024;
+    size_t numVertices = (size_t)(gridSize + 1) * (gridSize + 1);
+
+    NoiseGrid grid;
+    grid.SizeX = gridSize + 1;
+    grid.SizeY = gridSize + 1;
+    grid.SamplesPerUnit = (float)gridSize;
+
+    // the fractal output is x-major, so row i (fixed x) is strided. Transpose it to the rows WriteTerrainRow takes.
+    std::vector<float> gridValue(numVertices), gridValueDx(numVertices), gridValueDy(numVertices);
+    fractal(perm, grid, kTerrainSpectralTable, gridValue.data(), gridValueDx.data(), gridValueDy.data());
+    std::vector<float> value(numVertices), valueDx(numVertices), valueDy(numVertices);
+    for (int i = 0; i < gridSize + 1; i++)
+    {
+        for (int j = 0; j < gridSize + 1; j++)
+        {
+            value[i * (gridSize + 1) + j] = gridValue[j * (gridSize + 1) + i];
+            valueDx[i * (gridSize + 1) + j] = gridValueDx[j * (gridSize + 1) + i];
+            valueDy[i * (gridSize + 1) + j] = gridValueDy[j * (gridSize + 1) + i];
+        }
+    }
+
+    std::vector<GLfloat> vertices(numVertices * 3);
+    std::vector<GLfloat> normals(numVertices * 3);
+
+    results->push_back({ "normals_" + std::to_string(gridSize), "ns/vertex", MeasureNsPerUnit(settings, (double)numVertices, [&] {
+        for (int i = 0; i < gridSize + 1; i++)
+        {
+            size_t offset = (size_t)i * (gridSize + 1);
+            WriteTerrainRow(gridSize, i, 1.0f, 0.75f, &value[offset], &valueDx[offset], &valueDy[offset], (GLfloat(*)[3])vertices.data() + offset, (GLfloat(*)[3])normals.data() + offset, nullptr);
+        }
+        Consume(normals.data(), normals.size());
+    }) });
+}
+
+// the whole CPU heightfield pass (fractal, positions and normals), on one thread and on all of them.
+// The spectral synthesis runs at the same resolutions, to compare the two (4096 only on all threads, since it's slow).
+static void BenchHeightfield(const BenchSettings& settings, std::vector<BenchResult>* results)
+{
+    PermutationTable perm(0);
+    std::vector<int> threadCounts = { 1 };
+    if (GetThreadPool().GetMaxThreads() > 1)
+    {
+        threadCounts.push_back(GetThreadPool().GetMaxThreads());
+    }
+
+    for (int gridSize : { 256, 1024, 4096 })
+    {
+        size_t numVertices = (size_t)(gridSize + 1) * (gridSize + 1);
+        std::vector<GLfloat> vertices(numVertices * 3);
+        std::vector<GLfloat> normals(numVertices * 3);
+
+        for (FractalType fractal : { FractalType::HybridMultifractal, FractalType::Spectral })
+        {
+            TerrainFractalSettings terrainSettings;
+            terrainSettings.Fractal = fractal;
+            terrainSettings.H = GetDefaultTerrainH(fractal);
+
+            for (int numThreads : threadCounts)
+            {
+                if (gridSize == 4096 && numThreads != threadCounts.back())
+                {
+                    continue;
+                }
+
+                std::string name = std::string(fractal == FractalType::Spectral ? "heightfield_spectral_" : "heightfield_") + std::to_string(gridSize) +
+                    (numThreads == 1 ? "_1thread" : "_allthreads");
+                results->push_back({ name, "ns/vertex", MeasureNsPerUnit(settings, (double)numVertices, [&] {
+                    GenerateTerrainHeights(perm, terrainSettings, 0, 0, gridSize, (GLfloat(*)[3])vertices.data(), (GLfloat(*)[3])normals.data(), nullptr, numThreads);
+                    Consume(vertices.data(), vertices.size());
+                }) });
+            }
+        }
+    }
+}
+
+// the cloud noise texture (see cloud_noise.h), baked when there's no cached one for the seed, and its bricks
+static void BenchCloudNoise(const BenchSettings& settings, std::vector<BenchResult>* results)
+{
+    std::vector<uint16_t> texels(GetCloudNoiseTexelCount());
+    results->push_back({ "cloud_noise_bake", "ns/texel", MeasureNsPerUnit(settings, (double)texels.size(), [&] {
+        BakeCloudNoise(1, texels.data(), GetThreadPool().GetMaxThreads());
+        gSink = gSink + (float)texels[texels.size() / 2];
+    }) });
+
+    std::vector<CloudBrickLevel> levels;
+    results->push_back({ "cloud_bricks_build", "ns/texel", MeasureNsPerUnit(settings, (double)texels.size(), [&] {
+        BuildCloudBricks(texels.data(), &levels, GetThreadPool().GetMaxThreads());
+        gSink = gSink + (float)levels.back().MinMax[0];
+    }) });
+}
+
+static void BenchGridIndices(const BenchSettings& settings, std::vector<BenchResult>* results)
+{
+    for (int gridSize : { 256, 1024 })
+    {
+        size_t indexCount = (size_t)gridSize * gridSize * 6;
+        std::vector<uint32_t> indices(indexCount);
+
+        results->push_back({ "grid_indices_" + std::to_string(gridSize), "ns/index", MeasureNsPerUnit(settings, (double)indexCount, [&] {
+            GenerateGridIndices(gridSize, indices.data());
+            gSink = gSink + (float)indices[indexCount / 2];
+        }) });
+    }
+}
+
+// the adaptive mesh (see rtin.h) of the world terrain, for a few seeds: how long it takes to make, and the share of the full grid's
+// triangles and vertices it keeps at a few error thresholds (in world units), to pick the default from.
+// The shares don't depend on the machine, so any change to them is the mesher's.
+static void BenchAdaptiveMesh(const BenchSettings& settings, std::vector<BenchResult>* results)
+{
+    const int gridSize = 1024;
+    size_t numVertices = (size_t)(gridSize + 1) * (gridSize + 1);
+    size_t gridTriangles = (size_t)gridSize * gridSize * 2;
+
+    TerrainFractalSettings terrainSettings;
+    std::vector<float> heights(numVertices);
+    std::vector<GLfloat> normals(numVertices * 3);
+    std::vector<uint8_t> texels(GetTerrainTexelBytes(gridSize));
+    std::vector<uint32_t> indices;
+
+    for (int seed : { 0, 1, 2 })
+    {
+        GenerateTerrainHeights(PermutationTable(seed), terrainSettings, 0, 0, gridSize, nullptr, (GLfloat(*)[3])normals.data(), heights.data(), GetThreadPool().GetMaxThreads());
+        float minHeight = *std::min_element(heights.begin(), heights.end());
+        float maxHeight = *std::max_element(heights.begin(), heights.end());
+        PackTerrainTexels(gridSize, heights.data(), (const GLfloat(*)[3])normals.data(), minHeight, maxHeight, texels.data());
+
+        if (seed == 0)
+        {
+            results->push_back({ "adaptive_mesh_" + std::to_string(gridSize), "ns/vertex", MeasureNsPerUnit(settings, (double)numVertices, [&] {
+                BuildTerrainAdaptiveIndices(gridSize, texels.data(), minHeight, maxHeight, TERRAIN_DEFAULT_MESH_MAX_ERROR, &indices);
+                gSink = gSink + (float)indices.size();
+            }) });
+        }
+
+        for (float maxError : { 0.001f, 0.0025f, 0.005f, 0.01f, 0.02f })
+        {
+            BuildTerrainAdaptiveIndices(gridSize, texels.data(), minHeight, maxHeight, maxError, &indices);
+
+            char suffix[64];
+            snprintf(suffix, sizeof(suffix), "_seed%d_%g", seed, maxError);
+            results->push_back({ std::string("adaptive_triangles") + suffix, "% of grid", 100.0 * (indices.size() / 3) / gridTriangles });
+            results->push_back({ std::string("adaptive_vertices") + suffix, "% of grid", 100.0 * CountRtinVertices(gridSize, indices) / numVertices });
+        }
+    }
+}
+
+// one frame of a brush stroke, and packing the texels it changed. Its cost should only depend on the brush's area.
+static void BenchSculpt(const BenchSettings& settings, std::vector<BenchResult>* results)
+{
+    for (int gridSize : { 1024, 4096 })
+    {
+        size_t rowVertices = (size_t)gridSize + 1;
+        std::vector<float> heights(rowVertices * rowVertices);
+        for (size_t i = 0; i < rowVertices; i++)
+        {
+            for (size_t j = 0; j < rowVertices; j++)
+            {
+                heights[i * rowVertices + j] = 5.0f + sinf(i * 0.05f) * cosf(j * 0.07f);
+            }
+        }
+        std::vector<uint8_t> texels(GetTerrainTexelBytes(gridSize));
+
+        // 64 grid squares across, whatever the grid size
+        float radius = 32.0f * TERRAIN_WORLD_SIZE / gridSize;
+        size_t brushVertices = 65 * 65;
+
+        for (SculptBrush brush : { SculptBrush::Raise, SculptBrush::Smooth })
+        {
+            std::string name = std::string(brush == SculptBrush::Raise ? "sculpt_raise_" : "sculpt_smooth_") + std::to_string(gridSize);
+            results->push_back({ name, "ns/vertex", MeasureNsPerUnit(settings, (double)brushVertices, [&] {
+                // raising by 0 still does all of the work
+                SculptRect rect = SculptHeights(gridSize, heights.data(), brush, glm::vec2(0.0f), radius, brush == SculptBrush::Raise ? 0.0f : 0.5f, 0.0f);
+                PackSculptedTexels(gridSize, heights.data(), rect, 0.0f, 10.0f, texels.data());
+                gSink = gSink + texels[rect.FirstRow * rowVertices + rect.FirstColumn];
+            }) });
+        }
+    }
+}
+
+static std::string DescribeConfiguration()
+{
+    char description[128];
+    snprintf(description, sizeof(description), "kernel %s, %d threads", GetNoiseKernelName(GetNoiseKernel()), GetThreadPool().GetMaxThreads());
+    return description;
+}
+
+// returns false if the file doesn't exist or can't be read
+static bool LoadBaseline(const char* path, std::map<std::string, BenchResult>* baseline, std::string* configuration)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        return false;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        const char* configurationPrefix = "# configuration: ";
+        if (strncmp(line, configurationPrefix, strlen(configurationPrefix)) == 0)
+        {
+            *configuration = line + strlen(configurationPrefix);
+            continue;
+        }
+        if (line[0] == '#' || line[0] == '\0' || strcmp(line, "name,unit,value") == 0)
+        {
+            continue;
+        }
+
+        char* unit = strchr(line, ',');
+        char* value = unit ? strchr(unit + 1, ',') : nullptr;
+        if (!value)
+        {
+            fprintf(stderr, "%s: skipping malformed line \"%s\"\n", path, line);
+            continue;
+        }
+        *unit++ = '\0';
+        *value++ = '\0';
+
+        BenchResult result;
+        result.Name = line;
+        result.Unit = unit;
+        result.Value = atof(value);
+        (*baseline)[result.Name] = result;
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool SaveBaseline(const char* path, const std::vector<BenchResult>& results)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", path);
+        return false;
+    }
+
+    fprintf(file, "# terrain generation benchmark baseline. Times per unit of work, lower is better.\n");
+    fprintf(file, "# configuration: %s\n", DescribeConfiguration().c_str());
+    fprintf(file, "name,unit,value\n");
+    for (const BenchResult& result : results)
+    {
+        fprintf(file, "%s,%s,%.4f\n", result.Name.c_str(), result.Unit.c_str(), result.Value);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static void PrintUsage()
+{
+    fprintf(stderr, "usage: bench [--baseline <file>] [--save] [--tolerance <percent>] [--quick]\n");
+    fprintf(stderr, "  --baseline   baseline to compare against (default bench_baseline.csv)\n");
+    fprintf(stderr, "  --save       write the results as the new baseline\n");
+    fprintf(stderr, "  --tolerance  slowdown flagged as a regression, in percent (default 10)\n");
+    fprintf(stderr, "  --quick      fewer and shorter runs, for a rough check\n");
+}
+
+int main(int argc, char* argv[])
+{
+    const char* baselinePath = "bench_baseline.csv";
+    bool save = false;
+    double tolerancePercent = 10.0;
+    BenchSettings settings;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+        {
+            baselinePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--save") == 0)
+        {
+            save = true;
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+        {
+            tolerancePercent = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--quick") == 0)
+        {
+            settings.Trials = 2;
+            settings.MinRunMs = 5.0;
+        }
+        else
+        {
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    printf("Terrain generation benchmarks (%s)\n\n", DescribeConfiguration().c_str());
+
+    std::vector<BenchResult> results;
+    BenchReferenceNoise(settings, &results);
+    BenchGridNoise(settings, &results);
+    BenchFractal(settings, &results);
+    BenchNormals(settings, &results);
+    BenchHeightfield(settings, &results);
+    BenchCloudNoise(settings, &results);
+    BenchGridIndices(settings, &results);
+    BenchAdaptiveMesh(settings, &results);
+    BenchSculpt(settings, &results);
+
+    std::map<std::string, BenchResult> baseline;
+    std::string baselineConfiguration;
+    bool haveBaseline = LoadBaseline(baselinePath, &baseline, &baselineConfiguration);
+
+    int numRegressions = 0;
+    for (const BenchResult& result : results)
+    {
+        printf("%-36s %10.3f %-10s", result.Name.c_str(), result.Value, result.Unit.c_str());
+
+        auto base = baseline.find(result.Name);
+        if (base != baseline.end() && base->second.Unit == result.Unit && base->second.Value > 0.0)
+        {
+            double changePercent = (result.Value / base->second.Value - 1.0) * 100.0;
+            printf("  baseline %10.3f  %+6.1f%%", base->second.Value, changePercent);
+            if (changePercent > tolerancePercent)
+            {
+                printf("  REGRESSION");
+                numRegressions++;
+            }
+            else if (changePercent < -tolerancePercent)
+            {
+                printf("  improved");
+            }
+        }
+        else if (haveBaseline)
+        {
+            printf("  (not in baseline)");
+        }
+        printf("\n");
+    }
+    printf("\n");
+
+    if (!haveBaseline)
+    {
+        printf("No baseline at %s. Run with --save to record one.\n", baselinePath);
+    }
+    else
+    {
+        if (baselineConfiguration != DescribeConfiguration())
+        {
+            printf("Warning: the baseline was recorded with %s, so the comparison may not be meaningful.\n", baselineConfiguration.c_str());
+        }
+        printf("%d regression(s) over %.0f%% against %s\n", numRegressions, tolerancePercent, baselinePath);
+    }
+
+    if (save && SaveBaseline(baselinePath, results))
+    {
+        printf("Saved the results to %s\n", baselinePath);
+    }
+
+    return numRegressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+#include "cdlod.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+int GetCdlodNumLevels(int gridSize)
+{
+    int numLevels = 1;
+    while (numLevels < CDLOD_MAX_LEVELS && (CDLOD_PATCH_RESOLUTION << (numLevels - 1)) < gridSize)
+    {
+        numLevels++;
+    }
+    return numLevels;
+}
+
+void ComputeCdlodRanges(float rootSize, int numLevels, const CdlodSettings& settings, CdlodRanges* ranges)
+{
+    ranges->NumLevels = numLevels;
+
+    // an edge of length s at distance d covers s * ViewportHeight / (2 * d * tan(FovY / 2)) pixels
+    float pixelsPerUnitAtUnitDistance = settings.ViewportHeight / (2.0f * tan(settings.FovY * 0.5f));
+
+    float previousRange = 0.0f;
+    for (int level = 0; level < numLevels; level++)
+    {
+        float nodeSize = rootSize / (float)(1 << (numLevels - 1 - level));
+        float vertexSpacing = nodeSize / CDLOD_PATCH_RESOLUTION;
+
+        float range = vertexSpacing * pixelsPerUnitAtUnitDistance / settings.PixelError;
+
+        // a node that is drawn must be fully morphed before its farthest vertex can border a node two levels coarser,
+        // which holds as long as the range is a few node sizes long and at least doubles every level
+        range = std::max(range, 2.5f * nodeSize);
+        range = std::max(range, 2.0f * previousRange);
+
+        if (level == numLevels - 1)
+        {
+            // the root covers everything, and has no coarser level to morph to
+            ranges->Range[level] = FLT_MAX;
+            ranges->MorphConsts[level] = glm::vec2(1.0f, 0.0f);
+            break;
+        }
+
+        float morphEnd = range;
+        float morphStart = previousRange + (range - previousRange) * (1.0f - settings.MorphRatio);
+
+        ranges->Range[level] = range;
+        ranges->MorphConsts[level] = glm::vec2(morphEnd / (morphEnd - morphStart), 1.0f / (morphEnd - morphStart));
+
+        previousRange = range;
+    }
+}
+
+namespace
+{
+    struct SelectionContext
+    {
+        const CdlodRanges* Ranges;
+        float MinHeight;
+        float MaxHeight;
+        glm::vec3 Eye;
+        // frustum planes, pointing inwards
+        glm::vec4 Planes[6];
+        std::vector<CdlodNode>* Nodes;
+    };
+}
+
+static bool BoxIntersectsSphere(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& center, float radius)
+{
+    if (radius == FLT_MAX)
+        return true;
+
+    glm::vec3 closest = glm::clamp(center, boxMin, boxMax);
+    glm::vec3 delta = closest - center;
+    return dot(delta, delta) <= radius * radius;
+}
+
+static bool BoxInFrustum(const SelectionContext& ctx, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    for (const glm::vec4& plane : ctx.Planes)
+    {
+        // the corner furthest along the plane normal
+        glm::vec3 corner(
+            plane.x >= 0.0f ? boxMax.x : boxMin.x,
+            plane.y >= 0.0f ? boxMax.y : boxMin.y,
+            plane.z >= 0.0f ? boxMax.z : boxMin.z);
+
+        if (dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// returns false if the node is out of its level's range, in which case the parent has to cover its area
+static bool SelectNode(SelectionContext& ctx, glm::vec2 nodeMin, float nodeSize, int level)
+{
+    glm::vec3 boxMin(nodeMin.x, ctx.MinHeight, nodeMin.y);
+    glm::vec3 boxMax(nodeMin.x + nodeSize, ctx.MaxHeight, nodeMin.y + nodeSize);
+
+    if (!BoxIntersectsSphere(boxMin, boxMax, ctx.Eye, ctx.Ranges->Range[level]))
+        return false;
+
+    // out of view. Nothing to draw, but the area is taken care of.
+    if (!BoxInFrustum(ctx, boxMin, boxMax))
+        return true;
+
+    if (level == 0 || !BoxIntersectsSphere(boxMin, boxMax, ctx.Eye, ctx.Ranges->Range[level - 1]))
+    {
+        ctx.Nodes->push_back(CdlodNode{ nodeMin, nodeSize, level, -1 });
+        return true;
+    }
+
+    // children that are too far for their own level get drawn as quarters of this node
+    float childSize = nodeSize * 0.5f;
+    int uncoveredQuadrants[4];
+    int numUncovered = 0;
+    for (int quadrant = 0; quadrant < 4; quadrant++)
+    {
+        glm::vec2 childMin = nodeMin + glm::vec2((float)(quadrant & 1), (float)(quadrant >> 1)) * childSize;
+        if (!SelectNode(ctx, childMin, childSize, level - 1))
+        {
+            uncoveredQuadrants[numUncovered++] = quadrant;
+        }
+    }
+
+    if (numUncovered == 4)
+    {
+        ctx.Nodes->push_back(CdlodNode{ nodeMin, nodeSize, level, -1 });
+        return true;
+    }
+
+    for (int i = 0; i < numUncovered; i++)
+    {
+        ctx.Nodes->push_back(CdlodNode{ nodeMin, nodeSize, level, uncoveredQuadrants[i] });
+    }
+
+    return true;
+}
+
+void SelectCdlodNodes(
+    const CdlodRanges& ranges,
+    glm::vec2 rootMin,
+    float rootSize,
+    float minHeight,
+    float maxHeight,
+    glm::vec3 eye,
+    const glm::mat4& modelViewProjection,
+    std::vector<CdlodNode>* nodes)
+{
+    SelectionContext ctx;
+    ctx.Ranges = &ranges;
+    ctx.MinHeight = minHeight;
+    ctx.MaxHeight = maxHeight;
+    ctx.Eye = eye;
+    ctx.Nodes = nodes;
+
+    // Gribb/Hartmann plane extraction: left, right, bottom, top, near, far
+    glm::mat4 m = glm::transpose(modelViewProjection);
+    ctx.Planes[0] = m[3] + m[0];
+    ctx.Planes[1] = m[3] - m[0];
+    ctx.Planes[2] = m[3] + m[1];
+    ctx.Planes[3] = m[3] - m[1];
+    ctx.Planes[4] = m[3] + m[2];
+    ctx.Planes[5] = m[3] - m[2];
+
+    SelectNode(ctx, rootMin, rootSize, ranges.NumLevels - 1);
+}
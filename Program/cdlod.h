@@ -0,0 +1,64 @@
+#pragma once
+
+#include "preamble.glsl"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Continuous distance-dependent level of detail for the terrain grids ("CDLOD", F. Strugar 2010).
+//
+// Each terrain is covered by a quadtree. Every selected node is drawn with the same patch mesh of
+// CDLOD_PATCH_RESOLUTION^2 quads, displaced by the terrain's height texture, so a node's vertex spacing halves with every level down the tree.
+// Nodes are picked by their distance to the camera, and the vertex shader morphs vertices towards the next coarser level
+// as they approach the end of their level's range, so LOD changes don't pop and neighbouring nodes don't crack.
+
+// CDLOD_PATCH_RESOLUTION is in preamble.glsl, since the vertex shader needs it too
+#define CDLOD_MAX_LEVELS 12
+
+struct CdlodSettings
+{
+    // how big (in pixels) one patch quad is allowed to get on screen before a finer level is used
+    float PixelError;
+    float ViewportHeight;
+    float FovY;
+    // fraction at the end of each level's range over which vertices morph to the next coarser level
+    float MorphRatio;
+};
+
+// distance ranges of the levels of one quadtree. Level 0 is the finest.
+struct CdlodRanges
+{
+    int NumLevels;
+    float Range[CDLOD_MAX_LEVELS];
+    // morph factor = 1 - clamp(MorphConsts.x - distance * MorphConsts.y, 0, 1)
+    glm::vec2 MorphConsts[CDLOD_MAX_LEVELS];
+};
+
+// a node to draw. Quadrant is -1 to draw the whole node, or 0-3 (x + 2 * z) to draw one quarter of it.
+struct CdlodNode
+{
+    glm::vec2 Min;
+    float Size;
+    int Level;
+    int Quadrant;
+};
+
+// number of levels needed for the finest level to match the vertex spacing of a gridSize x gridSize terrain
+int GetCdlodNumLevels(int gridSize);
+
+// the range of each level is the distance at which its vertex spacing projects to settings.PixelError pixels.
+void ComputeCdlodRanges(float rootSize, int numLevels, const CdlodSettings& settings, CdlodRanges* ranges);
+
+// selects the nodes covering the square [rootMin, rootMin + rootSize] (in model space x/z), and appends them to nodes.
+// eye is the camera in model space, and nodes outside the modelViewProjection frustum are culled.
+// minHeight/maxHeight bound the terrain's heights.
+void SelectCdlodNodes(
+    const CdlodRanges& ranges,
+    glm::vec2 rootMin,
+    float rootSize,
+    float minHeight,
+    float maxHeight,
+    glm::vec3 eye,
+    const glm::mat4& modelViewProjection,
+    std::vector<CdlodNode>* nodes);
@@ -0,0 +1,49 @@
+// Upsamples cloud_march.frag's clouds to the screen, and blends them over the scene.
+// Each pixel weighs the 4 nearest cloud samples by how close they are, and by how close their distance from the camera is
+// to its own, so clouds in front of a ridge don't bleed onto the terrain or the sky behind it.
+
+uniform sampler2D SceneDepth;
+uniform sampler2D CloudSamples;
+uniform mat4 WorldFromClip;
+uniform vec3 CameraPos;
+uniform int Downsample;
+
+uniform vec4 CloudHue;
+
+out vec4 FragColor;
+
+void main()
+{
+    ivec2 screenSize = textureSize(SceneDepth, 0);
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(SceneDepth, pixel, 0).r;
+
+    vec2 ndc = (vec2(pixel) + 0.5) / vec2(screenSize) * 2.0 - 1.0;
+    vec4 target = WorldFromClip * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    float sceneDistance = distance(CameraPos, target.xyz / target.w);
+
+    // the samples are at the centers of their footprints
+    vec2 sampleCoord = gl_FragCoord.xy / float(Downsample) - 0.5;
+    ivec2 firstSample = ivec2(floor(sampleCoord));
+    vec2 f = sampleCoord - vec2(firstSample);
+    ivec2 lastSample = textureSize(CloudSamples, 0) - 1;
+
+    float blocked = 0.0;
+    float weightSum = 0.0;
+    for (int k = 0; k < 4; k++)
+    {
+        ivec2 offset = ivec2(k & 1, k >> 1);
+        vec2 cloudSample = texelFetch(CloudSamples, clamp(firstSample + offset, ivec2(0), lastSample), 0).rg;
+
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float relativeDifference = abs(cloudSample.y - sceneDistance) / max(sceneDistance, 0.001);
+        float weight = bilinear.x * bilinear.y / (0.001 + relativeDifference);
+
+        blocked += cloudSample.x * weight;
+        weightSum += weight;
+    }
+    blocked = weightSum > 0.0 ? blocked / weightSum : 0.0;
+
+    // blended over the scene: CloudHue * blocked + scene * (1 - blocked)
+    FragColor = vec4(CloudHue.rgb, clamp(blocked, 0.0, 1.0));
+}
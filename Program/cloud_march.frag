@@ -0,0 +1,29 @@
+// Volumetric cloud pass. Marches the clouds (clouds.glsl) from the camera to the scene, once per pixel of a target that's
+// Downsample times smaller than the screen. Each pixel takes the depth at the center of its footprint on the screen.
+// Writes how much the clouds block the scene, and the scene's distance from the camera, for cloud_composite.frag,
+// and the number of steps the march took, for the stats.
+
+uniform sampler2D SceneDepth;
+uniform mat4 WorldFromClip;
+uniform vec3 CameraPos;
+uniform int Downsample;
+
+layout(location = 0) out vec2 CloudSample;
+layout(location = 1) out float CloudSteps;
+
+// from clouds.glsl
+float cast_ray(vec3 origin, vec3 target, out float num_steps);
+
+void main()
+{
+    ivec2 screenSize = textureSize(SceneDepth, 0);
+    ivec2 pixel = min(ivec2(gl_FragCoord.xy) * Downsample + Downsample / 2, screenSize - 1);
+    float depth = texelFetch(SceneDepth, pixel, 0).r;
+
+    // the sky is at the far plane, which is past CLOUD_MAX_DISTANCE
+    vec2 ndc = (vec2(pixel) + 0.5) / vec2(screenSize) * 2.0 - 1.0;
+    vec4 target = WorldFromClip * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    target /= target.w;
+
+    CloudSample = vec2(cast_ray(CameraPos, target.xyz, CloudSteps), distance(CameraPos, target.xyz));
+}
@@ -0,0 +1,259 @@
+#include "cloud_noise.h"
+
+#include "preamble.glsl"
+#include "noise.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#define CLOUD_NOISE_CACHE_MAGIC 0x4E444C43
+
+namespace
+{
+    struct CloudNoiseHeader
+    {
+        // CLOUD_NOISE_CACHE_MAGIC
+        uint32_t Magic;
+        uint32_t Version;
+        uint32_t Seed;
+        // the layout of the texels, in case preamble.glsl changes
+        int32_t Size;
+        int32_t Layers;
+        float Tile;
+        float Range;
+        uint32_t Reserved;
+    };
+
+    // octaves from the coarsest, in cycles per world unit, and their weights
+    const int kNumOctaves = 4;
+    const double kOctaveFrequency[kNumOctaves] = { 0.25, 0.5, 1.0, 2.0 };
+    const double kOctaveWeight[kNumOctaves] = { 4.0, 3.0, 2.0, 1.0 };
+}
+
+static_assert(sizeof(CloudNoiseHeader) == 32, "the texels should stay aligned");
+
+size_t GetCloudNoiseTexelCount()
+{
+    return (size_t)CLOUD_NOISE_SIZE * CLOUD_NOISE_LAYERS * CLOUD_NOISE_SIZE;
+}
+
+void BakeCloudNoise(uint32_t seed, uint16_t* texels, int maxThreads)
+{
+    PermutationTable perm(seed);
+
+    // the octaves repeat this many lattice cells across the tile
+    int periods[kNumOctaves];
+    for (int octave = 0; octave < kNumOctaves; octave++)
+    {
+        periods[octave] = (int)(CLOUD_NOISE_TILE * kOctaveFrequency[octave]);
+    }
+
+    double texelWidth = CLOUD_NOISE_TILE / CLOUD_NOISE_SIZE;
+    double texelHeight = (CLOUD_TOP - CLOUD_BOTTOM) / CLOUD_NOISE_LAYERS;
+
+    // one job per z slice
+    GetThreadPool().ParallelFor(CLOUD_NOISE_SIZE, maxThreads, [&](int z) {
+        uint16_t* slice = texels + (size_t)z * CLOUD_NOISE_LAYERS * CLOUD_NOISE_SIZE;
+        double worldZ = (z + 0.5) * texelWidth;
+        for (int y = 0; y < CLOUD_NOISE_LAYERS; y++)
+        {
+            double worldY = CLOUD_BOTTOM + (y + 0.5) * texelHeight;
+            for (int x = 0; x < CLOUD_NOISE_SIZE; x++)
+            {
+                double worldX = (x + 0.5) * texelWidth;
+
+                double sum = 0.0;
+                for (int octave = 0; octave < kNumOctaves; octave++)
+                {
+                    double frequency = kOctaveFrequency[octave];
+                    // Perlin3Tiled is in [0, 1], and the octaves are summed signed
+                    double noise = Perlin3Tiled(perm, worldX * frequency, worldY * frequency, worldZ * frequency, periods[octave], 256, periods[octave]);
+                    sum += (noise * 2.0 - 1.0) * kOctaveWeight[octave];
+                }
+
+                double texel = std::max(0.0, std::min(1.0, sum / CLOUD_NOISE_RANGE));
+                slice[y * CLOUD_NOISE_SIZE + x] = (uint16_t)std::lround(texel * 65535.0);
+            }
+        }
+    });
+}
+
+void BuildCloudBricks(const uint16_t* texels, std::vector<CloudBrickLevel>* levels, int maxThreads)
+{
+    levels->resize(CLOUD_BRICK_LEVELS);
+
+    CloudBrickLevel& bricks = (*levels)[0];
+    bricks.SizeX = CLOUD_NOISE_SIZE / CLOUD_BRICK_TEXELS;
+    bricks.SizeY = (CLOUD_NOISE_LAYERS + CLOUD_BRICK_TEXELS - 1) / CLOUD_BRICK_TEXELS;
+    bricks.SizeZ = CLOUD_NOISE_SIZE / CLOUD_BRICK_TEXELS;
+    bricks.MinMax.resize((size_t)bricks.SizeX * bricks.SizeY * bricks.SizeZ * 2);
+
+    // a brick's texels, and the ones next to them, which the filtering blends in at its edges.
+    // they wrap around across the tile, but not through the layer.
+    GetThreadPool().ParallelFor(bricks.SizeZ, maxThreads, [&](int brickZ) {
+        for (int brickY = 0; brickY < bricks.SizeY; brickY++)
+        {
+            int firstY = std::max(brickY * CLOUD_BRICK_TEXELS - 1, 0);
+            int lastY = std::min(brickY * CLOUD_BRICK_TEXELS + CLOUD_BRICK_TEXELS, CLOUD_NOISE_LAYERS - 1);
+            for (int brickX = 0; brickX < bricks.SizeX; brickX++)
+            {
+                uint16_t minTexel = 0xFFFF;
+                uint16_t maxTexel = 0;
+                for (int z = brickZ * CLOUD_BRICK_TEXELS - 1; z <= brickZ * CLOUD_BRICK_TEXELS + CLOUD_BRICK_TEXELS; z++)
+                {
+                    int wrappedZ = (z + CLOUD_NOISE_SIZE) % CLOUD_NOISE_SIZE;
+                    for (int y = firstY; y <= lastY; y++)
+                    {
+                        const uint16_t* row = texels + ((size_t)wrappedZ * CLOUD_NOISE_LAYERS + y) * CLOUD_NOISE_SIZE;
+                        for (int x = brickX * CLOUD_BRICK_TEXELS - 1; x <= brickX * CLOUD_BRICK_TEXELS + CLOUD_BRICK_TEXELS; x++)
+                        {
+                            uint16_t texel = row[(x + CLOUD_NOISE_SIZE) % CLOUD_NOISE_SIZE];
+                            minTexel = std::min(minTexel, texel);
+                            maxTexel = std::max(maxTexel, texel);
+                        }
+                    }
+                }
+
+                size_t brick = ((size_t)brickZ * bricks.SizeY + brickY) * bricks.SizeX + brickX;
+                bricks.MinMax[brick * 2] = minTexel;
+                bricks.MinMax[brick * 2 + 1] = maxTexel;
+            }
+        }
+    });
+
+    // each cell of a level covers 2 cells of the level below it across, and however many it takes to cover the layer up
+    for (int levelIndex = 1; levelIndex < CLOUD_BRICK_LEVELS; levelIndex++)
+    {
+        const CloudBrickLevel& below = (*levels)[levelIndex - 1];
+        CloudBrickLevel& level = (*levels)[levelIndex];
+        level.SizeX = std::max(below.SizeX / 2, 1);
+        level.SizeY = std::max(below.SizeY / 2, 1);
+        level.SizeZ = std::max(below.SizeZ / 2, 1);
+        level.MinMax.resize((size_t)level.SizeX * level.SizeY * level.SizeZ * 2);
+
+        int coverX = below.SizeX / level.SizeX;
+        int coverY = below.SizeY / level.SizeY;
+        int coverZ = below.SizeZ / level.SizeZ;
+        for (int cellZ = 0; cellZ < level.SizeZ; cellZ++)
+        {
+            for (int cellY = 0; cellY < level.SizeY; cellY++)
+            {
+                for (int cellX = 0; cellX < level.SizeX; cellX++)
+                {
+                    uint16_t minTexel = 0xFFFF;
+                    uint16_t maxTexel = 0;
+                    for (int z = cellZ * coverZ; z < (cellZ + 1) * coverZ; z++)
+                    {
+                        for (int y = cellY * coverY; y < (cellY + 1) * coverY; y++)
+                        {
+                            for (int x = cellX * coverX; x < (cellX + 1) * coverX; x++)
+                            {
+                                size_t child = ((size_t)z * below.SizeY + y) * below.SizeX + x;
+                                minTexel = std::min(minTexel, below.MinMax[child * 2]);
+                                maxTexel = std::max(maxTexel, below.MinMax[child * 2 + 1]);
+                            }
+                        }
+                    }
+
+                    size_t cell = ((size_t)cellZ * level.SizeY + cellY) * level.SizeX + cellX;
+                    level.MinMax[cell * 2] = minTexel;
+                    level.MinMax[cell * 2 + 1] = maxTexel;
+                }
+            }
+        }
+    }
+}
+
+static size_t GetCloudNoiseBytes()
+{
+    return sizeof(CloudNoiseHeader) + GetCloudNoiseTexelCount() * sizeof(uint16_t);
+}
+
+CloudNoiseCache::CloudNoiseCache(const std::string& directory)
+    : mDirectory(directory)
+{ }
+
+std::string CloudNoiseCache::GetPath(uint32_t seed) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/clouds_seed%u.bin", seed);
+    return mDirectory + name;
+}
+
+bool CloudNoiseCache::Load(uint32_t seed, CachedCloudNoise* noise)
+{
+    std::string path = GetPath(seed);
+    MappedFile& file = noise->File;
+    if (!file.Open(path.c_str()))
+    {
+        return false;
+    }
+
+    const CloudNoiseHeader* header = static_cast<const CloudNoiseHeader*>(file.GetData());
+
+    bool valid = file.GetSize() == GetCloudNoiseBytes() &&
+        header->Magic == CLOUD_NOISE_CACHE_MAGIC &&
+        header->Version == CLOUD_NOISE_CACHE_VERSION &&
+        header->Seed == seed &&
+        header->Size == CLOUD_NOISE_SIZE &&
+        header->Layers == CLOUD_NOISE_LAYERS &&
+        header->Tile == (float)CLOUD_NOISE_TILE &&
+        header->Range == (float)CLOUD_NOISE_RANGE;
+    if (!valid)
+    {
+        // it'll be overwritten when this noise is stored
+        fprintf(stderr, "Ignoring stale cloud noise cache file %s\n", path.c_str());
+        file.Close();
+        return false;
+    }
+
+    noise->Texels = reinterpret_cast<const uint16_t*>(static_cast<const char*>(file.GetData()) + sizeof(CloudNoiseHeader));
+    return true;
+}
+
+bool CloudNoiseCache::Store(uint32_t seed, const uint16_t* texels)
+{
+    if (!MakeCacheDirectory(mDirectory))
+    {
+        fprintf(stderr, "Failed to create cloud noise cache directory %s\n", mDirectory.c_str());
+        return false;
+    }
+
+    static std::atomic<unsigned> tempCounter{ 0 };
+    std::string path = GetPath(seed);
+    std::string tempPath = path + ".tmp" + std::to_string(tempCounter++);
+
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", tempPath.c_str());
+        return false;
+    }
+
+    CloudNoiseHeader header = {};
+    header.Magic = CLOUD_NOISE_CACHE_MAGIC;
+    header.Version = CLOUD_NOISE_CACHE_VERSION;
+    header.Seed = seed;
+    header.Size = CLOUD_NOISE_SIZE;
+    header.Layers = CLOUD_NOISE_LAYERS;
+    header.Tile = (float)CLOUD_NOISE_TILE;
+    header.Range = (float)CLOUD_NOISE_RANGE;
+
+    size_t numTexels = GetCloudNoiseTexelCount();
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(texels, sizeof(uint16_t), numTexels, file) == numTexels;
+    written = (fclose(file) == 0) && written;
+
+    if (!written || !ReplaceCacheFile(tempPath, path))
+    {
+        fprintf(stderr, "Failed to write cloud noise cache file %s\n", path.c_str());
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
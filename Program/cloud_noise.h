@@ -0,0 +1,72 @@
+#pragma once
+
+#include "terrain_cache.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The clouds' density noise, baked into a 3D texture so the march does one trilinear fetch per step instead of four octaves
+// of noise.
+//
+// The texture covers a CLOUD_NOISE_TILE square of the cloud layer (see preamble.glsl), and repeats across it: each octave is
+// Perlin3Tiled with a period that divides the tile, so the edges line up. Vertically it spans the layer once, from CLOUD_BOTTOM
+// to CLOUD_TOP, since there are no clouds above or below it.
+//
+// The texels are the sum of the octaves, clamped at 0 (where there's no cloud) and stored as 16-bit unorms of
+// [0, CLOUD_NOISE_RANGE]. They depend only on the seed: the cloud thickness scales the density in the shader,
+// so changing it doesn't need a new bake.
+//
+// Baked textures are cached to disk next to the terrain's, like TerrainHeightfieldCache does, and the same cache rules apply:
+// bump CLOUD_NOISE_CACHE_VERSION whenever the baked noise changes for the same seed.
+
+#define CLOUD_NOISE_CACHE_VERSION 1
+
+// texel (x, y, z) is texels[(z * CLOUD_NOISE_LAYERS + y) * CLOUD_NOISE_SIZE + x], with y up, like a GL 3D texture
+size_t GetCloudNoiseTexelCount();
+
+// bakes the noise of seed into texels, with the rows spread over up to maxThreads threads of the shared pool
+void BakeCloudNoise(uint32_t seed, uint16_t* texels, int maxThreads);
+
+// Bricks of the noise, for the march to skip the empty space in (see cast_ray in clouds.glsl).
+// Level 0 has the min and max of each CLOUD_BRICK_TEXELS^3 brick of texels, including the texels around it that the texture's
+// filtering blends in, and each level above has the min and max of the cells of the level below it that it covers.
+// The levels halve in size like mipmaps, and are uploaded as the brick texture's.
+// They hold the noise itself, like the texels, so the threshold and thickness the clouds are drawn with are applied in the shader,
+// and only a new seed builds them again.
+struct CloudBrickLevel
+{
+    int SizeX = 0;
+    int SizeY = 0;
+    int SizeZ = 0;
+    // SizeX * SizeY * SizeZ pairs of min and max, in the texels' units, in the texels' layout
+    std::vector<uint16_t> MinMax;
+};
+
+// builds the CLOUD_BRICK_LEVELS levels of bricks of the noise's texels
+void BuildCloudBricks(const uint16_t* texels, std::vector<CloudBrickLevel>* levels, int maxThreads);
+
+// the baked noise of a seed, loaded from the cache. Texels points into the mapping, so it stays valid as long as this does.
+struct CachedCloudNoise
+{
+    MappedFile File;
+    const uint16_t* Texels = nullptr;
+};
+
+class CloudNoiseCache
+{
+    std::string mDirectory;
+
+public:
+    // the directory is created on the first store
+    explicit CloudNoiseCache(const std::string& directory = "terrain_cache");
+
+    std::string GetPath(uint32_t seed) const;
+
+    // maps the noise of seed. Returns false if it isn't cached, or the file is stale or truncated.
+    bool Load(uint32_t seed, CachedCloudNoise* noise);
+
+    // writes the noise of seed, under a temporary name that is then renamed, like TerrainHeightfieldCache::Store
+    bool Store(uint32_t seed, const uint16_t* texels);
+};
@@ -0,0 +1,21 @@
+// Cloud shadow pass. Marches the clouds (clouds.glsl) through the layer toward the light, once per texel of a map that covers
+// a tile of the noise on the layer's bottom plane, and writes how much light gets through, for scene.frag.
+// The noise tiles across the layer, so for a fixed direction the map does too.
+
+// the direction to the light, pointing up
+uniform vec3 ToLight;
+
+out float CloudTransmittance;
+
+// from clouds.glsl
+float cast_ray(vec3 origin, vec3 target, out float num_steps);
+
+void main()
+{
+    vec2 xz = gl_FragCoord.xy / CLOUD_SHADOW_SIZE * CLOUD_NOISE_TILE;
+    vec3 origin = vec3(xz.x, CLOUD_BOTTOM, xz.y);
+    vec3 target = origin + ToLight * ((CLOUD_TOP - CLOUD_BOTTOM) / ToLight.y);
+
+    float num_steps;
+    CloudTransmittance = 1.0 - cast_ray(origin, target, num_steps);
+}
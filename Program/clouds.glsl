@@ -0,0 +1,179 @@
+// Cloud density, and the ray march through it.
+// Linked into a program as an extra shader object of the stage that calls cast_ray (see cloud_march.frag).
+
+uniform float CloudThickness;
+
+// the sum of the noise's octaves, baked by BakeCloudNoise
+uniform sampler3D CloudNoise;
+
+float cloud_noise(vec3 point) {
+    // the noise is zero outside of the layer, and tiles across it
+    if(point.y <= CLOUD_BOTTOM || point.y >= CLOUD_TOP)
+        return 0.0;
+    vec3 texcoord = vec3(point.x / CLOUD_NOISE_TILE, (point.y - CLOUD_BOTTOM) / (CLOUD_TOP - CLOUD_BOTTOM), point.z / CLOUD_NOISE_TILE);
+    return texture(CloudNoise, texcoord).r * CLOUD_NOISE_RANGE;
+}
+
+// how much of the noise is cloud: all of it over 0 at 1, and none under CLOUD_COVERAGE_THRESHOLD at 0
+uniform float CloudCoverage;
+const float CLOUD_COVERAGE_THRESHOLD = 4.0;
+
+float cloud_threshold() {
+    return (1.0 - CloudCoverage) * CLOUD_COVERAGE_THRESHOLD;
+}
+
+float sample_cloud(vec3 point){
+	return 0.02 * max(cloud_noise(point) - cloud_threshold(), 0.0) * CloudThickness;
+}
+
+// the min and max of the noise in bricks of it, with CLOUD_BRICK_LEVELS levels (see BuildCloudBricks)
+uniform sampler3D CloudBricks;
+
+// where a ray from point leaves a cell, in distance along it
+float cell_exit(vec3 point, vec3 direction, vec3 inverse_direction, vec3 cell, vec3 cell_size) {
+    vec3 to_bounds = ((cell + step(0.0, direction)) * cell_size - point) * inverse_direction;
+    return min(min(to_bounds.x, to_bounds.y), to_bounds.z);
+}
+
+// finds the coarsest brick around the point at t with no cloud in it, and returns where the ray leaves it.
+// If even the finest brick there has some, returns -1, and where the ray leaves that brick in occupied_exit.
+float skip_empty_bricks(vec3 origin, vec3 direction, vec3 inverse_direction, float t, out float occupied_exit) {
+    vec3 point = origin + direction * t - vec3(0.0, CLOUD_BOTTOM, 0.0);
+    vec3 layer_size = vec3(CLOUD_NOISE_TILE, CLOUD_TOP - CLOUD_BOTTOM, CLOUD_NOISE_TILE);
+    float threshold = cloud_threshold();
+
+    // from the finest level up, since most of the finest bricks have some cloud
+    float empty_exit = -1.0;
+    occupied_exit = t;
+    for(int level = 0; level < CLOUD_BRICK_LEVELS; level++) {
+        ivec3 num_cells = textureSize(CloudBricks, level);
+        vec3 cell_size = layer_size / vec3(num_cells);
+        vec3 cell = floor(point / cell_size);
+
+        // the bricks tile across the layer, like the noise
+        ivec3 texel = ivec3(mod(cell, vec3(num_cells)));
+        texel.y = clamp(int(cell.y), 0, num_cells.y - 1);
+        float exit = t + cell_exit(point, direction, inverse_direction, cell, cell_size);
+        if(texelFetch(CloudBricks, texel, level).g * CLOUD_NOISE_RANGE > threshold) {
+            if(level == 0) {
+                occupied_exit = exit;
+            }
+            break;
+        }
+        empty_exit = exit;
+    }
+    return empty_exit;
+}
+
+// the march steps this far through clouds, and this far through empty space until it finds one
+const float CLOUD_FINE_STEP = 0.1;
+const float CLOUD_COARSE_STEP = 0.3;
+// fine steps through empty space before going back to coarse ones
+const int CLOUD_EMPTY_STEPS_TO_COARSE = 4;
+
+// while off, rays are marched from the camera in fine steps, like they used to be (for comparison)
+uniform bool CloudSkipEmpty;
+// while off, the coarse steps don't jump over empty bricks (for comparison)
+uniform bool CloudUseBricks;
+
+float cast_ray(vec3 origin, vec3 target, out float num_steps) {
+    // adapted from Real-Time Rendering of Volumetric Clouds, by Rikard Olajo
+    float blocked = 0;
+    num_steps = 0;
+
+    // not called distance, which would hide the builtin
+    float ray_length = distance(target, origin);
+    vec3 direction = normalize(target - origin);
+
+    // the clouds past this are left out
+    ray_length = min(ray_length, CLOUD_MAX_DISTANCE);
+
+    if(!CloudSkipEmpty) {
+        for(float i = 0; i < ray_length; i += CLOUD_FINE_STEP) {
+            num_steps += 1;
+            blocked = blocked + sample_cloud(origin + direction * i);
+            if(blocked >= 1.0) {
+                return 1.0;
+            }
+        }
+        return blocked;
+    }
+
+    if(CloudThickness <= 0.0) {
+        return 0.0;
+    }
+
+    // the part of the ray inside the cloud layer, since the density is zero everywhere else
+    float enter = 0.0;
+    float leave = ray_length;
+    if(abs(direction.y) > 1e-6) {
+        float to_bottom = (CLOUD_BOTTOM - origin.y) / direction.y;
+        float to_top = (CLOUD_TOP - origin.y) / direction.y;
+        enter = max(enter, min(to_bottom, to_top));
+        leave = min(leave, max(to_bottom, to_top));
+    }
+    else if(origin.y <= CLOUD_BOTTOM || origin.y >= CLOUD_TOP) {
+        return 0.0;
+    }
+
+    // axes the ray is parallel to never reach a brick's bounds
+    vec3 inverse_direction = 1.0 / max(abs(direction), vec3(1e-6)) * sign(direction);
+    inverse_direction = mix(inverse_direction, vec3(1e6), equal(direction, vec3(0.0)));
+
+    // coarse steps until a sample is in a cloud, then fine steps through it from just past the last empty sample,
+    // until a few fine samples in a row are empty again. Only the fine samples add to the clouds.
+    // The coarse steps jump over the bricks without any cloud in them.
+    // The bricks are only looked up when the coarse steps go into a new one.
+    bool fine = false;
+    int empty_steps = 0;
+    float last_empty = enter - CLOUD_FINE_STEP;
+    float occupied_exit = enter;
+    float t = enter;
+    while(t < leave) {
+        num_steps += 1;
+
+        if(!fine && CloudUseBricks && t >= occupied_exit) {
+            float brick_exit = skip_empty_bricks(origin, direction, inverse_direction, t, occupied_exit);
+            if(brick_exit >= 0.0) {
+                // a little past the bounds, so the next step is in the next brick
+                last_empty = brick_exit - CLOUD_FINE_STEP;
+                t = brick_exit + 1e-3;
+                continue;
+            }
+        }
+
+        float density = sample_cloud(origin + direction * t);
+
+        if(!fine) {
+            if(density > 0.0) {
+                fine = true;
+                empty_steps = 0;
+                t = last_empty + CLOUD_FINE_STEP;
+            }
+            else {
+                last_empty = t;
+                t += CLOUD_COARSE_STEP;
+            }
+            continue;
+        }
+
+        blocked = blocked + density;
+        if(blocked >= 1.0) {
+            return 1.0;
+        }
+
+        if(density > 0.0) {
+            empty_steps = 0;
+        }
+        else {
+            empty_steps++;
+            last_empty = t;
+        }
+        if(empty_steps >= CLOUD_EMPTY_STEPS_TO_COARSE) {
+            fine = false;
+        }
+        t += CLOUD_FINE_STEP;
+    }
+
+    return blocked;
+}
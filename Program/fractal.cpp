@@ -0,0 +1,74 @@
+#include "fractal.h"
+
+#include <cmath>
+#include <utility>
+
+const char* GetFractalTypeName(FractalType type)
+{
+    switch (type)
+    {
+    case FractalType::HybridMultifractal: return "Hybrid multifractal";
+    case FractalType::FBm:                return "fBm";
+    case FractalType::RidgedMultifractal: return "Ridged multifractal";
+    case FractalType::Spectral:           return "Spectral (FFT)";
+    }
+    return "Unknown";
+}
+
+SpectralTable MakeSpectralTable(double H, double lacunarity)
+{
+    SpectralTable table = {};
+    double frequency = 1.0;
+    for (int k = 0; k < FRACTAL_MAX_OCTAVES; k++)
+    {
+        table.Weights[k] = (float)std::pow(frequency, -H);
+        table.Frequencies[k] = (float)frequency;
+        frequency *= lacunarity;
+    }
+    return table;
+}
+
+const SpectralTable kTerrainSpectralTable = MakeSpectralTable(TerrainSpectrum::H, TerrainSpectrum::Lacunarity);
+
+// kFractalFunctions<Generator>::Table[octaves - FRACTAL_MIN_OCTAVES] is Generator<PerlinBasis, octaves>::Generate
+template<template<class, int> class Generator, class Octaves>
+struct FractalFunctionTable;
+
+template<template<class, int> class Generator, int... Offsets>
+struct FractalFunctionTable<Generator, std::integer_sequence<int, Offsets...>>
+{
+    static constexpr FractalFunction Table[] = {
+        &Generator<PerlinBasis, FRACTAL_MIN_OCTAVES + Offsets>::Generate...
+    };
+};
+
+template<template<class, int> class Generator, int... Offsets>
+constexpr FractalFunction FractalFunctionTable<Generator, std::integer_sequence<int, Offsets...>>::Table[];
+
+typedef std::make_integer_sequence<int, FRACTAL_MAX_OCTAVES - FRACTAL_MIN_OCTAVES + 1> FractalOctaveOffsets;
+
+FractalFunction GetFractalFunction(FractalType type, int octaves)
+{
+    if (octaves < FRACTAL_MIN_OCTAVES)
+    {
+        octaves = FRACTAL_MIN_OCTAVES;
+    }
+    if (octaves > FRACTAL_MAX_OCTAVES)
+    {
+        octaves = FRACTAL_MAX_OCTAVES;
+    }
+
+    int index = octaves - FRACTAL_MIN_OCTAVES;
+    switch (type)
+    {
+    case FractalType::FBm:
+        return FractalFunctionTable<FBm, FractalOctaveOffsets>::Table[index];
+    case FractalType::RidgedMultifractal:
+        return FractalFunctionTable<RidgedMultifractal, FractalOctaveOffsets>::Table[index];
+    case FractalType::Spectral:
+        return nullptr;
+    case FractalType::HybridMultifractal:
+    default:
+        return FractalFunctionTable<HybridMultifractal, FractalOctaveOffsets>::Table[index];
+    }
+}
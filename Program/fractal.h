@@ -0,0 +1,296 @@
+#pragma once
+
+#include "noise.h"
+#include "arena.h"
+
+#include <cstddef>
+#include <type_traits>
+
+// Fractal noise (sums of octaves of a basis noise), from "Procedural Fractal Terrains", F. Kenton Musgrave.
+//
+// The generators are templates over the basis function and the octave count, so the octave loop is unrolled.
+// The spectral weights and frequencies (H and lacunarity) are a runtime table, so they can be tweaked without recompiling.
+// GetFractalFunction picks one of the precompiled specializations at runtime.
+//
+// Every generator also returns the analytic derivatives of its value by the unscaled grid coordinates
+// ((OriginX + i) / SamplesPerUnit), carried through the octaves with the product rule.
+
+enum class FractalType
+{
+    HybridMultifractal,
+    FBm,
+    RidgedMultifractal,
+    // fBm synthesized from its spectrum with an FFT (see spectral.h) rather than summed from octaves.
+    // It has no FractalFunction, since it makes the whole grid at once.
+    Spectral,
+};
+
+// octave counts with a precompiled specialization
+#define FRACTAL_MIN_OCTAVES 1
+#define FRACTAL_MAX_OCTAVES 12
+
+const char* GetFractalTypeName(FractalType type);
+
+struct SpectralTable;
+
+// samples a grid of fractal noise with the octave weights and frequencies of spectrum: value[n] and its derivatives by x and y.
+// grid.Frequency is ignored.
+typedef void (*FractalFunction)(const PermutationTable& perm, const NoiseGrid& grid, const SpectralTable& spectrum, float* value, float* valueDx, float* valueDy);
+
+// octaves is clamped to [FRACTAL_MIN_OCTAVES, FRACTAL_MAX_OCTAVES]. Returns null for FractalType::Spectral.
+FractalFunction GetFractalFunction(FractalType type, int octaves);
+
+// spectral weight and frequency of each octave: weight k = lacunarity^(-H k), frequency k = lacunarity^k.
+// the first octaves don't depend on the octave count, so one table of FRACTAL_MAX_OCTAVES serves every specialization.
+struct SpectralTable
+{
+    float Weights[FRACTAL_MAX_OCTAVES];
+    float Frequencies[FRACTAL_MAX_OCTAVES];
+};
+
+SpectralTable MakeSpectralTable(double H, double lacunarity);
+
+// the terrain's default spectrum: rough (low H), with the usual doubling of frequency per octave
+struct TerrainSpectrum
+{
+    static constexpr double H = 0.25;
+    static constexpr double Lacunarity = 2.0;
+};
+
+// the weights of the default spectrum, made at static initialization
+extern const SpectralTable kTerrainSpectralTable;
+
+// Perlin noise basis, in [0, 1]
+struct PerlinBasis
+{
+    static void Sample(const PermutationTable& perm, const NoiseGrid& grid, float* out, float* outDx, float* outDy)
+    {
+        PerlinGrid2DDeriv(perm, grid, out, outDx, outDy);
+    }
+};
+
+// calls func(std::integral_constant<int, K>()) for K in [First, Last), unrolled at compile time
+template<int First, int Last>
+struct UnrollOctaves
+{
+    template<class Func>
+    static void Run(Func& func)
+    {
+        func(std::integral_constant<int, First>());
+        UnrollOctaves<First + 1, Last>::Run(func);
+    }
+};
+
+template<int Last>
+struct UnrollOctaves<Last, Last>
+{
+    template<class Func>
+    static void Run(Func&) { }
+};
+
+// scratch for one octave of basis samples
+struct OctaveSamples
+{
+    float* Noise;
+    float* NoiseDx;
+    float* NoiseDy;
+
+    OctaveSamples(ScratchArena& scratch, size_t count)
+        : Noise(scratch.Allocate<float>(count))
+        , NoiseDx(scratch.Allocate<float>(count))
+        , NoiseDy(scratch.Allocate<float>(count))
+    { }
+
+    template<class Basis>
+    void Sample(const PermutationTable& perm, NoiseGrid grid, float frequency)
+    {
+        grid.Frequency = frequency;
+        Basis::Sample(perm, grid, Noise, NoiseDx, NoiseDy);
+    }
+};
+
+inline size_t FractalSampleCount(const NoiseGrid& grid)
+{
+    return (size_t)grid.SizeX * grid.SizeY;
+}
+
+// hybrid multifractal: each octave is scaled by the (clamped) product of the previous ones,
+// so valleys stay smooth while peaks get rough. Output is roughly [0, 10] with the default terrain spectrum.
+template<class Basis, int Octaves>
+struct HybridMultifractal
+{
+    static void Generate(const PermutationTable& perm, const NoiseGrid& grid, const SpectralTable& table, float* value, float* valueDx, float* valueDy)
+    {
+        size_t count = FractalSampleCount(grid);
+
+        ScratchArena& scratch = GetScratchArena();
+        ScratchScope scratchScope(scratch);
+        OctaveSamples octave(scratch, count);
+        float* weight = scratch.Allocate<float>(count);
+        float* weightDx = scratch.Allocate<float>(count);
+        float* weightDy = scratch.Allocate<float>(count);
+
+        // the first octave's frequency is always 1
+        const float firstWeight = table.Weights[0];
+        octave.Sample<Basis>(perm, grid, table.Frequencies[0]);
+        for (size_t n = 0; n < count; n++)
+        {
+            value[n] = octave.Noise[n] * 2 * firstWeight;
+            weight[n] = value[n];
+
+            valueDx[n] = octave.NoiseDx[n] * 2 * firstWeight;
+            valueDy[n] = octave.NoiseDy[n] * 2 * firstWeight;
+            weightDx[n] = valueDx[n];
+            weightDy[n] = valueDy[n];
+        }
+
+        auto addOctave = [&](auto k) {
+            constexpr int K = decltype(k)::value;
+            const float frequency = table.Frequencies[K];
+            const float spectralWeight = table.Weights[K];
+
+            octave.Sample<Basis>(perm, grid, frequency);
+            for (size_t n = 0; n < count; n++)
+            {
+                if (weight[n] > 2.0)
+                {
+                    weight[n] = 2.0;
+                    weightDx[n] = 0.0f;
+                    weightDy[n] = 0.0f;
+                }
+
+                float signal = octave.Noise[n] * 2 * spectralWeight;
+                value[n] += signal * weight[n];
+
+                // this octave is sampled at frequency * (x, y)
+                float signalDx = octave.NoiseDx[n] * frequency * 2 * spectralWeight;
+                float signalDy = octave.NoiseDy[n] * frequency * 2 * spectralWeight;
+                valueDx[n] += signalDx * weight[n] + signal * weightDx[n];
+                valueDy[n] += signalDy * weight[n] + signal * weightDy[n];
+                weightDx[n] = weightDx[n] * signal + weight[n] * signalDx;
+                weightDy[n] = weightDy[n] * signal + weight[n] * signalDy;
+
+                weight[n] *= signal;
+            }
+        };
+        UnrollOctaves<1, Octaves>::Run(addOctave);
+    }
+};
+
+// fractional Brownian motion: the plain weighted sum of the octaves, with the basis made signed ([-1, 1]).
+// Output is centred on 0, roughly [-1.5, 1.5] with the default terrain spectrum.
+template<class Basis, int Octaves>
+struct FBm
+{
+    static void Generate(const PermutationTable& perm, const NoiseGrid& grid, const SpectralTable& table, float* value, float* valueDx, float* valueDy)
+    {
+        size_t count = FractalSampleCount(grid);
+
+        ScratchArena& scratch = GetScratchArena();
+        ScratchScope scratchScope(scratch);
+        OctaveSamples octave(scratch, count);
+
+        for (size_t n = 0; n < count; n++)
+        {
+            value[n] = 0.0f;
+            valueDx[n] = 0.0f;
+            valueDy[n] = 0.0f;
+        }
+
+        auto addOctave = [&](auto k) {
+            constexpr int K = decltype(k)::value;
+            const float frequency = table.Frequencies[K];
+            const float spectralWeight = table.Weights[K];
+
+            octave.Sample<Basis>(perm, grid, frequency);
+            for (size_t n = 0; n < count; n++)
+            {
+                value[n] += (octave.Noise[n] * 2 - 1) * spectralWeight;
+                valueDx[n] += octave.NoiseDx[n] * frequency * 2 * spectralWeight;
+                valueDy[n] += octave.NoiseDy[n] * frequency * 2 * spectralWeight;
+            }
+        };
+        UnrollOctaves<0, Octaves>::Run(addOctave);
+    }
+};
+
+// ridged multifractal: octaves of (1 - |noise|)^2, each scaled by the previous one, which makes sharp ridges.
+// Output is roughly [1, 5] with the default terrain spectrum.
+template<class Basis, int Octaves>
+struct RidgedMultifractal
+{
+    static void Generate(const PermutationTable& perm, const NoiseGrid& grid, const SpectralTable& table, float* value, float* valueDx, float* valueDy)
+    {
+        const float offset = 1.0f;
+        const float gain = 2.0f;
+
+        size_t count = FractalSampleCount(grid);
+
+        ScratchArena& scratch = GetScratchArena();
+        ScratchScope scratchScope(scratch);
+        OctaveSamples octave(scratch, count);
+        // the previous octave's signal
+        float* signal = scratch.Allocate<float>(count);
+        float* signalDx = scratch.Allocate<float>(count);
+        float* signalDy = scratch.Allocate<float>(count);
+
+        for (size_t n = 0; n < count; n++)
+        {
+            value[n] = 0.0f;
+            valueDx[n] = 0.0f;
+            valueDy[n] = 0.0f;
+        }
+
+        auto addOctave = [&](auto k) {
+            constexpr int K = decltype(k)::value;
+            const float frequency = table.Frequencies[K];
+            const float spectralWeight = table.Weights[K];
+
+            octave.Sample<Basis>(perm, grid, frequency);
+            for (size_t n = 0; n < count; n++)
+            {
+                // the basis is [0, 1], so 2n - 1 is the signed noise. Its zero crossings become the ridges.
+                float signedNoise = octave.Noise[n] * 2 - 1;
+                float sign = signedNoise < 0.0f ? -1.0f : 1.0f;
+                float ridge = offset - signedNoise * sign;
+                float ridgeDx = -sign * octave.NoiseDx[n] * frequency * 2;
+                float ridgeDy = -sign * octave.NoiseDy[n] * frequency * 2;
+
+                float s = ridge * ridge;
+                float sDx = 2 * ridge * ridgeDx;
+                float sDy = 2 * ridge * ridgeDy;
+
+                if (K > 0)
+                {
+                    // weight by the previous octave, so ridges only get detail on top of other ridges
+                    float weight = signal[n] * gain;
+                    float weightDx = signalDx[n] * gain;
+                    float weightDy = signalDy[n] * gain;
+                    if (weight > 1.0f)
+                    {
+                        weight = 1.0f;
+                        weightDx = weightDy = 0.0f;
+                    }
+                    else if (weight < 0.0f)
+                    {
+                        weight = 0.0f;
+                        weightDx = weightDy = 0.0f;
+                    }
+
+                    sDx = sDx * weight + s * weightDx;
+                    sDy = sDy * weight + s * weightDy;
+                    s *= weight;
+                }
+
+                signal[n] = s;
+                signalDx[n] = sDx;
+                signalDy[n] = sDy;
+
+                value[n] += s * spectralWeight;
+                valueDx[n] += sDx * spectralWeight;
+                valueDy[n] += sDy * spectralWeight;
+            }
+        };
+        UnrollOctaves<0, Octaves>::Run(addOctave);
+    }
+};
@@ -0,0 +1,10 @@
+// One triangle covering the screen, for the screen-space passes. Draw 3 vertices with no attributes.
+
+out vec2 screen_texcoord;
+
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    screen_texcoord = corner;
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
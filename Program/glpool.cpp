@@ -0,0 +1,255 @@
+#include "glpool.h"
+
+#include <cstdio>
+
+static size_t TextureBytes(GLenum internalFormat, GLsizei width, GLsizei height)
+{
+    size_t texelBytes;
+    switch (internalFormat)
+    {
+    case GL_R16:
+    case GL_RG8_SNORM: texelBytes = 2; break;
+    case GL_R32F:    texelBytes = 4; break;
+    case GL_RGBA16F: texelBytes = 8; break;
+    case GL_RGBA32F: texelBytes = 16; break;
+    default:         texelBytes = 4; break;
+    }
+    return texelBytes * width * height;
+}
+
+GLResourcePool::~GLResourcePool()
+{
+    MaxIdleBytes = 0;
+    Trim();
+
+    for (BufferFence& pending : mPendingFences)
+    {
+        glDeleteSync(pending.Fence);
+    }
+
+    for (GLuint vertexArray : mIdleVertexArrays)
+    {
+        glDeleteVertexArrays(1, &vertexArray);
+    }
+}
+
+void GLResourcePool::Trim()
+{
+    while (mIdleBytes > MaxIdleBytes && (!mIdleBuffers.empty() || !mIdleTextures.empty()))
+    {
+        // drop from whichever list has the bigger oldest object
+        bool dropBuffer = mIdleTextures.empty() ||
+            (!mIdleBuffers.empty() && (size_t)mIdleBuffers.back().Size >= TextureBytes(mIdleTextures.back().InternalFormat, mIdleTextures.back().Width, mIdleTextures.back().Height));
+
+        if (dropBuffer)
+        {
+            IdleBuffer& idle = mIdleBuffers.back();
+            glDeleteSync(idle.Fence);
+            glDeleteBuffers(1, &idle.Buffer);
+            mIdleBytes -= idle.Size;
+            mIdleBuffers.pop_back();
+        }
+        else
+        {
+            IdleTexture& idle = mIdleTextures.back();
+            glDeleteTextures(1, &idle.Texture);
+            mIdleBytes -= TextureBytes(idle.InternalFormat, idle.Width, idle.Height);
+            mIdleTextures.pop_back();
+        }
+    }
+}
+
+GLuint GLResourcePool::AcquireBuffer(GLsizeiptr size)
+{
+    for (auto idle = mIdleBuffers.begin(); idle != mIdleBuffers.end(); ++idle)
+    {
+        if (idle->Size == size)
+        {
+            GLuint buffer = idle->Buffer;
+
+            // most buffers sat in the pool for a few frames, so their fence is long signaled
+            GLenum status = glClientWaitSync(idle->Fence, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            {
+                glDeleteSync(idle->Fence);
+            }
+            else
+            {
+                mPendingFences.push_back(BufferFence{ buffer, idle->Fence });
+            }
+
+            mIdleBytes -= idle->Size;
+            mIdleBuffers.erase(idle);
+            NumRecycled++;
+            return buffer;
+        }
+    }
+
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    NumCreated++;
+    return buffer;
+}
+
+GLuint GLResourcePool::AcquireTexture2D(GLenum internalFormat, GLsizei width, GLsizei height)
+{
+    for (auto idle = mIdleTextures.begin(); idle != mIdleTextures.end(); ++idle)
+    {
+        if (idle->InternalFormat == internalFormat && idle->Width == width && idle->Height == height)
+        {
+            GLuint texture = idle->Texture;
+            mIdleBytes -= TextureBytes(internalFormat, width, height);
+            mIdleTextures.erase(idle);
+            NumRecycled++;
+            return texture;
+        }
+    }
+
+    // immutable storage would be nicer, but glTexStorage2D is GL 4.2
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RED, GL_FLOAT, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    NumCreated++;
+    return texture;
+}
+
+GLuint GLResourcePool::AcquireVertexArray()
+{
+    if (!mIdleVertexArrays.empty())
+    {
+        GLuint vertexArray = mIdleVertexArrays.front();
+        mIdleVertexArrays.pop_front();
+        NumRecycled++;
+        return vertexArray;
+    }
+
+    GLuint vertexArray;
+    glGenVertexArrays(1, &vertexArray);
+    NumCreated++;
+    return vertexArray;
+}
+
+void GLResourcePool::DeletePendingFence(GLuint buffer)
+{
+    for (size_t i = 0; i < mPendingFences.size(); i++)
+    {
+        if (mPendingFences[i].Buffer == buffer)
+        {
+            glDeleteSync(mPendingFences[i].Fence);
+            mPendingFences[i] = mPendingFences.back();
+            mPendingFences.pop_back();
+            return;
+        }
+    }
+}
+
+void* GLResourcePool::MapBuffer(GLuint buffer, GLsizeiptr size)
+{
+    for (const BufferFence& pending : mPendingFences)
+    {
+        if (pending.Buffer != buffer)
+        {
+            continue;
+        }
+
+        // only a buffer retired in the last few frames gets here
+        GLenum status;
+        do
+        {
+            status = glClientWaitSync(pending.Fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+
+        if (status == GL_WAIT_FAILED)
+        {
+            fprintf(stderr, "MapBuffer: waiting for buffer %u failed\n", buffer);
+        }
+        break;
+    }
+    DeletePendingFence(buffer);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    void* data = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (!data)
+    {
+        fprintf(stderr, "MapBuffer: couldn't map %lld bytes of buffer %u\n", (long long)size, buffer);
+    }
+    return data;
+}
+
+bool GLResourcePool::UnmapBuffer(GLuint buffer)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    GLboolean intact = glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (!intact)
+    {
+        fprintf(stderr, "UnmapBuffer: the contents of buffer %u were lost\n", buffer);
+    }
+    return intact == GL_TRUE;
+}
+
+void GLResourcePool::RetireBuffer(GLuint buffer)
+{
+    if (!buffer)
+    {
+        return;
+    }
+
+    GLint size;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // a fence from its last time in the pool is superseded by this one
+    DeletePendingFence(buffer);
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    mIdleBuffers.push_front(IdleBuffer{ buffer, size, fence });
+    mIdleBytes += size;
+    Trim();
+}
+
+void GLResourcePool::RetireTexture2D(GLuint texture)
+{
+    if (!texture)
+    {
+        return;
+    }
+
+    IdleTexture idle;
+    idle.Texture = texture;
+
+    GLint internalFormat, width, height;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    idle.InternalFormat = internalFormat;
+    idle.Width = width;
+    idle.Height = height;
+
+    mIdleTextures.push_front(idle);
+    mIdleBytes += TextureBytes(idle.InternalFormat, width, height);
+    Trim();
+}
+
+void GLResourcePool::RetireVertexArray(GLuint vertexArray)
+{
+    if (!vertexArray)
+    {
+        return;
+    }
+
+    mIdleVertexArrays.push_front(vertexArray);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <vector>
+
+// Recycles retired GL buffers, textures and vertex arrays.
+// Terrain that is destroyed (a regenerated world, an evicted chunk) hands its objects to the pool, and the next terrain
+// of the same size takes them back instead of creating new ones, so regenerating doesn't churn driver allocations.
+// Idle objects past the memory budget are deleted, oldest first.
+//
+// Buffers can also be mapped for writing, eg. by worker threads that generate vertices straight into them.
+// Retired buffers are fenced, so the mapping doesn't have to be synchronized with the GPU: MapBuffer only waits if the GPU
+// could still be reading a recycled buffer for its last user.
+class GLResourcePool
+{
+    struct IdleBuffer
+    {
+        GLuint Buffer;
+        GLsizeiptr Size;
+        // signaled once the GPU is done with the buffer's last user
+        GLsync Fence;
+    };
+
+    struct BufferFence
+    {
+        GLuint Buffer;
+        GLsync Fence;
+    };
+
+    struct IdleTexture
+    {
+        GLuint Texture;
+        GLenum InternalFormat;
+        GLsizei Width;
+        GLsizei Height;
+    };
+
+    // most recently retired at the front
+    std::list<IdleBuffer> mIdleBuffers;
+    std::list<IdleTexture> mIdleTextures;
+    std::list<GLuint> mIdleVertexArrays;
+
+    // fences of recycled buffers that were handed out before they were signaled, for MapBuffer
+    std::vector<BufferFence> mPendingFences;
+
+    size_t mIdleBytes = 0;
+
+    void Trim();
+    void DeletePendingFence(GLuint buffer);
+
+public:
+    // idle objects are deleted once they take more than this much memory
+    size_t MaxIdleBytes = 256 * 1024 * 1024;
+
+    // number of objects handed out from the pool and number created, for the stats display
+    uint64_t NumRecycled = 0;
+    uint64_t NumCreated = 0;
+
+    ~GLResourcePool();
+
+    // a buffer with size bytes of uninitialized storage
+    GLuint AcquireBuffer(GLsizeiptr size);
+    // a 2D texture with one level of uninitialized storage. Filtering and wrapping are left as the last user set them.
+    GLuint AcquireTexture2D(GLenum internalFormat, GLsizei width, GLsizei height);
+    // a vertex array, possibly with state from its last user. Only recycle vertex arrays between users that set the same attributes.
+    GLuint AcquireVertexArray();
+
+    // maps all size bytes of a buffer from AcquireBuffer for writing, discarding its contents. Returns null if it can't be mapped.
+    // the pointer can be written from any thread until UnmapBuffer, but GL can't use the buffer meanwhile (eg. to draw).
+    void* MapBuffer(GLuint buffer, GLsizeiptr size);
+    // returns false if the buffer's contents were lost while it was mapped, which GL allows (eg. on a display mode change)
+    bool UnmapBuffer(GLuint buffer);
+
+    // hands an object back to the pool. 0 is ignored.
+    void RetireBuffer(GLuint buffer);
+    void RetireTexture2D(GLuint texture);
+    void RetireVertexArray(GLuint vertexArray);
+
+    size_t GetIdleBytes() const { return mIdleBytes; }
+};
@@ -0,0 +1,214 @@
+#include "gridindex.h"
+
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdio>
+
+static void WriteSquare(int gridSize, int i, int j, uint32_t* indices)
+{
+    uint32_t topLeft = (uint32_t)(i * (gridSize + 1) + j);
+    uint32_t bottomLeft = topLeft + (uint32_t)(gridSize + 1);
+
+    // triangle 1
+    indices[0] = topLeft;
+    indices[1] = bottomLeft;
+    indices[2] = topLeft + 1;
+    // triangle 2
+    indices[3] = bottomLeft + 1;
+    indices[4] = bottomLeft;
+    indices[5] = topLeft + 1;
+}
+
+// calls visit(i, j) for the squares of a grid in strip order
+template<class Visit>
+static void ForEachSquare(int gridSize, int stripWidth, Visit visit)
+{
+    for (int stripStart = 0; stripStart < gridSize; stripStart += stripWidth)
+    {
+        int stripEnd = std::min(stripStart + stripWidth, gridSize);
+        for (int i = 0; i < gridSize; i++)
+        {
+            for (int j = stripStart; j < stripEnd; j++)
+            {
+                visit(i, j);
+            }
+        }
+    }
+}
+
+void GenerateGridIndices(int gridSize, uint32_t* indices)
+{
+    ForEachSquare(gridSize, GRID_INDEX_STRIP_WIDTH, [&](int i, int j) {
+        WriteSquare(gridSize, i, j, indices);
+        indices += 6;
+    });
+}
+
+int GetSubgridSize(int gridSize, int step)
+{
+    return (gridSize + step - 1) / step;
+}
+
+void GenerateSubgridIndices(int gridSize, int step, uint32_t* indices)
+{
+    int subgridSize = GetSubgridSize(gridSize, step);
+    auto vertex = [&](int i, int j) {
+        return (uint32_t)(std::min(i * step, gridSize) * (gridSize + 1) + std::min(j * step, gridSize));
+    };
+
+    for (int stripStart = 0; stripStart < subgridSize; stripStart += GRID_INDEX_STRIP_WIDTH)
+    {
+        int stripEnd = std::min(stripStart + GRID_INDEX_STRIP_WIDTH, subgridSize);
+        for (int i = 0; i < subgridSize; i++)
+        {
+            for (int j = stripStart; j < stripEnd; j++)
+            {
+                // the same triangles as WriteSquare
+                indices[0] = vertex(i, j);
+                indices[1] = vertex(i + 1, j);
+                indices[2] = vertex(i, j + 1);
+                indices[3] = vertex(i + 1, j + 1);
+                indices[4] = vertex(i + 1, j);
+                indices[5] = vertex(i, j + 1);
+                indices += 6;
+            }
+        }
+    }
+}
+
+float ComputeGridACMR(int gridSize, int stripWidth, int cacheSize)
+{
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+
+    // with a FIFO, a vertex is still cached if fewer than cacheSize misses happened since it was loaded.
+    // 32 bits is plenty, the biggest grids have ~17M vertices.
+    size_t numVertices = (size_t)(gridSize + 1) * (gridSize + 1);
+    uint32_t* loadedAt = scratch.Allocate<uint32_t>(numVertices);
+    std::fill(loadedAt, loadedAt + numVertices, UINT32_MAX);
+
+    uint32_t misses = 0;
+    ForEachSquare(gridSize, stripWidth, [&](int i, int j) {
+        uint32_t square[6];
+        WriteSquare(gridSize, i, j, square);
+        for (uint32_t vertex : square)
+        {
+            uint32_t& loaded = loadedAt[vertex];
+            if (loaded == UINT32_MAX || misses - loaded >= (uint32_t)cacheSize)
+            {
+                loaded = misses;
+                misses++;
+            }
+        }
+    });
+
+    return (float)misses / ((size_t)gridSize * gridSize * 2);
+}
+
+const GridIndexBuffer& GridIndexCache::Acquire(int gridSize)
+{
+    auto found = mBuffers.find(gridSize);
+    if (found != mBuffers.end())
+    {
+        if (found->second.RefCount++ == 0)
+        {
+            mIdleBytes -= found->second.Bytes;
+        }
+        return found->second;
+    }
+
+    size_t numVertices = (size_t)(gridSize + 1) * (gridSize + 1);
+    size_t indexCount = (size_t)gridSize * gridSize * 6;
+
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+
+    uint32_t* indices = scratch.Allocate<uint32_t>(indexCount);
+    GenerateGridIndices(gridSize, indices);
+
+    GridIndexBuffer buffer = {};
+    buffer.IndexCount = (GLsizei)indexCount;
+    buffer.RefCount = 1;
+
+    glGenBuffers(1, &buffer.IndexBO);
+    // Why not bind to GL_ELEMENT_ARRAY_BUFFER?
+    // Because binding to GL_ELEMENT_ARRAY_BUFFER attaches the EBO to the currently bound VAO, which might stomp somebody else's state.
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.IndexBO);
+    if (numVertices <= 65536)
+    {
+        GLushort* shortIndices = scratch.Allocate<GLushort>(indexCount);
+        std::copy(indices, indices + indexCount, shortIndices);
+
+        buffer.IndexType = GL_UNSIGNED_SHORT;
+        buffer.Bytes = indexCount * sizeof(GLushort);
+        glBufferData(GL_ARRAY_BUFFER, buffer.Bytes, shortIndices, GL_STATIC_DRAW);
+    }
+    else
+    {
+        buffer.IndexType = GL_UNSIGNED_INT;
+        buffer.Bytes = indexCount * sizeof(GLuint);
+        glBufferData(GL_ARRAY_BUFFER, buffer.Bytes, indices, GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenVertexArrays(1, &buffer.VertexArray);
+    glBindVertexArray(buffer.VertexArray);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.IndexBO);
+    glBindVertexArray(0);
+
+    return mBuffers[gridSize] = buffer;
+}
+
+void GridIndexCache::Release(int gridSize)
+{
+    auto found = mBuffers.find(gridSize);
+    if (found == mBuffers.end())
+    {
+        fprintf(stderr, "GridIndexCache::Release: no index buffer for grid size %d\n", gridSize);
+        return;
+    }
+
+    // kept for the next mesh of the size, eg. the next world's, which is usually made right after the last one is destroyed
+    if (--found->second.RefCount == 0)
+    {
+        found->second.ReleasedAt = mNumReleases++;
+        mIdleBytes += found->second.Bytes;
+        Trim();
+    }
+}
+
+void GridIndexCache::Trim()
+{
+    while (mIdleBytes > MaxIdleBytes)
+    {
+        auto oldest = mBuffers.end();
+        for (auto it = mBuffers.begin(); it != mBuffers.end(); ++it)
+        {
+            if (it->second.RefCount == 0 && (oldest == mBuffers.end() || it->second.ReleasedAt < oldest->second.ReleasedAt))
+            {
+                oldest = it;
+            }
+        }
+
+        mIdleBytes -= oldest->second.Bytes;
+        glDeleteVertexArrays(1, &oldest->second.VertexArray);
+        glDeleteBuffers(1, &oldest->second.IndexBO);
+        mBuffers.erase(oldest);
+    }
+}
+
+void GridIndexCache::UpdateStats()
+{
+    for (auto& sizeAndBuffer : mBuffers)
+    {
+        GridIndexBuffer& buffer = sizeAndBuffer.second;
+        if (!buffer.HasStats)
+        {
+            // and the row-by-row order's it replaced, for comparison
+            buffer.ACMR = ComputeGridACMR(sizeAndBuffer.first, GRID_INDEX_STRIP_WIDTH, GRID_INDEX_STATS_CACHE_SIZE);
+            buffer.RowOrderACMR = ComputeGridACMR(sizeAndBuffer.first, sizeAndBuffer.first, GRID_INDEX_STATS_CACHE_SIZE);
+            buffer.HasStats = true;
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+// Index buffers for the grid meshes (the terrain and the water).
+// Every grid of the same size draws the same triangles over its (gridSize+1)^2 vertices, so one index buffer per size
+// is shared by all of them instead of each mesh building and uploading its own.
+//
+// The squares are ordered in strips GRID_INDEX_STRIP_WIDTH squares wide, walked one row at a time ("strip of strips"),
+// so the previous row's vertices are still in the post-transform vertex cache when the next row uses them.
+// A whole grid row is too long for that, which is why the plain row-by-row order transforms almost every vertex twice.
+
+// 8 vertices per row, so two rows fit in a 16 entry cache. Wider strips are slightly better on bigger caches,
+// but fall back to the row-by-row miss rate on smaller ones.
+#define GRID_INDEX_STRIP_WIDTH 7
+
+// FIFO cache size used for the ACMR statistics
+#define GRID_INDEX_STATS_CACHE_SIZE 16
+
+struct GridIndexBuffer
+{
+    GLuint IndexBO;
+    // a vertex array with no attributes, just IndexBO, for the meshes that fetch their vertices from textures (see terrain_grid.vert)
+    GLuint VertexArray;
+    // GL_UNSIGNED_SHORT when all the vertices can be indexed with 16 bits, otherwise GL_UNSIGNED_INT
+    GLenum IndexType;
+    GLsizei IndexCount;
+    size_t Bytes;
+
+    // number of meshes using the buffer. Unused buffers are kept for the next mesh of the size, within the cache's budget.
+    int RefCount;
+    // GridIndexCache::Release count when the buffer was last unused, for evicting the oldest first
+    uint64_t ReleasedAt;
+
+    // average vertices transformed per triangle (lower is better, 0.5 is the limit for a grid),
+    // for this order and for the row-by-row order it replaces. Only computed by GridIndexCache::UpdateStats.
+    bool HasStats;
+    float ACMR;
+    float RowOrderACMR;
+};
+
+// writes the gridSize^2 * 6 indices of a grid in strip order.
+// the two triangles of square (i, j) are (i, j), (i+1, j), (i, j+1) and (i+1, j+1), (i+1, j), (i, j+1),
+// where vertex (i, j) is i * (gridSize+1) + j.
+void GenerateGridIndices(int gridSize, uint32_t* indices);
+
+// squares per side of the coarser grid made of every step-th row and column of a grid, plus its last row and column
+int GetSubgridSize(int gridSize, int step);
+
+// writes the GetSubgridSize(gridSize, step)^2 * 6 indices of that coarser grid, in the same order as GenerateGridIndices.
+// They index the full grid's (gridSize+1)^2 vertices, so a grid can be drawn while only every step-th vertex is filled in.
+void GenerateSubgridIndices(int gridSize, int step, uint32_t* indices);
+
+// average cache miss ratio (vertices transformed per triangle) of a grid's triangles with a FIFO vertex cache of cacheSize entries,
+// in the order of GenerateGridIndices with strips stripWidth squares wide. A strip as wide as the grid is the row-by-row order.
+// The triangles are walked without storing their indices.
+float ComputeGridACMR(int gridSize, int stripWidth, int cacheSize);
+
+class GridIndexCache
+{
+    std::map<int, GridIndexBuffer> mBuffers;
+
+    uint64_t mNumReleases = 0;
+    size_t mIdleBytes = 0;
+
+    void Trim();
+
+public:
+    // unused buffers are deleted once they take more than this much memory, oldest first
+    size_t MaxIdleBytes = 256 * 1024 * 1024;
+
+    // returns the index buffer for the grid size, creating it if there isn't one yet.
+    // every Acquire must be matched by a Release once the mesh is destroyed.
+    const GridIndexBuffer& Acquire(int gridSize);
+    void Release(int gridSize);
+
+    // computes the ACMR statistics of the buffers that don't have them yet. Slow for big grids, so only call it to show them.
+    void UpdateStats();
+
+    size_t GetIdleBytes() const { return mIdleBytes; }
+
+    // for the stats display
+    const std::map<int, GridIndexBuffer>& GetBuffers() const { return mBuffers; }
+};
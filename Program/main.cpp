@@ -25,10 +25,9 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
-    // GL 4.1 for OS X support
-    // Feel free to increase the GL version if your computer supports it.
+    // GL 4.3 for compute shaders, falling back to 4.1 for OS X support (see below)
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 #ifdef _DEBUG
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
 #endif
@@ -70,6 +69,12 @@ int main(int argc, char* argv[])
 
     SDL_GLContext glctx = SDL_GL_CreateContext(window);
     if (!glctx)
+    {
+        // the compute paths are optional, so run without them
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+        glctx = SDL_GL_CreateContext(window);
+    }
+    if (!glctx)
     {
         fprintf(stderr, "SDL_GL_CreateContext: %s\n", SDL_GetError());
         exit(1);
@@ -0,0 +1,328 @@
+#include "noise.h"
+
+#include "arena.h"
+#include "noise_simd.h"
+
+#include <algorithm>
+#include <cmath>
+
+uint32_t SquaresRandom(uint64_t counter, uint64_t key)
+{
+    uint64_t x = counter * key;
+    uint64_t y = x;
+    uint64_t z = y + key;
+
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    x = x * x + z; x = (x >> 32) | (x << 32);
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    return (uint32_t)((x * x + z) >> 32);
+}
+
+uint64_t MakeRandomKey(uint32_t seed)
+{
+    // splitmix64 finalizer. The low bit is forced on, since an even key loses a bit of the counter.
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z = z ^ (z >> 31);
+    return z | 1;
+}
+
+// perlin noise-related functions
+// taken from https://connex.csc.uvic.ca/access/content/group/feae68d4-a86f-4c6a-af57-9a21e665f7d0/Reading%20Material/Noise/Understanding%20Perlin%20Noise.pdf
+
+static const int kReferencePermutation[256] = {
+    151,160,137,91,90,15,
+    131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,
+    190, 6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,
+    88,237,149,56,87,174,20,125,136,171,168, 68,175,74,165,71,134,139,48,27,166,
+    77,146,158,231,83,111,229,122,60,211,133,230,220,105,92,41,55,46,245,40,244,
+    102,143,54, 65,25,63,161, 1,216,80,73,209,76,132,187,208, 89,18,169,200,196,
+    135,130,116,188,159,86,164,100,109,198,173,186, 3,64,52,217,226,250,124,123,
+    5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,189,28,42,
+    223,183,170,213,119,248,152, 2,44,154,163, 70,221,153,101,155,167, 43,172,9,
+    129,22,39,253, 19,98,108,110,79,113,224,232,178,185, 112,104,218,246,97,228,
+    251,34,242,193,238,210,144,12,191,179,162,241, 81,51,145,235,249,14,239,107,
+    49,192,214, 31,181,199,106,157,184, 84,204,176,115,121,50,45,127, 4,150,254,
+    138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180,
+};
+
+PermutationTable::PermutationTable(uint32_t seed)
+    : mSeed(seed)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        mTable[i] = kReferencePermutation[i];
+    }
+
+    // if the seed is 0, use the reference permutation
+    if (seed != 0)
+    {
+        // Fisher-Yates, with the i-th random number deciding the swap at i
+        uint64_t key = MakeRandomKey(seed);
+        for (int i = 255; i > 0; i--)
+        {
+            int j = (int)(((uint64_t)SquaresRandom(i, key) * (i + 1)) >> 32);
+            int tmp = mTable[i];
+            mTable[i] = mTable[j];
+            mTable[j] = tmp;
+        }
+    }
+
+    for (int i = 0; i < 256; i++)
+    {
+        mTable[i + 256] = mTable[i];
+    }
+}
+
+static double fade(double t) {
+    return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+static double lerp(double a, double b, double x) {
+    return a + x * (b - a);
+}
+
+// 2d select gradient: x+y, -x+y, x-y, -x-y, indexed by hash & 0x3
+static const double kGrad2X[4] = { 1.0, -1.0, 1.0, -1.0 };
+static const double kGrad2Y[4] = { 1.0, 1.0, -1.0, -1.0 };
+
+static double grad(int hash, double x, double y){
+    return kGrad2X[hash & 0x3] * x + kGrad2Y[hash & 0x3] * y;
+}
+
+// 3d select gradient, indexed by hash & 0xF: x+y, -x+y, x-y, -x-y, x+z, -x+z, x-z, -x-z,
+// y+z, -y+z, y-z, -y-z, y+x, -y+z, y-x, -y-z (Ken Perlin's improved noise, padded to 16)
+static const double kGrad3X[16] = { 1, -1, 1, -1, 1, -1, 1, -1, 0, 0, 0, 0, 1, 0, -1, 0 };
+static const double kGrad3Y[16] = { 1, 1, -1, -1, 0, 0, 0, 0, 1, -1, 1, -1, 1, -1, 1, -1 };
+static const double kGrad3Z[16] = { 0, 0, 0, 0, 1, 1, -1, -1, 1, 1, -1, -1, 0, 1, 0, -1 };
+
+static double grad(int hash, double x, double y, double z){
+    int h = hash & 0xF;
+    return kGrad3X[h] * x + kGrad3Y[h] * y + kGrad3Z[h] * z;
+}
+
+// 2d perlin noise
+// floor() rather than truncation, so negative coordinates (terrain chunks left of the origin) stay continuous
+double Perlin2(const PermutationTable& perm, double x, double y) {
+    const int* ps = perm.Data();
+
+    int xi = (int)floor(x) & 255;
+    int yi = (int)floor(y) & 255;
+
+    double xf = x - floor(x);
+    double yf = y - floor(y);
+
+    double u = fade(xf);
+    double v = fade(yf);
+
+
+    int aa, ab, ba, bb;
+    aa = ps[ps[xi] + yi];
+    ab = ps[ps[xi] + yi+1];
+    ba = ps[ps[xi+1] + yi];
+    bb = ps[ps[xi+1] + yi+1];
+
+    double x1, x2;
+    x1 = lerp( grad (aa, xf , yf),
+               grad (ba, xf-1, yf),
+               u);
+    x2 = lerp( grad (ab, xf , yf-1),
+               grad (bb, xf-1, yf-1),
+               u);
+    return(lerp(x1, x2, v)+1)/2;
+}
+
+// 3d perlin noise
+double Perlin3(const PermutationTable& perm, double x, double y, double z) {
+    const int* ps = perm.Data();
+
+    int xi = (int)floor(x) & 255;
+    int yi = (int)floor(y) & 255;
+    int zi = (int)floor(z) & 255;
+
+    double xf = x - floor(x);
+    double yf = y - floor(y);
+    double zf = z - floor(z);
+
+    double u = fade(xf);
+    double v = fade(yf);
+    double w = fade(zf);
+
+
+    int aaa, aba, aab, abb, baa, bba, bab, bbb;
+    aaa = ps[ps[ps[ xi ]+ yi ]+ zi ];
+    aba = ps[ps[ps[ xi ]+yi+1]+ zi ];
+    aab = ps[ps[ps[ xi ]+ yi ]+zi+1];
+    abb = ps[ps[ps[ xi ]+yi+1]+zi+1];
+    baa = ps[ps[ps[xi+1]+ yi ]+ zi ];
+    bba = ps[ps[ps[xi+1]+yi+1]+ zi ];
+    bab = ps[ps[ps[xi+1]+ yi ]+zi+1];
+    bbb = ps[ps[ps[xi+1]+yi+1]+zi+1];
+
+    double x1, x2, y1, y2;
+    x1 = lerp( grad (aaa, xf , yf , zf),
+               grad (baa, xf-1, yf , zf),
+               u);
+    x2 = lerp( grad (aba, xf , yf-1, zf),
+               grad (bba, xf-1, yf-1, zf),
+               u);
+    y1 = lerp(x1, x2, v);
+    x1 = lerp( grad (aab, xf , yf , zf-1),
+               grad (bab, xf-1, yf , zf-1),
+               u);
+    x2 = lerp( grad (abb, xf , yf-1, zf-1),
+               grad (bbb, xf-1, yf-1, zf-1),
+               u);
+    y2 = lerp (x1, x2, v);
+
+    return (lerp (y1, y2, w)+1)/2;
+}
+
+// 3d perlin noise that repeats every periodX, periodY and periodZ units.
+// the lattice coordinates wrap at the period before they're hashed, so the cells on either side of the seam share their gradients.
+double Perlin3Tiled(const PermutationTable& perm, double x, double y, double z, int periodX, int periodY, int periodZ) {
+    const int* ps = perm.Data();
+
+    double xfloor = floor(x);
+    double yfloor = floor(y);
+    double zfloor = floor(z);
+
+    // wrapped into [0, period), then into the table
+    int x0 = ((int)xfloor % periodX + periodX) % periodX;
+    int y0 = ((int)yfloor % periodY + periodY) % periodY;
+    int z0 = ((int)zfloor % periodZ + periodZ) % periodZ;
+    int x1 = (x0 + 1) % periodX & 255;
+    int y1 = (y0 + 1) % periodY & 255;
+    int z1 = (z0 + 1) % periodZ & 255;
+    x0 &= 255;
+    y0 &= 255;
+    z0 &= 255;
+
+    double xf = x - xfloor;
+    double yf = y - yfloor;
+    double zf = z - zfloor;
+
+    double u = fade(xf);
+    double v = fade(yf);
+    double w = fade(zf);
+
+    int aaa, aba, aab, abb, baa, bba, bab, bbb;
+    aaa = ps[ps[ps[x0] + y0] + z0];
+    aba = ps[ps[ps[x0] + y1] + z0];
+    aab = ps[ps[ps[x0] + y0] + z1];
+    abb = ps[ps[ps[x0] + y1] + z1];
+    baa = ps[ps[ps[x1] + y0] + z0];
+    bba = ps[ps[ps[x1] + y1] + z0];
+    bab = ps[ps[ps[x1] + y0] + z1];
+    bbb = ps[ps[ps[x1] + y1] + z1];
+
+    double x1Lerp, x2Lerp, y1Lerp, y2Lerp;
+    x1Lerp = lerp(grad(aaa, xf, yf, zf), grad(baa, xf - 1, yf, zf), u);
+    x2Lerp = lerp(grad(aba, xf, yf - 1, zf), grad(bba, xf - 1, yf - 1, zf), u);
+    y1Lerp = lerp(x1Lerp, x2Lerp, v);
+    x1Lerp = lerp(grad(aab, xf, yf, zf - 1), grad(bab, xf - 1, yf, zf - 1), u);
+    x2Lerp = lerp(grad(abb, xf, yf - 1, zf - 1), grad(bbb, xf - 1, yf - 1, zf - 1), u);
+    y2Lerp = lerp(x1Lerp, x2Lerp, v);
+
+    return (lerp(y1Lerp, y2Lerp, w) + 1) / 2;
+}
+
+// perlin function produces values generally between 0.25 and 0.75, so this function creates values between 0 and 1
+// note: there may be some clustering at 0 and 1
+double Perlin2Clamped(const PermutationTable& perm, double x, double y) {
+    double value = Perlin2(perm, x, y);
+    value -= 0.25;
+    value *= 2.0;
+    return fmax(0, fmin(1, value));
+}
+
+// samples per batch kernel call. Enough to amortize the call, few enough that the coordinates stay in L1.
+static const int kGridBatchSize = 1024;
+
+// noise space coordinate of sample index along one axis of a grid
+static float GridCoordinate(const NoiseGrid& grid, int origin, int index)
+{
+    return (float)(origin + index) / grid.SamplesPerUnit * grid.Frequency;
+}
+
+// coordinates of samples [first, first + count) of a grid, in output order. z can be null for 2D grids.
+// the batches don't follow the rows, so grids of any shape (eg. a single column) get full batches.
+static void GridCoordinates(const NoiseGrid& grid, size_t first, int count, float* x, float* y, float* z)
+{
+    int i = (int)(first % grid.SizeX);
+    int j = (int)((first / grid.SizeX) % grid.SizeY);
+    int k = (int)(first / ((size_t)grid.SizeX * grid.SizeY));
+
+    for (int n = 0; n < count; n++)
+    {
+        x[n] = GridCoordinate(grid, grid.OriginX, i);
+        y[n] = GridCoordinate(grid, grid.OriginY, j);
+        if (z)
+        {
+            z[n] = GridCoordinate(grid, grid.OriginZ, k);
+        }
+
+        if (++i == grid.SizeX)
+        {
+            i = 0;
+            if (++j == grid.SizeY)
+            {
+                j = 0;
+                k++;
+            }
+        }
+    }
+}
+
+void PerlinGrid2D(const PermutationTable& perm, const NoiseGrid& grid, float* out)
+{
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+
+    float* x = scratch.Allocate<float>(kGridBatchSize);
+    float* y = scratch.Allocate<float>(kGridBatchSize);
+
+    size_t numSamples = (size_t)grid.SizeX * grid.SizeY;
+    for (size_t first = 0; first < numSamples; first += kGridBatchSize)
+    {
+        int count = (int)std::min(numSamples - first, (size_t)kGridBatchSize);
+        GridCoordinates(grid, first, count, x, y, NULL);
+        Perlin2Batch(perm.Data(), x, y, out + first, count);
+    }
+}
+
+void PerlinGrid2DDeriv(const PermutationTable& perm, const NoiseGrid& grid, float* out, float* outDx, float* outDy)
+{
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+
+    float* x = scratch.Allocate<float>(kGridBatchSize);
+    float* y = scratch.Allocate<float>(kGridBatchSize);
+
+    size_t numSamples = (size_t)grid.SizeX * grid.SizeY;
+    for (size_t first = 0; first < numSamples; first += kGridBatchSize)
+    {
+        int count = (int)std::min(numSamples - first, (size_t)kGridBatchSize);
+        GridCoordinates(grid, first, count, x, y, NULL);
+        Perlin2DerivBatch(perm.Data(), x, y, out + first, outDx + first, outDy + first, count);
+    }
+}
+
+void PerlinGrid3D(const PermutationTable& perm, const NoiseGrid& grid, float* out)
+{
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+
+    float* x = scratch.Allocate<float>(kGridBatchSize);
+    float* y = scratch.Allocate<float>(kGridBatchSize);
+    float* z = scratch.Allocate<float>(kGridBatchSize);
+
+    size_t numSamples = (size_t)grid.SizeX * grid.SizeY * grid.SizeZ;
+    for (size_t first = 0; first < numSamples; first += kGridBatchSize)
+    {
+        int count = (int)std::min(numSamples - first, (size_t)kGridBatchSize);
+        GridCoordinates(grid, first, count, x, y, z);
+        Perlin3Batch(perm.Data(), x, y, z, out + first, count);
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+
+// Perlin noise with seedable permutation tables.
+//
+// A PermutationTable is immutable once constructed, so any number of threads can sample the same table at once,
+// and two tables (eg. the world on screen and the one being built in the background) don't interfere.
+// Tables are shuffled with a counter-based RNG, so a seed gives the same table on every platform and compiler,
+// unlike srand() + std::random_shuffle.
+//
+// The grid functions sample whole 2D/3D grids at once with the batched kernels in noise_simd.h.
+// They only use the calling thread's scratch arena, so they are safe to call from any thread.
+
+// Squares counter-based RNG (Widynski 2020): the counter-th 32 bit number of the stream for key.
+// Stateless, so numbers can be drawn in any order, from any thread. Use MakeRandomKey to turn a seed into a key.
+uint32_t SquaresRandom(uint64_t counter, uint64_t key);
+
+// a well-mixed key for SquaresRandom (the algorithm needs keys with roughly even 0 and 1 bits)
+uint64_t MakeRandomKey(uint32_t seed);
+
+class PermutationTable
+{
+    uint32_t mSeed;
+    // the 256 entry permutation, repeated twice, so lookups of (perm[i] + j) don't need wrapping
+    int mTable[512];
+
+public:
+    // seed 0 is Ken Perlin's reference permutation. Other seeds shuffle it.
+    explicit PermutationTable(uint32_t seed = 0);
+
+    uint32_t GetSeed() const { return mSeed; }
+
+    // 512 entries, in the layout the batch kernels and terrain_heights.comp expect
+    const int* Data() const { return mTable; }
+};
+
+// reference double precision noise. Output is in [0, 1], mostly within [0.25, 0.75].
+double Perlin2(const PermutationTable& perm, double x, double y);
+double Perlin3(const PermutationTable& perm, double x, double y, double z);
+
+// Perlin3 that repeats every periodX, periodY and periodZ units (each in [1, 256]), eg. for textures that tile
+double Perlin3Tiled(const PermutationTable& perm, double x, double y, double z, int periodX, int periodY, int periodZ);
+
+// Perlin2 stretched from [0.25, 0.75] to [0, 1]
+// note: there may be some clustering at 0 and 1
+double Perlin2Clamped(const PermutationTable& perm, double x, double y);
+
+// A grid of samples on an integer lattice, in noise space:
+// sample (i, j, k) is at ((OriginX + i) / SamplesPerUnit * Frequency, (OriginY + j) / ..., (OriginZ + k) / ...).
+// Neighbouring grids that share an edge (eg. OriginX of one = OriginX + SizeX - 1 of the other) produce bit-identical samples on it.
+// The output is x-major: sample (i, j, k) is out[(k * SizeY + j) * SizeX + i].
+struct NoiseGrid
+{
+    int OriginX = 0;
+    int OriginY = 0;
+    int OriginZ = 0;
+
+    int SizeX = 1;
+    int SizeY = 1;
+    // ignored by the 2D functions
+    int SizeZ = 1;
+
+    float SamplesPerUnit = 1.0f;
+    // octave frequency, eg. lacunarity^octave. Powers of two keep the samples exact.
+    float Frequency = 1.0f;
+};
+
+// out gets SizeX * SizeY samples of 2D noise
+void PerlinGrid2D(const PermutationTable& perm, const NoiseGrid& grid, float* out);
+
+// out gets SizeX * SizeY samples of 2D noise, and outDx/outDy its partial derivatives by the sampled x and y coordinates.
+// multiply them by Frequency for the derivatives by the unscaled coordinates (OriginX + i) / SamplesPerUnit.
+void PerlinGrid2DDeriv(const PermutationTable& perm, const NoiseGrid& grid, float* out, float* outDx, float* outDy);
+
+// out gets SizeX * SizeY * SizeZ samples of 3D noise
+void PerlinGrid3D(const PermutationTable& perm, const NoiseGrid& grid, float* out);
@@ -0,0 +1,735 @@
+#include "noise_simd.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define NOISE_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC/Clang only emit AVX2 instructions inside functions marked for that target.
+// MSVC allows AVX2 intrinsics anywhere. FMA is deliberately not enabled, so no kernel contracts a*b+c differently from the others.
+#if defined(NOISE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define NOISE_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define NOISE_AVX2_TARGET
+#endif
+
+// scalar kernel (also handles the leftover samples of the SIMD kernels)
+
+static inline float FadeF(float t)
+{
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+static inline float LerpF(float a, float b, float x)
+{
+    return a + x * (b - a);
+}
+
+// 2d gradients, indexed by hash & 0x3: x+y, -x+y, x-y, -x-y
+static const float kGrad2X[4] = { 1.0f, -1.0f, 1.0f, -1.0f };
+static const float kGrad2Y[4] = { 1.0f, 1.0f, -1.0f, -1.0f };
+
+static inline float Grad2F(int hash, float x, float y)
+{
+    return kGrad2X[hash & 0x3] * x + kGrad2Y[hash & 0x3] * y;
+}
+
+// 3d gradients, indexed by hash & 0xF. Same table as the switch in grad(): the gradient is (+/-u) + (+/-v),
+// where u is x or y and v is x, y or z. The signs come from the two lowest bits of the hash.
+static const uint8_t kGrad3U[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1 };
+static const uint8_t kGrad3V[16] = { 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 0, 2, 0, 2 };
+
+static inline float Grad3F(int hash, float x, float y, float z)
+{
+    const float xyz[3] = { x, y, z };
+    float u = xyz[kGrad3U[hash & 0xF]];
+    float v = xyz[kGrad3V[hash & 0xF]];
+    return ((hash & 1) ? -u : u) + ((hash & 2) ? -v : v);
+}
+
+static float Perlin2Scalar(const int* ps, float x, float y)
+{
+    float fx = floorf(x);
+    float fy = floorf(y);
+
+    int xi = (int)fx & 255;
+    int yi = (int)fy & 255;
+
+    float xf = x - fx;
+    float yf = y - fy;
+
+    float u = FadeF(xf);
+    float v = FadeF(yf);
+
+    int aa = ps[ps[xi] + yi];
+    int ab = ps[ps[xi] + yi + 1];
+    int ba = ps[ps[xi + 1] + yi];
+    int bb = ps[ps[xi + 1] + yi + 1];
+
+    float x1 = LerpF(Grad2F(aa, xf, yf), Grad2F(ba, xf - 1.0f, yf), u);
+    float x2 = LerpF(Grad2F(ab, xf, yf - 1.0f), Grad2F(bb, xf - 1.0f, yf - 1.0f), u);
+    return (LerpF(x1, x2, v) + 1.0f) * 0.5f;
+}
+
+// derivative of FadeF
+static inline float FadeDerivF(float t)
+{
+    return 30.0f * t * t * (t * (t - 2.0f) + 1.0f);
+}
+
+// same value as Perlin2Scalar, plus its partial derivatives.
+// each corner's contribution is linear (its gradient), so the derivatives only need the fade derivatives on top.
+static float Perlin2DerivScalar(const int* ps, float x, float y, float* dx, float* dy)
+{
+    float fx = floorf(x);
+    float fy = floorf(y);
+
+    int xi = (int)fx & 255;
+    int yi = (int)fy & 255;
+
+    float xf = x - fx;
+    float yf = y - fy;
+
+    float u = FadeF(xf);
+    float v = FadeF(yf);
+    float du = FadeDerivF(xf);
+    float dv = FadeDerivF(yf);
+
+    int aa = ps[ps[xi] + yi];
+    int ab = ps[ps[xi] + yi + 1];
+    int ba = ps[ps[xi + 1] + yi];
+    int bb = ps[ps[xi + 1] + yi + 1];
+
+    float gaa = Grad2F(aa, xf, yf);
+    float gba = Grad2F(ba, xf - 1.0f, yf);
+    float gab = Grad2F(ab, xf, yf - 1.0f);
+    float gbb = Grad2F(bb, xf - 1.0f, yf - 1.0f);
+
+    float x1 = LerpF(gaa, gba, u);
+    float x2 = LerpF(gab, gbb, u);
+
+    float x1dx = LerpF(kGrad2X[aa & 0x3], kGrad2X[ba & 0x3], u) + du * (gba - gaa);
+    float x2dx = LerpF(kGrad2X[ab & 0x3], kGrad2X[bb & 0x3], u) + du * (gbb - gab);
+    float x1dy = LerpF(kGrad2Y[aa & 0x3], kGrad2Y[ba & 0x3], u);
+    float x2dy = LerpF(kGrad2Y[ab & 0x3], kGrad2Y[bb & 0x3], u);
+
+    *dx = LerpF(x1dx, x2dx, v) * 0.5f;
+    *dy = (LerpF(x1dy, x2dy, v) + dv * (x2 - x1)) * 0.5f;
+    return (LerpF(x1, x2, v) + 1.0f) * 0.5f;
+}
+
+static float Perlin3Scalar(const int* ps, float x, float y, float z)
+{
+    float fx = floorf(x);
+    float fy = floorf(y);
+    float fz = floorf(z);
+
+    int xi = (int)fx & 255;
+    int yi = (int)fy & 255;
+    int zi = (int)fz & 255;
+
+    float xf = x - fx;
+    float yf = y - fy;
+    float zf = z - fz;
+
+    float u = FadeF(xf);
+    float v = FadeF(yf);
+    float w = FadeF(zf);
+
+    int aaa = ps[ps[ps[xi] + yi] + zi];
+    int aba = ps[ps[ps[xi] + yi + 1] + zi];
+    int aab = ps[ps[ps[xi] + yi] + zi + 1];
+    int abb = ps[ps[ps[xi] + yi + 1] + zi + 1];
+    int baa = ps[ps[ps[xi + 1] + yi] + zi];
+    int bba = ps[ps[ps[xi + 1] + yi + 1] + zi];
+    int bab = ps[ps[ps[xi + 1] + yi] + zi + 1];
+    int bbb = ps[ps[ps[xi + 1] + yi + 1] + zi + 1];
+
+    float x1 = LerpF(Grad3F(aaa, xf, yf, zf), Grad3F(baa, xf - 1.0f, yf, zf), u);
+    float x2 = LerpF(Grad3F(aba, xf, yf - 1.0f, zf), Grad3F(bba, xf - 1.0f, yf - 1.0f, zf), u);
+    float y1 = LerpF(x1, x2, v);
+    x1 = LerpF(Grad3F(aab, xf, yf, zf - 1.0f), Grad3F(bab, xf - 1.0f, yf, zf - 1.0f), u);
+    x2 = LerpF(Grad3F(abb, xf, yf - 1.0f, zf - 1.0f), Grad3F(bbb, xf - 1.0f, yf - 1.0f, zf - 1.0f), u);
+    float y2 = LerpF(x1, x2, v);
+    return (LerpF(y1, y2, w) + 1.0f) * 0.5f;
+}
+
+static void Perlin2BatchScalar(const int* perm, const float* x, const float* y, float* out, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = Perlin2Scalar(perm, x[i], y[i]);
+    }
+}
+
+static void Perlin2DerivBatchScalar(const int* perm, const float* x, const float* y, float* out, float* outDx, float* outDy, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = Perlin2DerivScalar(perm, x[i], y[i], &outDx[i], &outDy[i]);
+    }
+}
+
+static void Perlin3BatchScalar(const int* perm, const float* x, const float* y, const float* z, float* out, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = Perlin3Scalar(perm, x[i], y[i], z[i]);
+    }
+}
+
+#ifdef NOISE_X86
+
+// SSE2 kernel. SSE2 has no gather, so the permutation lookups are done per lane.
+
+static inline __m128 FloorSSE2(__m128 x)
+{
+    // truncate, then subtract 1 where truncation rounded up (negative non-integers)
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
+static inline __m128 FadeSSE2(__m128 t)
+{
+    __m128 inner = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f));
+    return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+}
+
+static inline __m128 LerpSSE2(__m128 a, __m128 b, __m128 x)
+{
+    return _mm_add_ps(a, _mm_mul_ps(x, _mm_sub_ps(b, a)));
+}
+
+static inline __m128 SelectSSE2(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128 Grad2SSE2(__m128i hash, __m128 x, __m128 y)
+{
+    // hash bit 0 negates x, hash bit 1 negates y
+    __m128 signX = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(hash, _mm_set1_epi32(1)), 31));
+    __m128 signY = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(hash, _mm_set1_epi32(2)), 30));
+    return _mm_add_ps(_mm_xor_ps(x, signX), _mm_xor_ps(y, signY));
+}
+
+static inline __m128 Grad3SSE2(__m128i hash, __m128 x, __m128 y, __m128 z)
+{
+    __m128i h = _mm_and_si128(hash, _mm_set1_epi32(0xF));
+
+    __m128 uIsX = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)));
+    __m128 vIsY = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+    __m128 vIsX = _mm_castsi128_ps(_mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)), _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+
+    __m128 u = SelectSSE2(uIsX, x, y);
+    __m128 v = SelectSSE2(vIsY, y, SelectSSE2(vIsX, x, z));
+
+    __m128 signU = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+    __m128 signV = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+    return _mm_add_ps(_mm_xor_ps(u, signU), _mm_xor_ps(v, signV));
+}
+
+static void Perlin2BatchSSE2(const int* ps, const float* x, const float* y, float* out, int count)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+
+        __m128 fx = FloorSSE2(vx);
+        __m128 fy = FloorSSE2(vy);
+
+        alignas(16) int xi[4], yi[4];
+        _mm_store_si128((__m128i*)xi, _mm_and_si128(_mm_cvttps_epi32(fx), _mm_set1_epi32(255)));
+        _mm_store_si128((__m128i*)yi, _mm_and_si128(_mm_cvttps_epi32(fy), _mm_set1_epi32(255)));
+
+        alignas(16) int aa[4], ab[4], ba[4], bb[4];
+        for (int lane = 0; lane < 4; lane++)
+        {
+            int a = ps[xi[lane]] + yi[lane];
+            int b = ps[xi[lane] + 1] + yi[lane];
+            aa[lane] = ps[a];
+            ab[lane] = ps[a + 1];
+            ba[lane] = ps[b];
+            bb[lane] = ps[b + 1];
+        }
+
+        __m128 xf = _mm_sub_ps(vx, fx);
+        __m128 yf = _mm_sub_ps(vy, fy);
+        __m128 xf1 = _mm_sub_ps(xf, one);
+        __m128 yf1 = _mm_sub_ps(yf, one);
+
+        __m128 u = FadeSSE2(xf);
+        __m128 v = FadeSSE2(yf);
+
+        __m128 x1 = LerpSSE2(Grad2SSE2(_mm_load_si128((__m128i*)aa), xf, yf), Grad2SSE2(_mm_load_si128((__m128i*)ba), xf1, yf), u);
+        __m128 x2 = LerpSSE2(Grad2SSE2(_mm_load_si128((__m128i*)ab), xf, yf1), Grad2SSE2(_mm_load_si128((__m128i*)bb), xf1, yf1), u);
+
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(LerpSSE2(x1, x2, v), one), _mm_set1_ps(0.5f)));
+    }
+
+    Perlin2BatchScalar(ps, x + i, y + i, out + i, count - i);
+}
+
+static inline __m128 FadeDerivSSE2(__m128 t)
+{
+    __m128 inner = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(t, _mm_set1_ps(2.0f))), _mm_set1_ps(1.0f));
+    return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(30.0f), t), t), inner);
+}
+
+// the gradient's x (bit 0) or y (bit 1) component: +1, or -1 where the hash bit is set
+static inline __m128 GradSignSSE2(__m128i hash, int bit)
+{
+    __m128 sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(hash, _mm_set1_epi32(bit)), bit == 1 ? 31 : 30));
+    return _mm_xor_ps(_mm_set1_ps(1.0f), sign);
+}
+
+static void Perlin2DerivBatchSSE2(const int* ps, const float* x, const float* y, float* out, float* outDx, float* outDy, int count)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+
+        __m128 fx = FloorSSE2(vx);
+        __m128 fy = FloorSSE2(vy);
+
+        alignas(16) int xi[4], yi[4];
+        _mm_store_si128((__m128i*)xi, _mm_and_si128(_mm_cvttps_epi32(fx), _mm_set1_epi32(255)));
+        _mm_store_si128((__m128i*)yi, _mm_and_si128(_mm_cvttps_epi32(fy), _mm_set1_epi32(255)));
+
+        alignas(16) int aa[4], ab[4], ba[4], bb[4];
+        for (int lane = 0; lane < 4; lane++)
+        {
+            int a = ps[xi[lane]] + yi[lane];
+            int b = ps[xi[lane] + 1] + yi[lane];
+            aa[lane] = ps[a];
+            ab[lane] = ps[a + 1];
+            ba[lane] = ps[b];
+            bb[lane] = ps[b + 1];
+        }
+        __m128i haa = _mm_load_si128((__m128i*)aa);
+        __m128i hab = _mm_load_si128((__m128i*)ab);
+        __m128i hba = _mm_load_si128((__m128i*)ba);
+        __m128i hbb = _mm_load_si128((__m128i*)bb);
+
+        __m128 xf = _mm_sub_ps(vx, fx);
+        __m128 yf = _mm_sub_ps(vy, fy);
+        __m128 xf1 = _mm_sub_ps(xf, one);
+        __m128 yf1 = _mm_sub_ps(yf, one);
+
+        __m128 u = FadeSSE2(xf);
+        __m128 v = FadeSSE2(yf);
+        __m128 du = FadeDerivSSE2(xf);
+        __m128 dv = FadeDerivSSE2(yf);
+
+        __m128 gaa = Grad2SSE2(haa, xf, yf);
+        __m128 gba = Grad2SSE2(hba, xf1, yf);
+        __m128 gab = Grad2SSE2(hab, xf, yf1);
+        __m128 gbb = Grad2SSE2(hbb, xf1, yf1);
+
+        __m128 x1 = LerpSSE2(gaa, gba, u);
+        __m128 x2 = LerpSSE2(gab, gbb, u);
+
+        __m128 x1dx = _mm_add_ps(LerpSSE2(GradSignSSE2(haa, 1), GradSignSSE2(hba, 1), u), _mm_mul_ps(du, _mm_sub_ps(gba, gaa)));
+        __m128 x2dx = _mm_add_ps(LerpSSE2(GradSignSSE2(hab, 1), GradSignSSE2(hbb, 1), u), _mm_mul_ps(du, _mm_sub_ps(gbb, gab)));
+        __m128 x1dy = LerpSSE2(GradSignSSE2(haa, 2), GradSignSSE2(hba, 2), u);
+        __m128 x2dy = LerpSSE2(GradSignSSE2(hab, 2), GradSignSSE2(hbb, 2), u);
+
+        _mm_storeu_ps(outDx + i, _mm_mul_ps(LerpSSE2(x1dx, x2dx, v), half));
+        _mm_storeu_ps(outDy + i, _mm_mul_ps(_mm_add_ps(LerpSSE2(x1dy, x2dy, v), _mm_mul_ps(dv, _mm_sub_ps(x2, x1))), half));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(LerpSSE2(x1, x2, v), one), half));
+    }
+
+    Perlin2DerivBatchScalar(ps, x + i, y + i, out + i, outDx + i, outDy + i, count - i);
+}
+
+static void Perlin3BatchSSE2(const int* ps, const float* x, const float* y, const float* z, float* out, int count)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        __m128 vz = _mm_loadu_ps(z + i);
+
+        __m128 fx = FloorSSE2(vx);
+        __m128 fy = FloorSSE2(vy);
+        __m128 fz = FloorSSE2(vz);
+
+        alignas(16) int xi[4], yi[4], zi[4];
+        _mm_store_si128((__m128i*)xi, _mm_and_si128(_mm_cvttps_epi32(fx), _mm_set1_epi32(255)));
+        _mm_store_si128((__m128i*)yi, _mm_and_si128(_mm_cvttps_epi32(fy), _mm_set1_epi32(255)));
+        _mm_store_si128((__m128i*)zi, _mm_and_si128(_mm_cvttps_epi32(fz), _mm_set1_epi32(255)));
+
+        alignas(16) int aaa[4], aba[4], aab[4], abb[4], baa[4], bba[4], bab[4], bbb[4];
+        for (int lane = 0; lane < 4; lane++)
+        {
+            int a = ps[xi[lane]] + yi[lane];
+            int b = ps[xi[lane] + 1] + yi[lane];
+            int aa = ps[a] + zi[lane];
+            int ab = ps[a + 1] + zi[lane];
+            int ba = ps[b] + zi[lane];
+            int bb = ps[b + 1] + zi[lane];
+            aaa[lane] = ps[aa];
+            aab[lane] = ps[aa + 1];
+            aba[lane] = ps[ab];
+            abb[lane] = ps[ab + 1];
+            baa[lane] = ps[ba];
+            bab[lane] = ps[ba + 1];
+            bba[lane] = ps[bb];
+            bbb[lane] = ps[bb + 1];
+        }
+
+        __m128 xf = _mm_sub_ps(vx, fx);
+        __m128 yf = _mm_sub_ps(vy, fy);
+        __m128 zf = _mm_sub_ps(vz, fz);
+        __m128 xf1 = _mm_sub_ps(xf, one);
+        __m128 yf1 = _mm_sub_ps(yf, one);
+        __m128 zf1 = _mm_sub_ps(zf, one);
+
+        __m128 u = FadeSSE2(xf);
+        __m128 v = FadeSSE2(yf);
+        __m128 w = FadeSSE2(zf);
+
+        __m128 x1 = LerpSSE2(Grad3SSE2(_mm_load_si128((__m128i*)aaa), xf, yf, zf), Grad3SSE2(_mm_load_si128((__m128i*)baa), xf1, yf, zf), u);
+        __m128 x2 = LerpSSE2(Grad3SSE2(_mm_load_si128((__m128i*)aba), xf, yf1, zf), Grad3SSE2(_mm_load_si128((__m128i*)bba), xf1, yf1, zf), u);
+        __m128 y1 = LerpSSE2(x1, x2, v);
+        x1 = LerpSSE2(Grad3SSE2(_mm_load_si128((__m128i*)aab), xf, yf, zf1), Grad3SSE2(_mm_load_si128((__m128i*)bab), xf1, yf, zf1), u);
+        x2 = LerpSSE2(Grad3SSE2(_mm_load_si128((__m128i*)abb), xf, yf1, zf1), Grad3SSE2(_mm_load_si128((__m128i*)bbb), xf1, yf1, zf1), u);
+        __m128 y2 = LerpSSE2(x1, x2, v);
+
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(LerpSSE2(y1, y2, w), one), _mm_set1_ps(0.5f)));
+    }
+
+    Perlin3BatchScalar(ps, x + i, y + i, z + i, out + i, count - i);
+}
+
+// AVX2 kernel. Same math as SSE2, but 8 wide and with hardware gathers for the permutation lookups.
+
+NOISE_AVX2_TARGET static inline __m256 FadeAVX2(__m256 t)
+{
+    __m256 inner = _mm256_add_ps(_mm256_mul_ps(t, _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f))), _mm256_set1_ps(10.0f));
+    return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+}
+
+NOISE_AVX2_TARGET static inline __m256 LerpAVX2(__m256 a, __m256 b, __m256 x)
+{
+    return _mm256_add_ps(a, _mm256_mul_ps(x, _mm256_sub_ps(b, a)));
+}
+
+NOISE_AVX2_TARGET static inline __m256i GatherAVX2(const int* table, __m256i index)
+{
+    return _mm256_i32gather_epi32(table, index, 4);
+}
+
+NOISE_AVX2_TARGET static inline __m256 Grad2AVX2(__m256i hash, __m256 x, __m256 y)
+{
+    __m256 signX = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(hash, _mm256_set1_epi32(1)), 31));
+    __m256 signY = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(hash, _mm256_set1_epi32(2)), 30));
+    return _mm256_add_ps(_mm256_xor_ps(x, signX), _mm256_xor_ps(y, signY));
+}
+
+NOISE_AVX2_TARGET static inline __m256 Grad3AVX2(__m256i hash, __m256 x, __m256 y, __m256 z)
+{
+    __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(0xF));
+
+    __m256 uIsX = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+    __m256 vIsY = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+    __m256 vIsX = _mm256_castsi256_ps(_mm256_or_si256(_mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)), _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14))));
+
+    __m256 u = _mm256_blendv_ps(y, x, uIsX);
+    __m256 v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, vIsX), y, vIsY);
+
+    __m256 signU = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+    __m256 signV = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+    return _mm256_add_ps(_mm256_xor_ps(u, signU), _mm256_xor_ps(v, signV));
+}
+
+NOISE_AVX2_TARGET static void Perlin2BatchAVX2(const int* ps, const float* x, const float* y, float* out, int count)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i oneI = _mm256_set1_epi32(1);
+    const __m256i mask255 = _mm256_set1_epi32(255);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+
+        __m256 fx = _mm256_floor_ps(vx);
+        __m256 fy = _mm256_floor_ps(vy);
+
+        __m256i xi = _mm256_and_si256(_mm256_cvttps_epi32(fx), mask255);
+        __m256i yi = _mm256_and_si256(_mm256_cvttps_epi32(fy), mask255);
+
+        __m256i a = _mm256_add_epi32(GatherAVX2(ps, xi), yi);
+        __m256i b = _mm256_add_epi32(GatherAVX2(ps, _mm256_add_epi32(xi, oneI)), yi);
+        __m256i aa = GatherAVX2(ps, a);
+        __m256i ab = GatherAVX2(ps, _mm256_add_epi32(a, oneI));
+        __m256i ba = GatherAVX2(ps, b);
+        __m256i bb = GatherAVX2(ps, _mm256_add_epi32(b, oneI));
+
+        __m256 xf = _mm256_sub_ps(vx, fx);
+        __m256 yf = _mm256_sub_ps(vy, fy);
+        __m256 xf1 = _mm256_sub_ps(xf, one);
+        __m256 yf1 = _mm256_sub_ps(yf, one);
+
+        __m256 u = FadeAVX2(xf);
+        __m256 v = FadeAVX2(yf);
+
+        __m256 x1 = LerpAVX2(Grad2AVX2(aa, xf, yf), Grad2AVX2(ba, xf1, yf), u);
+        __m256 x2 = LerpAVX2(Grad2AVX2(ab, xf, yf1), Grad2AVX2(bb, xf1, yf1), u);
+
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_add_ps(LerpAVX2(x1, x2, v), one), _mm256_set1_ps(0.5f)));
+    }
+
+    Perlin2BatchScalar(ps, x + i, y + i, out + i, count - i);
+}
+
+NOISE_AVX2_TARGET static inline __m256 FadeDerivAVX2(__m256 t)
+{
+    __m256 inner = _mm256_add_ps(_mm256_mul_ps(t, _mm256_sub_ps(t, _mm256_set1_ps(2.0f))), _mm256_set1_ps(1.0f));
+    return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(30.0f), t), t), inner);
+}
+
+NOISE_AVX2_TARGET static inline __m256 GradSignAVX2(__m256i hash, int bit)
+{
+    __m256 sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(hash, _mm256_set1_epi32(bit)), bit == 1 ? 31 : 30));
+    return _mm256_xor_ps(_mm256_set1_ps(1.0f), sign);
+}
+
+NOISE_AVX2_TARGET static void Perlin2DerivBatchAVX2(const int* ps, const float* x, const float* y, float* out, float* outDx, float* outDy, int count)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256i oneI = _mm256_set1_epi32(1);
+    const __m256i mask255 = _mm256_set1_epi32(255);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+
+        __m256 fx = _mm256_floor_ps(vx);
+        __m256 fy = _mm256_floor_ps(vy);
+
+        __m256i xi = _mm256_and_si256(_mm256_cvttps_epi32(fx), mask255);
+        __m256i yi = _mm256_and_si256(_mm256_cvttps_epi32(fy), mask255);
+
+        __m256i a = _mm256_add_epi32(GatherAVX2(ps, xi), yi);
+        __m256i b = _mm256_add_epi32(GatherAVX2(ps, _mm256_add_epi32(xi, oneI)), yi);
+        __m256i aa = GatherAVX2(ps, a);
+        __m256i ab = GatherAVX2(ps, _mm256_add_epi32(a, oneI));
+        __m256i ba = GatherAVX2(ps, b);
+        __m256i bb = GatherAVX2(ps, _mm256_add_epi32(b, oneI));
+
+        __m256 xf = _mm256_sub_ps(vx, fx);
+        __m256 yf = _mm256_sub_ps(vy, fy);
+        __m256 xf1 = _mm256_sub_ps(xf, one);
+        __m256 yf1 = _mm256_sub_ps(yf, one);
+
+        __m256 u = FadeAVX2(xf);
+        __m256 v = FadeAVX2(yf);
+        __m256 du = FadeDerivAVX2(xf);
+        __m256 dv = FadeDerivAVX2(yf);
+
+        __m256 gaa = Grad2AVX2(aa, xf, yf);
+        __m256 gba = Grad2AVX2(ba, xf1, yf);
+        __m256 gab = Grad2AVX2(ab, xf, yf1);
+        __m256 gbb = Grad2AVX2(bb, xf1, yf1);
+
+        __m256 x1 = LerpAVX2(gaa, gba, u);
+        __m256 x2 = LerpAVX2(gab, gbb, u);
+
+        __m256 x1dx = _mm256_add_ps(LerpAVX2(GradSignAVX2(aa, 1), GradSignAVX2(ba, 1), u), _mm256_mul_ps(du, _mm256_sub_ps(gba, gaa)));
+        __m256 x2dx = _mm256_add_ps(LerpAVX2(GradSignAVX2(ab, 1), GradSignAVX2(bb, 1), u), _mm256_mul_ps(du, _mm256_sub_ps(gbb, gab)));
+        __m256 x1dy = LerpAVX2(GradSignAVX2(aa, 2), GradSignAVX2(ba, 2), u);
+        __m256 x2dy = LerpAVX2(GradSignAVX2(ab, 2), GradSignAVX2(bb, 2), u);
+
+        _mm256_storeu_ps(outDx + i, _mm256_mul_ps(LerpAVX2(x1dx, x2dx, v), half));
+        _mm256_storeu_ps(outDy + i, _mm256_mul_ps(_mm256_add_ps(LerpAVX2(x1dy, x2dy, v), _mm256_mul_ps(dv, _mm256_sub_ps(x2, x1))), half));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_add_ps(LerpAVX2(x1, x2, v), one), half));
+    }
+
+    Perlin2DerivBatchScalar(ps, x + i, y + i, out + i, outDx + i, outDy + i, count - i);
+}
+
+NOISE_AVX2_TARGET static void Perlin3BatchAVX2(const int* ps, const float* x, const float* y, const float* z, float* out, int count)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i oneI = _mm256_set1_epi32(1);
+    const __m256i mask255 = _mm256_set1_epi32(255);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+        __m256 vz = _mm256_loadu_ps(z + i);
+
+        __m256 fx = _mm256_floor_ps(vx);
+        __m256 fy = _mm256_floor_ps(vy);
+        __m256 fz = _mm256_floor_ps(vz);
+
+        __m256i xi = _mm256_and_si256(_mm256_cvttps_epi32(fx), mask255);
+        __m256i yi = _mm256_and_si256(_mm256_cvttps_epi32(fy), mask255);
+        __m256i zi = _mm256_and_si256(_mm256_cvttps_epi32(fz), mask255);
+
+        __m256i a = _mm256_add_epi32(GatherAVX2(ps, xi), yi);
+        __m256i b = _mm256_add_epi32(GatherAVX2(ps, _mm256_add_epi32(xi, oneI)), yi);
+        __m256i aa = _mm256_add_epi32(GatherAVX2(ps, a), zi);
+        __m256i ab = _mm256_add_epi32(GatherAVX2(ps, _mm256_add_epi32(a, oneI)), zi);
+        __m256i ba = _mm256_add_epi32(GatherAVX2(ps, b), zi);
+        __m256i bb = _mm256_add_epi32(GatherAVX2(ps, _mm256_add_epi32(b, oneI)), zi);
+
+        __m256i aaa = GatherAVX2(ps, aa);
+        __m256i aab = GatherAVX2(ps, _mm256_add_epi32(aa, oneI));
+        __m256i aba = GatherAVX2(ps, ab);
+        __m256i abb = GatherAVX2(ps, _mm256_add_epi32(ab, oneI));
+        __m256i baa = GatherAVX2(ps, ba);
+        __m256i bab = GatherAVX2(ps, _mm256_add_epi32(ba, oneI));
+        __m256i bba = GatherAVX2(ps, bb);
+        __m256i bbb = GatherAVX2(ps, _mm256_add_epi32(bb, oneI));
+
+        __m256 xf = _mm256_sub_ps(vx, fx);
+        __m256 yf = _mm256_sub_ps(vy, fy);
+        __m256 zf = _mm256_sub_ps(vz, fz);
+        __m256 xf1 = _mm256_sub_ps(xf, one);
+        __m256 yf1 = _mm256_sub_ps(yf, one);
+        __m256 zf1 = _mm256_sub_ps(zf, one);
+
+        __m256 u = FadeAVX2(xf);
+        __m256 v = FadeAVX2(yf);
+        __m256 w = FadeAVX2(zf);
+
+        __m256 x1 = LerpAVX2(Grad3AVX2(aaa, xf, yf, zf), Grad3AVX2(baa, xf1, yf, zf), u);
+        __m256 x2 = LerpAVX2(Grad3AVX2(aba, xf, yf1, zf), Grad3AVX2(bba, xf1, yf1, zf), u);
+        __m256 y1 = LerpAVX2(x1, x2, v);
+        x1 = LerpAVX2(Grad3AVX2(aab, xf, yf, zf1), Grad3AVX2(bab, xf1, yf, zf1), u);
+        x2 = LerpAVX2(Grad3AVX2(abb, xf, yf1, zf1), Grad3AVX2(bbb, xf1, yf1, zf1), u);
+        __m256 y2 = LerpAVX2(x1, x2, v);
+
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_add_ps(LerpAVX2(y1, y2, w), one), _mm256_set1_ps(0.5f)));
+    }
+
+    Perlin3BatchScalar(ps, x + i, y + i, z + i, out + i, count - i);
+}
+
+static bool CpuSupportsAVX2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // the OS must also save the YMM registers on context switches (OSXSAVE + XCR0 bits 1 and 2)
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif // NOISE_X86
+
+NoiseKernel GetBestNoiseKernel()
+{
+#ifdef NOISE_X86
+    static const bool hasAVX2 = CpuSupportsAVX2();
+    return hasAVX2 ? NoiseKernel::AVX2 : NoiseKernel::SSE2;
+#else
+    return NoiseKernel::Scalar;
+#endif
+}
+
+// atomic, so the kernel can be switched while other threads are sampling
+static std::atomic<NoiseKernel> gNoiseKernel{ GetBestNoiseKernel() };
+
+NoiseKernel GetNoiseKernel()
+{
+    return gNoiseKernel;
+}
+
+void SetNoiseKernel(NoiseKernel kernel)
+{
+    if ((int)kernel > (int)GetBestNoiseKernel())
+    {
+        kernel = GetBestNoiseKernel();
+    }
+    gNoiseKernel = kernel;
+}
+
+const char* GetNoiseKernelName(NoiseKernel kernel)
+{
+    switch (kernel)
+    {
+    case NoiseKernel::Scalar: return "Scalar";
+    case NoiseKernel::SSE2:   return "SSE2";
+    case NoiseKernel::AVX2:   return "AVX2";
+    }
+    return "Unknown";
+}
+
+void Perlin2Batch(const int* perm, const float* x, const float* y, float* out, int count)
+{
+    switch (gNoiseKernel)
+    {
+#ifdef NOISE_X86
+    case NoiseKernel::AVX2: Perlin2BatchAVX2(perm, x, y, out, count); return;
+    case NoiseKernel::SSE2: Perlin2BatchSSE2(perm, x, y, out, count); return;
+#endif
+    default:                Perlin2BatchScalar(perm, x, y, out, count); return;
+    }
+}
+
+void Perlin2DerivBatch(const int* perm, const float* x, const float* y, float* out, float* outDx, float* outDy, int count)
+{
+    switch (gNoiseKernel)
+    {
+#ifdef NOISE_X86
+    case NoiseKernel::AVX2: Perlin2DerivBatchAVX2(perm, x, y, out, outDx, outDy, count); return;
+    case NoiseKernel::SSE2: Perlin2DerivBatchSSE2(perm, x, y, out, outDx, outDy, count); return;
+#endif
+    default:                Perlin2DerivBatchScalar(perm, x, y, out, outDx, outDy, count); return;
+    }
+}
+
+void Perlin3Batch(const int* perm, const float* x, const float* y, const float* z, float* out, int count)
+{
+    switch (gNoiseKernel)
+    {
+#ifdef NOISE_X86
+    case NoiseKernel::AVX2: Perlin3BatchAVX2(perm, x, y, z, out, count); return;
+    case NoiseKernel::SSE2: Perlin3BatchSSE2(perm, x, y, z, out, count); return;
+#endif
+    default:                Perlin3BatchScalar(perm, x, y, z, out, count); return;
+    }
+}
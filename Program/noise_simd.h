@@ -0,0 +1,41 @@
+#pragma once
+
+// Batched single-precision Perlin noise.
+//
+// Evaluates the same noise as Perlin2 / Perlin3 in noise.h (output remapped to [0, 1]),
+// but for many samples per call, 4 (SSE2) or 8 (AVX2) at a time. The kernel is picked at runtime from the CPU's features.
+//
+// Tolerance: the scalar, SSE2 and AVX2 kernels do the same float operations in the same order (no FMA),
+// so they return bit-identical results. Compared to the double precision Perlin2() evaluated at the same (float) coordinates,
+// results differ by at most 1e-6 (float rounding of the fade/lerp chain).
+//
+// perm is a 512 entry permutation table (the 256 entry permutation, repeated twice), eg. PermutationTable::Data().
+// Most code should use the grid functions in noise.h rather than calling these directly.
+
+enum class NoiseKernel
+{
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// fastest kernel supported by this CPU
+NoiseKernel GetBestNoiseKernel();
+
+// the kernel used by the batch functions. Defaults to GetBestNoiseKernel().
+NoiseKernel GetNoiseKernel();
+
+// forces a kernel (eg. to compare them). Kernels the CPU doesn't support fall back to the best supported one.
+void SetNoiseKernel(NoiseKernel kernel);
+
+const char* GetNoiseKernelName(NoiseKernel kernel);
+
+// out[i] = Perlin2(x[i], y[i])
+void Perlin2Batch(const int* perm, const float* x, const float* y, float* out, int count);
+
+// out[i] = Perlin2(x[i], y[i]), and its analytic partial derivatives outDx[i] = d/dx and outDy[i] = d/dy.
+// out is bit-identical to Perlin2Batch.
+void Perlin2DerivBatch(const int* perm, const float* x, const float* y, float* out, float* outDx, float* outDy, int count);
+
+// out[i] = Perlin3(x[i], y[i], z[i])
+void Perlin3Batch(const int* perm, const float* x, const float* y, const float* z, float* out, int count);
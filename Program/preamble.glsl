@@ -9,7 +9,50 @@
 
 #define SCENE_DIFFUSE_MAP_TEXTURE_BINDING 0
 #define SCENE_HEIGHT_COLOR_MAP_TEXTURE_BINDING 1
+#define SCENE_HEIGHT_MAP_TEXTURE_BINDING 2
+#define SCENE_NORMAL_MAP_TEXTURE_BINDING 3
+#define SCENE_CLOUD_SHADOW_TEXTURE_BINDING 4
 
 #define DEPTHVIS_DEPTH_MAP_TEXTURE_BINDING 0
 
+// Clouds: how far from the camera they are marched, in world units
+#define CLOUD_MAX_DISTANCE 50.0
+
+// the layer the clouds are in, between these heights
+#define CLOUD_BOTTOM 10.0
+#define CLOUD_TOP 13.0
+
+// baked cloud noise (see cloud_noise.h): CLOUD_NOISE_SIZE texels across a tile of CLOUD_NOISE_TILE world units,
+// CLOUD_NOISE_LAYERS texels from the bottom to the top of the layer, and texels of [0, CLOUD_NOISE_RANGE]
+#define CLOUD_NOISE_SIZE 256
+#define CLOUD_NOISE_LAYERS 24
+#define CLOUD_NOISE_TILE 32.0
+#define CLOUD_NOISE_RANGE 10.0
+
+// the min and max of the cloud noise in bricks of CLOUD_BRICK_TEXELS^3 texels, and CLOUD_BRICK_LEVELS - 1 coarser levels above them
+#define CLOUD_BRICK_TEXELS 4
+#define CLOUD_BRICK_LEVELS 4
+
+// the clouds' shadow map (see cloud_shadow.frag): CLOUD_SHADOW_SIZE texels across a tile of the noise
+#define CLOUD_SHADOW_SIZE 128
+
+#define CLOUD_SCENE_DEPTH_TEXTURE_BINDING 0
+#define CLOUD_SAMPLE_TEXTURE_BINDING 1
+#define CLOUD_NOISE_TEXTURE_BINDING 2
+#define CLOUD_BRICK_TEXTURE_BINDING 3
+
+// Terrain LOD
+#define CDLOD_PATCH_RESOLUTION 32
+
+// Terrain generation (compute)
+#define TERRAIN_GEN_LOCAL_SIZE 8
+#define TERRAIN_GEN_MAX_OCTAVES 16
+
+#define TERRAIN_GEN_PERMUTATION_BUFFER_BINDING 0
+#define TERRAIN_GEN_HEIGHT_BUFFER_BINDING 1
+#define TERRAIN_GEN_BOUNDS_BUFFER_BINDING 2
+
+#define TERRAIN_GEN_HEIGHT_IMAGE_BINDING 0
+#define TERRAIN_GEN_NORMAL_IMAGE_BINDING 1
+
 #endif // PREAMBLE_GLSL
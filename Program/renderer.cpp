@@ -1,6 +1,10 @@
 #include "renderer.h"
 
 #include "scene.h"
+#include "arena.h"
+#include "cloud_noise.h"
+#include "noise_simd.h"
+#include "threadpool.h"
 
 #include "imgui.h"
 
@@ -13,6 +17,10 @@
 
 #include <SDL.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
 void Renderer::Init(Scene* scene)
 {
     mScene = scene;
@@ -21,7 +29,123 @@ void Renderer::Init(Scene* scene)
     mShaders.SetVersion("410");
     mShaders.SetPreambleFile("preamble.glsl");
 
-    mSceneSP = mShaders.AddProgramFromExts({ "scene.vert", "scene.frag" });
+    // terrain_heightmap.glsl is a library of functions shared by the terrain vertex shaders
+    mSceneSP = mShaders.AddProgram({ { "scene.vert", GL_VERTEX_SHADER }, { "scene.frag", GL_FRAGMENT_SHADER } });
+    mGridSP = mShaders.AddProgram({
+        { "terrain_grid.vert", GL_VERTEX_SHADER },
+        { "terrain_heightmap.glsl", GL_VERTEX_SHADER },
+        { "scene.frag", GL_FRAGMENT_SHADER } });
+    mCdlodSP = mShaders.AddProgram({
+        { "terrain_cdlod.vert", GL_VERTEX_SHADER },
+        { "terrain_heightmap.glsl", GL_VERTEX_SHADER },
+        { "scene.frag", GL_FRAGMENT_SHADER } });
+    mTessSP = mShaders.AddProgram({
+        { "terrain_tess.vert", GL_VERTEX_SHADER },
+        { "terrain_heightmap.glsl", GL_VERTEX_SHADER },
+        { "terrain_tess.tesc", GL_TESS_CONTROL_SHADER },
+        { "terrain_tess.tese", GL_TESS_EVALUATION_SHADER },
+        { "terrain_heightmap.glsl", GL_TESS_EVALUATION_SHADER },
+        { "scene.frag", GL_FRAGMENT_SHADER } });
+
+    // the clouds are marched per pixel after the scene is drawn, at a reduced resolution, then upsampled over it.
+    // clouds.glsl has the density and the march.
+    mCloudMarchSP = mShaders.AddProgram({
+        { "fullscreen.vert", GL_VERTEX_SHADER },
+        { "cloud_march.frag", GL_FRAGMENT_SHADER },
+        { "clouds.glsl", GL_FRAGMENT_SHADER } });
+    mCloudCompositeSP = mShaders.AddProgram({ { "fullscreen.vert", GL_VERTEX_SHADER }, { "cloud_composite.frag", GL_FRAGMENT_SHADER } });
+    // and their shadows are marched once per texel of a map, with the same density, when they change
+    mCloudShadowSP = mShaders.AddProgram({
+        { "fullscreen.vert", GL_VERTEX_SHADER },
+        { "cloud_shadow.frag", GL_FRAGMENT_SHADER },
+        { "clouds.glsl", GL_FRAGMENT_SHADER } });
+
+    // GPU terrain generation, when the context has compute shaders. Until they compile, the CPU path is used.
+    GLint glMajorVersion, glMinorVersion;
+    glGetIntegerv(GL_MAJOR_VERSION, &glMajorVersion);
+    glGetIntegerv(GL_MINOR_VERSION, &glMinorVersion);
+    if (glMajorVersion > 4 || (glMajorVersion == 4 && glMinorVersion >= 3))
+    {
+        mComputeShaders.SetVersion("430");
+        mComputeShaders.SetPreambleFile("preamble.glsl");
+
+        mScene->TerrainHeightsCS = mComputeShaders.AddProgram({ { "terrain_heights.comp", GL_COMPUTE_SHADER } });
+    }
+
+    // CDLOD patch: (N+1)^2 vertices with positions in [0, 1]^2, and the indices of each quadrant stored one after the other
+    {
+        const int n = CDLOD_PATCH_RESOLUTION;
+
+        std::vector<glm::vec2> positions;
+        for (int z = 0; z <= n; z++)
+        {
+            for (int x = 0; x <= n; x++)
+            {
+                positions.emplace_back((float)x / n, (float)z / n);
+            }
+        }
+
+        std::vector<GLushort> indices;
+        for (int quadrant = 0; quadrant < 4; quadrant++)
+        {
+            int x0 = (quadrant & 1) * n / 2;
+            int z0 = (quadrant >> 1) * n / 2;
+            for (int z = z0; z < z0 + n / 2; z++)
+            {
+                for (int x = x0; x < x0 + n / 2; x++)
+                {
+                    GLushort topLeft = (GLushort)(z * (n + 1) + x);
+                    GLushort bottomLeft = (GLushort)((z + 1) * (n + 1) + x);
+                    indices.insert(end(indices), { topLeft, (GLushort)(topLeft + 1), bottomLeft });
+                    indices.insert(end(indices), { (GLushort)(bottomLeft + 1), (GLushort)(topLeft + 1), bottomLeft });
+                }
+            }
+        }
+
+        glGenBuffers(1, &mCdlodPatchPositionBO);
+        glBindBuffer(GL_ARRAY_BUFFER, mCdlodPatchPositionBO);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(positions[0]), positions.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glGenBuffers(1, &mCdlodPatchIndexBO);
+        glBindBuffer(GL_ARRAY_BUFFER, mCdlodPatchIndexBO);
+        glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(indices[0]), indices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glGenVertexArrays(1, &mCdlodPatchVAO);
+        glBindVertexArray(mCdlodPatchVAO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, mCdlodPatchPositionBO);
+        glVertexAttribPointer(SCENE_POSITION_ATTRIB_LOCATION, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glEnableVertexAttribArray(SCENE_POSITION_ATTRIB_LOCATION);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mCdlodPatchIndexBO);
+
+        glBindVertexArray(0);
+    }
+
+    glGenVertexArrays(1, &mTessPatchVAO);
+    glGenVertexArrays(1, &mFullscreenVAO);
+
+    glGenQueries(1, &mTerrainPrimitivesQuery);
+    glGenQueries(1, &mTerrainTimeQuery);
+    glGenQueries(1, &mCloudTimeQuery);
+
+    glGenBuffers(1, &mCloudStepsPBO);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, mCloudStepsPBO);
+    glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(float), NULL, GL_STREAM_READ);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    GLint numExtensions;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; i++)
+    {
+        if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_pipeline_statistics_query") == 0)
+        {
+            glGenQueries(1, &mTerrainVertexInvocationsQuery);
+        }
+    }
 
     float maxAnisotropy;
     glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
@@ -59,11 +183,80 @@ void Renderer::Resize(int width, int height)
         }
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
+
+    // the clouds are blended onto the backbuffer's color while its depth is read as a texture, so they get an FBO without the depth
+    {
+        glDeleteFramebuffers(1, &mCloudCompositeFBO);
+        glGenFramebuffers(1, &mCloudCompositeFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, mCloudCompositeFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mBackbufferColorTO, 0);
+        GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (fboStatus != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "glCheckFramebufferStatus: %x\n", fboStatus);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    ResizeCloudTarget();
+}
+
+void Renderer::ResizeCloudTarget()
+{
+    // rounded up, so the last samples cover the edge of the screen
+    mCloudTargetDownsample = mCloudDownsample;
+    mCloudTargetWidth = (mBackbufferWidth + mCloudDownsample - 1) / mCloudDownsample;
+    mCloudTargetHeight = (mBackbufferHeight + mCloudDownsample - 1) / mCloudDownsample;
+
+    // how much the clouds block the scene, and the scene's distance from the camera
+    glDeleteTextures(1, &mCloudSampleTO);
+    glGenTextures(1, &mCloudSampleTO);
+    glBindTexture(GL_TEXTURE_2D, mCloudSampleTO);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, mCloudTargetWidth, mCloudTargetHeight, 0, GL_RG, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // the steps of each ray. The march only covers the target's size, so the texels past it stay 0,
+    // and they're taken back out of the average when it's read.
+    mCloudStepsWidth = 1;
+    mCloudStepsHeight = 1;
+    while (mCloudStepsWidth < mCloudTargetWidth)
+    {
+        mCloudStepsWidth *= 2;
+    }
+    while (mCloudStepsHeight < mCloudTargetHeight)
+    {
+        mCloudStepsHeight *= 2;
+    }
+    std::vector<float> noSteps((size_t)mCloudStepsWidth * mCloudStepsHeight, 0.0f);
+
+    glDeleteTextures(1, &mCloudStepsTO);
+    glGenTextures(1, &mCloudStepsTO);
+    glBindTexture(GL_TEXTURE_2D, mCloudStepsTO);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, mCloudStepsWidth, mCloudStepsHeight, 0, GL_RED, GL_FLOAT, noSteps.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glDeleteFramebuffers(1, &mCloudSampleFBO);
+    glGenFramebuffers(1, &mCloudSampleFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, mCloudSampleFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mCloudSampleTO, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mCloudStepsTO, 0);
+    GLenum cloudDrawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, cloudDrawBuffers);
+    GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (fboStatus != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "glCheckFramebufferStatus: %x\n", fboStatus);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void Renderer::Render()
 {
     mShaders.UpdatePrograms();
+    mComputeShaders.UpdatePrograms();
 
     // Clear last frame
     {
@@ -80,10 +273,161 @@ void Renderer::Render()
     if (ImGui::Begin("World Generation", 0, ImGuiWindowFlags_AlwaysAutoResize))
     {
         ImGui::SliderInt("Seed", &mSeed, 0, 100);
+        // takes effect on the next regenerate
+        ImGui::SliderInt("Grid Size", &mScene->TerrainGridSize, TERRAIN_MIN_GRID_SIZE, TERRAIN_MAX_GRID_SIZE);
+
+        // the adaptive mesh is made with the world, so changing it regenerates the world too
+        bool meshChanged = ImGui::Checkbox("Adaptive Mesh", &mScene->TerrainAdaptiveMesh);
+        if (mScene->TerrainAdaptiveMesh)
+        {
+            meshChanged |= ImGui::SliderFloat("Max Error", &mScene->TerrainMeshMaxError, 0.0005f, 0.05f, "%.4f", 2.0f);
+        }
+        if (meshChanged)
+        {
+            RequestWorldRegeneration(mScene, (int)mSeed);
+        }
+
+        // the whole world has to be regenerated, or streamed chunks wouldn't match their neighbours.
+        // while dragging a slider, only the latest request is kept, and each world is previewed as soon as it starts building.
+        TerrainFractalSettings& terrainSettings = mScene->TerrainSettings;
+        bool settingsChanged = false;
+        int fractal = (int)terrainSettings.Fractal;
+        if (ImGui::Combo("Fractal", &fractal, "Hybrid multifractal\0fBm\0Ridged multifractal\0Spectral (FFT)\0\0"))
+        {
+            terrainSettings.Fractal = (FractalType)fractal;
+            terrainSettings.H = GetDefaultTerrainH(terrainSettings.Fractal);
+            settingsChanged = true;
+        }
+        settingsChanged |= ImGui::SliderFloat("H", &terrainSettings.H, 0.0f, 2.0f);
+        settingsChanged |= ImGui::SliderFloat("Lacunarity", &terrainSettings.Lacunarity, 1.5f, 4.0f);
+        settingsChanged |= ImGui::SliderInt("Octaves", &terrainSettings.Octaves, FRACTAL_MIN_OCTAVES, FRACTAL_MAX_OCTAVES);
+        settingsChanged |= ImGui::SliderFloat("Height Scale", &terrainSettings.HeightScale, 0.25f, 4.0f);
+        if (settingsChanged)
+        {
+            RequestWorldRegeneration(mScene, (int)mSeed);
+        }
     }
     if (ImGui::Button("Regenerate Scene"))
     {
-        GenerateWorld((int)mSeed, mScene);
+        RequestWorldRegeneration(mScene, (int)mSeed);
+    }
+    ImGui::SameLine();
+    ImGui::Checkbox("Progressive Preview", &mScene->WorldRegen.Progressive);
+    const WorldRegeneration& regen = mScene->WorldRegen;
+    if (regen.CurrentStage == WorldRegeneration::Building && regen.PreviewStep != 0)
+    {
+        ImGui::Text("Building seed %d, previewing every %d vertices...", regen.Seed, regen.PreviewStep);
+    }
+    else if (regen.CurrentStage == WorldRegeneration::Building)
+    {
+        ImGui::Text("Building seed %d...", regen.Seed);
+    }
+    else if (regen.CurrentStage == WorldRegeneration::Uploading)
+    {
+        ImGui::Text("Uploading seed %d: %d%%", regen.Seed, regen.UploadedRows * 100 / (regen.GridSize + 1));
+    }
+    ImGui::Text("Worlds: %d swapped in, %d superseded", regen.NumCompleted, regen.NumSuperseded);
+    TerrainHeightfieldCache& heightfieldCache = mScene->HeightfieldCache;
+    ImGui::Checkbox("Disk Cache", &heightfieldCache.Enabled);
+    ImGui::SameLine();
+    ImGui::Text("%d hits, %d misses, %d stored", (int)heightfieldCache.NumHits, (int)heightfieldCache.NumMisses, (int)heightfieldCache.NumStored);
+    ImGui::Text("GL pool: %.1f MB idle, %d recycled, %d created",
+        mScene->GLPool.GetIdleBytes() / (1024.0f * 1024.0f), (int)mScene->GLPool.NumRecycled, (int)mScene->GLPool.NumCreated);
+
+    int noiseKernel = (int)GetNoiseKernel();
+    if (ImGui::Combo("Noise Kernel", &noiseKernel, "Scalar\0SSE2\0AVX2\0\0"))
+    {
+        SetNoiseKernel((NoiseKernel)noiseKernel);
+    }
+    if (mScene->TerrainHeightsCS)
+    {
+        ImGui::Checkbox("Generate on GPU", &mScene->TerrainGenUseGPU);
+    }
+    else
+    {
+        ImGui::Text("GPU generation needs GL 4.3");
+    }
+    ImGui::SliderInt("Generation Threads", &mScene->TerrainGenMaxThreads, 1, GetThreadPool().GetMaxThreads());
+    if (mScene->TerrainGenOnGPU)
+    {
+        ImGui::Text("Heightfield: %.2f ms on the GPU", mScene->TerrainGenHeightfieldMs);
+    }
+    else if (mScene->TerrainGenFromCache)
+    {
+        ImGui::Text("Heightfield: %.2f ms from the disk cache", mScene->TerrainGenHeightfieldMs);
+    }
+    else
+    {
+        ImGui::Text("Heightfield: %.2f ms on %d threads", mScene->TerrainGenHeightfieldMs, mScene->TerrainGenThreadsUsed);
+    }
+    if (ImGui::Button("Measure Thread Scaling"))
+    {
+        mGenerationScalingDeterministic = MeasureTerrainGenerationScaling(mScene->TerrainNoise, mScene->TerrainSettings, mScene->TerrainGridSize, &mGenerationScalingMs);
+    }
+    if (!mGenerationScalingMs.empty())
+    {
+        for (size_t i = 0; i < mGenerationScalingMs.size(); i++)
+        {
+            ImGui::Text("%2d threads: %6.2f ms (%.2fx)", (int)i + 1, mGenerationScalingMs[i], mGenerationScalingMs[0] / mGenerationScalingMs[i]);
+        }
+        ImGui::Text(mGenerationScalingDeterministic ? "Output identical for all thread counts" : "Output DIFFERS between thread counts!");
+    }
+
+    TerrainChunkCache& chunks = mScene->TerrainChunks;
+    if (ImGui::Checkbox("Infinite Terrain", &chunks.Enabled))
+    {
+        RequestWorldRegeneration(mScene, (int)mSeed);
+    }
+    if (chunks.Enabled)
+    {
+        if (ImGui::SliderInt("View Radius", &chunks.ViewRadius, 1, 8))
+        {
+            chunks.KeepRadius = chunks.ViewRadius + 1;
+        }
+        if (ImGui::SliderInt("Chunk Grid Size", &chunks.GridSize, TERRAIN_MIN_GRID_SIZE, 512))
+        {
+            // the cached chunks have the old size, so start over
+            RequestWorldRegeneration(mScene, (int)mSeed);
+        }
+
+        int budgetMB = (int)(chunks.MemoryBudget / (1024 * 1024));
+        if (ImGui::SliderInt("Memory Budget (MB)", &budgetMB, 16, 512))
+        {
+            chunks.MemoryBudget = (size_t)budgetMB * 1024 * 1024;
+        }
+
+        ImGui::Text("Chunks: %d (%.1f MB)", (int)chunks.LRU.size(), chunks.MemoryUsed / (1024.0f * 1024.0f));
+    }
+
+    ImGui::End();
+
+    if (ImGui::Begin("Terrain Sculpting", 0, ImGuiWindowFlags_AlwaysAutoResize))
+    {
+        TerrainSculpt& sculpt = mScene->Sculpt;
+        ImGui::Checkbox("Sculpt (left mouse)", &sculpt.Enabled);
+
+        int brush = (int)sculpt.Brush;
+        ImGui::RadioButton("Raise", &brush, (int)SculptBrush::Raise);
+        ImGui::SameLine();
+        ImGui::RadioButton("Lower", &brush, (int)SculptBrush::Lower);
+        ImGui::SameLine();
+        ImGui::RadioButton("Smooth", &brush, (int)SculptBrush::Smooth);
+        ImGui::SameLine();
+        ImGui::RadioButton("Flatten", &brush, (int)SculptBrush::Flatten);
+        sculpt.Brush = (SculptBrush)brush;
+
+        ImGui::SliderFloat("Radius", &sculpt.Radius, 0.1f, 4.0f);
+        ImGui::SliderFloat("Strength", &sculpt.Strength, 0.1f, 10.0f, "%.2f", 2.0f);
+
+        if (sculpt.Enabled && mScene->TerrainChunks.Enabled)
+        {
+            ImGui::Text("Streamed chunks can't be sculpted");
+        }
+        else if (sculpt.Enabled && sculpt.TerrainID != (uint32_t)-1)
+        {
+            ImGui::Text("Last edit: %d vertices in %.2f ms", sculpt.LastEditVertices, sculpt.LastEditMs);
+            ImGui::Text("Height range widened %d times", sculpt.NumRangeWidenings);
+        }
     }
 
     ImGui::End();
@@ -100,10 +444,123 @@ void Renderer::Render()
 	if (ImGui::Begin("Cloud Thickness", 0, ImGuiWindowFlags_AlwaysAutoResize))
 	{
 		ImGui::SliderFloat("", &mCloudThickness, 0, 1);
+        ImGui::SliderFloat("Coverage", &mCloudCoverage, 0, 1);
 	}
 
     ImGui::End();
 
+    if (ImGui::Begin("Cloud Rendering", 0, ImGuiWindowFlags_AlwaysAutoResize))
+    {
+        // the clouds are marched once per pixel of a target this many times smaller than the screen
+        int resolution = mCloudDownsample == 1 ? 0 : mCloudDownsample == 2 ? 1 : 2;
+        if (ImGui::Combo("Resolution", &resolution, "Full\0Half\0Quarter\0\0"))
+        {
+            mCloudDownsample = 1 << resolution;
+        }
+        ImGui::Checkbox("Skip empty space", &mCloudSkipEmpty);
+        if (mCloudSkipEmpty)
+        {
+            ImGui::Checkbox("Skip empty bricks", &mCloudUseBricks);
+        }
+        ImGui::Checkbox("Shadows", &mCloudShadows);
+        ImGui::Text("Shadow map: %d x %d, drawn %d times", CLOUD_SHADOW_SIZE, CLOUD_SHADOW_SIZE, mCloudShadowDraws);
+        ImGui::Text("Rays: %d x %d", mCloudTargetWidth, mCloudTargetHeight);
+        ImGui::Text("Average steps per ray: %.1f", mCloudStepsPerRay);
+        ImGui::Text("Cloud GPU time: %.2f ms", mCloudGpuMs);
+
+        ImGui::SliderInt("Seed", &mCloudSeed, 0, 100);
+        if (mCloudNoiseTO)
+        {
+            ImGui::Text("Noise %s in %.1f ms", mCloudNoiseCached ? "loaded from the cache" : "baked", mCloudNoiseMs);
+        }
+    }
+
+    ImGui::End();
+
+    if (ImGui::Begin("Terrain Rendering", 0, ImGuiWindowFlags_AlwaysAutoResize))
+    {
+        int renderMode = (int)mTerrainRenderMode;
+        if (ImGui::Combo("Mode", &renderMode, "Full Grid\0CDLOD\0Tessellation\0\0"))
+        {
+            mTerrainRenderMode = (TerrainRenderMode)renderMode;
+        }
+        if (mTerrainRenderMode == TerrainRenderMode::Cdlod)
+        {
+            ImGui::SliderFloat("Pixel Error", &mCdlodPixelError, 0.5f, 16.0f);
+            ImGui::SliderFloat("Morph Ratio", &mCdlodMorphRatio, 0.05f, 0.5f);
+        }
+        if (mTerrainRenderMode == TerrainRenderMode::Tessellation)
+        {
+            ImGui::SliderFloat("Edge Length (px)", &mTessTargetEdgePixels, 1.0f, 32.0f);
+        }
+        // counts from the previous frame. The tessellated triangles are only known to the GPU.
+        ImGui::Text("Frame: %.2f ms", 1000.0f / ImGui::GetIO().Framerate);
+        ImGui::Text("Draw calls: %d", mTerrainDrawCalls);
+        if (mTerrainRenderMode != TerrainRenderMode::Tessellation)
+        {
+            ImGui::Text("Triangles: %.2f M", mTerrainTrianglesDrawn / 1000000.0f);
+        }
+        ImGui::Text("Primitives generated: %.2f M", mTerrainPrimitivesGenerated / 1000000.0f);
+        ImGui::Text("Terrain GPU time: %.2f ms", mTerrainGpuMs);
+        if (mTerrainVertexInvocationsQuery)
+        {
+            ImGui::Text("Vertex shader invocations: %.2f M", mTerrainVertexInvocations / 1000000.0f);
+        }
+
+        // the grid index buffers shared by the full grid terrains and the water, and the unused ones kept for the next meshes
+        size_t indexBytes = 0;
+        size_t unsharedIndexBytes = 0;
+        for (const auto& sizeAndBuffer : mScene->GridIndices.GetBuffers())
+        {
+            const GridIndexBuffer& buffer = sizeAndBuffer.second;
+            indexBytes += buffer.Bytes;
+            unsharedIndexBytes += (size_t)buffer.RefCount * buffer.IndexCount * sizeof(GLuint);
+            ImGui::Text("Grid %d: %d meshes, %s indices",
+                sizeAndBuffer.first, buffer.RefCount, buffer.IndexType == GL_UNSIGNED_SHORT ? "16-bit" : "32-bit");
+        }
+        ImGui::Text("Grid indices: %.1f KB, %.1f KB unused (%.1f KB as 32-bit buffers per mesh)",
+            indexBytes / 1024.0f, mScene->GridIndices.GetIdleBytes() / 1024.0f, unsharedIndexBytes / 1024.0f);
+
+        // simulated per grid size the first time the node is opened, which takes a while for the big grids
+        if (ImGui::TreeNode("Vertex cache"))
+        {
+            mScene->GridIndices.UpdateStats();
+            for (const auto& sizeAndBuffer : mScene->GridIndices.GetBuffers())
+            {
+                const GridIndexBuffer& buffer = sizeAndBuffer.second;
+                ImGui::Text("Grid %d: ACMR %.2f (row order %.2f)", sizeAndBuffer.first, buffer.ACMR, buffer.RowOrderACMR);
+            }
+            ImGui::TreePop();
+        }
+
+        // the heightfield textures, and the float position and normal buffers they replace
+        size_t heightfieldBytes = 0;
+        size_t vertexBufferBytes = 0;
+        for (uint32_t terrainID : mScene->Terrains)
+        {
+            const Terrain& terrain = mScene->Terrains[terrainID];
+            if (terrain.HeightTO)
+            {
+                heightfieldBytes += GetTerrainTexelBytes(terrain.gridSize);
+                vertexBufferBytes += (size_t)(terrain.gridSize + 1) * (terrain.gridSize + 1) * 2 * sizeof(glm::vec3);
+            }
+        }
+        ImGui::Text("Heightfields: %.1f MB (%.1f MB as vertex buffers)", heightfieldBytes / 1048576.0f, vertexBufferBytes / 1048576.0f);
+
+        // the adaptive meshes are only drawn by the full grid renderer. CDLOD and tessellation make their own triangles.
+        for (uint32_t terrainID : mScene->Terrains)
+        {
+            const Terrain& terrain = mScene->Terrains[terrainID];
+            if (terrain.AdaptiveMesh)
+            {
+                size_t gridTriangles = (size_t)terrain.gridSize * terrain.gridSize * 2;
+                ImGui::Text("Adaptive mesh: %.2f M triangles, %.1f%% of the grid's", terrain.IndexCount / 3 / 1000000.0f, 100.0f * terrain.IndexCount / 3 / gridTriangles);
+            }
+        }
+    }
+
+    ImGui::End();
+
     // Clear last frame
     {
         glBindFramebuffer(GL_FRAMEBUFFER, mBackbufferFBO);
@@ -118,6 +575,8 @@ void Renderer::Render()
     // render scene
     if (*mSceneSP)
     {
+        bool cloudShadows = UpdateCloudShadows();
+
         glUseProgram(*mSceneSP);
 
 		//Nick
@@ -140,8 +599,6 @@ void Renderer::Render()
         GLint SCENE_CAMERAPOS_UNIFORM_LOCATION = glGetUniformLocation(*mSceneSP, "CameraPos");
         GLint SCENE_LIGHTPOS_UNIFORM_LOCATION = glGetUniformLocation(*mSceneSP, "LightPos");
         GLint SCENE_LIGHTMATRIX_UNIFORM_LOCATION = glGetUniformLocation(*mSceneSP, "lightMatrix");
-		GLint SCENE_CLOUD_HUE_UNIFORM_LOCATION = glGetUniformLocation(*mSceneSP, "CloudHue");
-		GLint SCENE_CLOUD_THICKNESS_UNIFORM_LOCATION = glGetUniformLocation(*mSceneSP, "CloudThickness");
 		GLint SCENE_HEIGHT_COLOR_TEXTURE_UNIFORM_LOCATION = glGetUniformLocation(*mSceneSP, "HeightColorTexture");
 
         const Camera& mainCamera = mScene->MainCamera;
@@ -175,11 +632,71 @@ void Renderer::Render()
         glProgramUniform3fv(*mSceneSP, SCENE_LIGHTPOS_UNIFORM_LOCATION, 1, value_ptr(lightPos));
         glProgramUniformMatrix4fv(*mSceneSP, SCENE_LIGHTMATRIX_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(lightMatrix));
 
-		glm::vec4 cloudHue(mCloudRed, mCloudGreen, mCloudBlue, 1);
-		GLfloat cloudThickness(mCloudThickness);
+        // the sculpting brush's outline, at (x, z) with its radius. A radius of 0 hides it.
+        const TerrainSculpt& sculpt = mScene->Sculpt;
+        glm::vec3 sculptBrush(sculpt.Target.x, sculpt.Target.z, sculpt.Enabled && sculpt.HasTarget ? sculpt.Radius : 0.0f);
+        glProgramUniform3fv(*mSceneSP, glGetUniformLocation(*mSceneSP, "SculptBrush"), 1, value_ptr(sculptBrush));
+
+        // shared by every program with scene.frag
+        for (GLuint program : { *mSceneSP, *mGridSP, *mCdlodSP, *mTessSP })
+        {
+            if (!program)
+                continue;
+
+            glProgramUniform1i(program, glGetUniformLocation(program, "CloudShadows"), cloudShadows);
+            glProgramUniform1i(program, glGetUniformLocation(program, "CloudShadow"), SCENE_CLOUD_SHADOW_TEXTURE_BINDING);
+            glProgramUniform3fv(program, glGetUniformLocation(program, "CloudShadowToLight"), 1, value_ptr(mCloudShadowToLight));
+        }
+        glActiveTexture(GL_TEXTURE0 + SCENE_CLOUD_SHADOW_TEXTURE_BINDING);
+        glBindTexture(GL_TEXTURE_2D, mCloudShadowTO);
+
+        for (GLuint terrainSP : { *mGridSP, *mCdlodSP, *mTessSP })
+        {
+            if (!terrainSP)
+                continue;
+
+            // same fragment shader as the scene program
+            glProgramUniform3fv(terrainSP, glGetUniformLocation(terrainSP, "CameraPos"), 1, value_ptr(eye));
+            glProgramUniform3fv(terrainSP, glGetUniformLocation(terrainSP, "LightPos"), 1, value_ptr(lightPos));
+            glProgramUniform3fv(terrainSP, glGetUniformLocation(terrainSP, "SculptBrush"), 1, value_ptr(sculptBrush));
+            glProgramUniform1i(terrainSP, glGetUniformLocation(terrainSP, "HeightColorTexture"), SCENE_HEIGHT_COLOR_MAP_TEXTURE_BINDING);
+            glProgramUniform1i(terrainSP, glGetUniformLocation(terrainSP, "HeightMap"), SCENE_HEIGHT_MAP_TEXTURE_BINDING);
+            glProgramUniform1i(terrainSP, glGetUniformLocation(terrainSP, "NormalMap"), SCENE_NORMAL_MAP_TEXTURE_BINDING);
+        }
+
+        mTerrainDrawCalls = 0;
+        mTerrainTrianglesDrawn = 0;
 
-		glProgramUniform4fv(*mSceneSP, SCENE_CLOUD_HUE_UNIFORM_LOCATION, 1, value_ptr(cloudHue));
-		glProgramUniform1f(*mSceneSP, SCENE_CLOUD_THICKNESS_UNIFORM_LOCATION, cloudThickness);
+        // a query can only be restarted once its last result has been read
+        bool startTerrainQueries = true;
+        if (mTerrainQueriesPending)
+        {
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(mTerrainTimeQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 elapsedNs;
+                glGetQueryObjectui64v(mTerrainTimeQuery, GL_QUERY_RESULT, &elapsedNs);
+                glGetQueryObjectui64v(mTerrainPrimitivesQuery, GL_QUERY_RESULT, &mTerrainPrimitivesGenerated);
+                if (mTerrainVertexInvocationsQuery)
+                {
+                    glGetQueryObjectui64v(mTerrainVertexInvocationsQuery, GL_QUERY_RESULT, &mTerrainVertexInvocations);
+                }
+                mTerrainGpuMs = elapsedNs / 1000000.0f;
+                mTerrainQueriesPending = false;
+            }
+            startTerrainQueries = !mTerrainQueriesPending;
+        }
+
+        if (startTerrainQueries)
+        {
+            glBeginQuery(GL_PRIMITIVES_GENERATED, mTerrainPrimitivesQuery);
+            glBeginQuery(GL_TIME_ELAPSED, mTerrainTimeQuery);
+            if (mTerrainVertexInvocationsQuery)
+            {
+                glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, mTerrainVertexInvocationsQuery);
+            }
+        }
 
         glBindFramebuffer(GL_FRAMEBUFFER, mBackbufferFBO);
         glViewport(0, 0, mBackbufferWidth, mBackbufferHeight);
@@ -207,32 +724,63 @@ void Renderer::Render()
 
             glm::mat4 modelViewProjection = worldProjection * modelWorld;
 
-            glProgramUniformMatrix4fv(*mSceneSP, SCENE_MODELWORLD_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(modelWorld));
-            glProgramUniformMatrix3fv(*mSceneSP, SCENE_NORMAL_MODELWORLD_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(normal_ModelWorld));
-            glProgramUniformMatrix4fv(*mSceneSP, SCENE_MODELVIEWPROJECTION_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(modelViewProjection));
-
 			//
 			glActiveTexture(GL_TEXTURE0 + SCENE_HEIGHT_COLOR_MAP_TEXTURE_BINDING);
 			glProgramUniform1i(*mSceneSP, SCENE_HEIGHT_COLOR_TEXTURE_UNIFORM_LOCATION, SCENE_HEIGHT_COLOR_MAP_TEXTURE_BINDING);
 			glBindTexture(GL_TEXTURE_1D, mScene->heightColorTexture);
 			//
 
+            // the meshes with vertex buffers (the water, and previews) are always drawn as a full grid with the scene program
+            bool hasHeightmap = terrain->HeightTO != 0;
+            if (mTerrainRenderMode == TerrainRenderMode::Cdlod && hasHeightmap && *mCdlodSP)
+            {
+                RenderTerrainCdlod(*terrain, modelWorld, normal_ModelWorld, worldProjection);
+                continue;
+            }
+            if (mTerrainRenderMode == TerrainRenderMode::Tessellation && hasHeightmap && *mTessSP)
+            {
+                RenderTerrainTessellated(*terrain, modelWorld, normal_ModelWorld, worldProjection);
+                continue;
+            }
+            if (hasHeightmap)
+            {
+                RenderTerrainGrid(*terrain, modelWorld, normal_ModelWorld, worldProjection);
+                continue;
+            }
+
+            glProgramUniformMatrix4fv(*mSceneSP, SCENE_MODELWORLD_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(modelWorld));
+            glProgramUniformMatrix3fv(*mSceneSP, SCENE_NORMAL_MODELWORLD_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(normal_ModelWorld));
+            glProgramUniformMatrix4fv(*mSceneSP, SCENE_MODELVIEWPROJECTION_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(modelViewProjection));
+
             glBindVertexArray(terrain->MeshVAO);
 
-            glDrawElementsBaseVertex(GL_TRIANGLES, (terrain->gridSize)*(terrain->gridSize)*2*3, GL_UNSIGNED_INT, 0, 0);
+            glDrawElementsBaseVertex(GL_TRIANGLES, terrain->IndexCount, terrain->IndexType, 0, 0);
+            mTerrainDrawCalls++;
+            mTerrainTrianglesDrawn += terrain->IndexCount / 3;
             //glPointSize(10);
-            //glDrawElementsBaseVertex(GL_POINTS, (terrain->gridSize)*(terrain->gridSize)*2*3, GL_UNSIGNED_INT, 0, 0);
+            //glDrawElementsBaseVertex(GL_POINTS, terrain->IndexCount, GL_UNSIGNED_INT, 0, 0);
 
             glBindVertexArray(0);
         }
 
-
+        if (startTerrainQueries)
+        {
+            if (mTerrainVertexInvocationsQuery)
+            {
+                glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB);
+            }
+            glEndQuery(GL_TIME_ELAPSED);
+            glEndQuery(GL_PRIMITIVES_GENERATED);
+            mTerrainQueriesPending = true;
+        }
 
         glDisable(GL_DEPTH_TEST);
         glDisable(GL_FRAMEBUFFER_SRGB);
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
         glUseProgram(0);
+
+        RenderClouds(worldProjection, eye);
     }
 
     // Render ImGui
@@ -254,6 +802,417 @@ void Renderer::Render()
     }
 }
 
+void Renderer::UpdateCloudNoise()
+{
+    if (mCloudNoiseTO && mCloudNoiseSeed == mCloudSeed)
+    {
+        return;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+
+    CloudNoiseCache cache;
+    CachedCloudNoise cached;
+    const uint16_t* texels;
+    mCloudNoiseCached = cache.Load((uint32_t)mCloudSeed, &cached);
+    if (mCloudNoiseCached)
+    {
+        texels = cached.Texels;
+    }
+    else
+    {
+        uint16_t* baked = scratch.Allocate<uint16_t>(GetCloudNoiseTexelCount());
+        BakeCloudNoise((uint32_t)mCloudSeed, baked, GetThreadPool().GetMaxThreads());
+        cache.Store((uint32_t)mCloudSeed, baked);
+        texels = baked;
+    }
+
+    if (!mCloudNoiseTO)
+    {
+        // tiles across the layer, but not through it
+        glGenTextures(1, &mCloudNoiseTO);
+        glBindTexture(GL_TEXTURE_3D, mCloudNoiseTO);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+    }
+    glBindTexture(GL_TEXTURE_3D, mCloudNoiseTO);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R16, CLOUD_NOISE_SIZE, CLOUD_NOISE_LAYERS, CLOUD_NOISE_SIZE, 0, GL_RED, GL_UNSIGNED_SHORT, texels);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    // one mip level per level of bricks. They're read with texelFetch, so the filtering doesn't matter.
+    std::vector<CloudBrickLevel> brickLevels;
+    BuildCloudBricks(texels, &brickLevels, GetThreadPool().GetMaxThreads());
+
+    if (!mCloudBricksTO)
+    {
+        glGenTextures(1, &mCloudBricksTO);
+        glBindTexture(GL_TEXTURE_3D, mCloudBricksTO);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, CLOUD_BRICK_LEVELS - 1);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glBindTexture(GL_TEXTURE_3D, mCloudBricksTO);
+    for (int level = 0; level < CLOUD_BRICK_LEVELS; level++)
+    {
+        const CloudBrickLevel& bricks = brickLevels[level];
+        glTexImage3D(GL_TEXTURE_3D, level, GL_RG16, bricks.SizeX, bricks.SizeY, bricks.SizeZ, 0, GL_RG, GL_UNSIGNED_SHORT, bricks.MinMax.data());
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    mCloudNoiseSeed = mCloudSeed;
+
+    auto end = std::chrono::high_resolution_clock::now();
+    mCloudNoiseMs = std::chrono::duration<float, std::milli>(end - start).count();
+}
+
+void Renderer::BindCloudDensity(GLuint program)
+{
+    glProgramUniform1f(program, glGetUniformLocation(program, "CloudThickness"), mCloudThickness);
+    glProgramUniform1f(program, glGetUniformLocation(program, "CloudCoverage"), mCloudCoverage);
+    glProgramUniform1i(program, glGetUniformLocation(program, "CloudSkipEmpty"), mCloudSkipEmpty);
+    glProgramUniform1i(program, glGetUniformLocation(program, "CloudUseBricks"), mCloudUseBricks);
+    glProgramUniform1i(program, glGetUniformLocation(program, "CloudNoise"), CLOUD_NOISE_TEXTURE_BINDING);
+    glProgramUniform1i(program, glGetUniformLocation(program, "CloudBricks"), CLOUD_BRICK_TEXTURE_BINDING);
+
+    glActiveTexture(GL_TEXTURE0 + CLOUD_NOISE_TEXTURE_BINDING);
+    glBindTexture(GL_TEXTURE_3D, mCloudNoiseTO);
+    glActiveTexture(GL_TEXTURE0 + CLOUD_BRICK_TEXTURE_BINDING);
+    glBindTexture(GL_TEXTURE_3D, mCloudBricksTO);
+}
+
+bool Renderer::UpdateCloudShadows()
+{
+    // the light is below the clouds, so they're shadowed along its direction, as if it were the sun,
+    // rather than toward its position
+    glm::vec3 toLight = -normalize(mScene->MainLight.Direction);
+
+    // the map is projected onto the bottom of the layer along the direction, which doesn't reach it from below the horizon
+    if (!mCloudShadows || !*mCloudShadowSP || toLight.y < 0.01f)
+    {
+        return false;
+    }
+
+    UpdateCloudNoise();
+
+    bool upToDate = mCloudShadowDrawn &&
+        mCloudShadowProgram == *mCloudShadowSP &&
+        mCloudShadowToLight == toLight &&
+        mCloudShadowThickness == mCloudThickness &&
+        mCloudShadowCoverage == mCloudCoverage &&
+        mCloudShadowSeed == mCloudNoiseSeed;
+    if (upToDate)
+    {
+        return true;
+    }
+
+    if (!mCloudShadowTO)
+    {
+        // tiles across the layer, like the noise
+        glGenTextures(1, &mCloudShadowTO);
+        glBindTexture(GL_TEXTURE_2D, mCloudShadowTO);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, CLOUD_SHADOW_SIZE, CLOUD_SHADOW_SIZE, 0, GL_RED, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &mCloudShadowFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, mCloudShadowFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mCloudShadowTO, 0);
+        GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (fboStatus != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "glCheckFramebufferStatus: %x\n", fboStatus);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    BindCloudDensity(*mCloudShadowSP);
+    glProgramUniform3fv(*mCloudShadowSP, glGetUniformLocation(*mCloudShadowSP, "ToLight"), 1, value_ptr(toLight));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mCloudShadowFBO);
+    glViewport(0, 0, CLOUD_SHADOW_SIZE, CLOUD_SHADOW_SIZE);
+    glUseProgram(*mCloudShadowSP);
+    glBindVertexArray(mFullscreenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    mCloudShadowDrawn = true;
+    mCloudShadowProgram = *mCloudShadowSP;
+    mCloudShadowToLight = toLight;
+    mCloudShadowThickness = mCloudThickness;
+    mCloudShadowCoverage = mCloudCoverage;
+    mCloudShadowSeed = mCloudNoiseSeed;
+    mCloudShadowDraws++;
+    return true;
+}
+
+void Renderer::RenderClouds(const glm::mat4& worldProjection, const glm::vec3& eye)
+{
+    if (!*mCloudMarchSP || !*mCloudCompositeSP)
+    {
+        return;
+    }
+
+    if (mCloudTargetDownsample != mCloudDownsample)
+    {
+        ResizeCloudTarget();
+    }
+
+    UpdateCloudNoise();
+
+    // read a few frames late, like the terrain's queries
+    bool startCloudQuery = true;
+    if (mCloudQueryPending)
+    {
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(mCloudTimeQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 elapsedNs;
+            glGetQueryObjectui64v(mCloudTimeQuery, GL_QUERY_RESULT, &elapsedNs);
+            mCloudGpuMs = elapsedNs / 1000000.0f;
+            mCloudQueryPending = false;
+        }
+        startCloudQuery = !mCloudQueryPending;
+    }
+    if (startCloudQuery)
+    {
+        glBeginQuery(GL_TIME_ELAPSED, mCloudTimeQuery);
+    }
+
+    // both passes find the scene's points from the depth buffer
+    glm::mat4 worldFromClip = inverse(worldProjection);
+    for (GLuint program : { *mCloudMarchSP, *mCloudCompositeSP })
+    {
+        glProgramUniformMatrix4fv(program, glGetUniformLocation(program, "WorldFromClip"), 1, GL_FALSE, value_ptr(worldFromClip));
+        glProgramUniform3fv(program, glGetUniformLocation(program, "CameraPos"), 1, value_ptr(eye));
+        glProgramUniform1i(program, glGetUniformLocation(program, "Downsample"), mCloudTargetDownsample);
+        glProgramUniform1i(program, glGetUniformLocation(program, "SceneDepth"), CLOUD_SCENE_DEPTH_TEXTURE_BINDING);
+    }
+    BindCloudDensity(*mCloudMarchSP);
+    glProgramUniform4f(*mCloudCompositeSP, glGetUniformLocation(*mCloudCompositeSP, "CloudHue"), mCloudRed, mCloudGreen, mCloudBlue, 1.0f);
+    glProgramUniform1i(*mCloudCompositeSP, glGetUniformLocation(*mCloudCompositeSP, "CloudSamples"), CLOUD_SAMPLE_TEXTURE_BINDING);
+
+    glActiveTexture(GL_TEXTURE0 + CLOUD_SCENE_DEPTH_TEXTURE_BINDING);
+    glBindTexture(GL_TEXTURE_2D, mBackbufferDepthTO);
+    glActiveTexture(GL_TEXTURE0 + CLOUD_SAMPLE_TEXTURE_BINDING);
+    glBindTexture(GL_TEXTURE_2D, mCloudSampleTO);
+
+    glBindVertexArray(mFullscreenVAO);
+
+    // march the reduced resolution samples
+    glBindFramebuffer(GL_FRAMEBUFFER, mCloudSampleFBO);
+    glViewport(0, 0, mCloudTargetWidth, mCloudTargetHeight);
+    glUseProgram(*mCloudMarchSP);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // upsample them over the scene. Blended in linear space, like the scene's shading.
+    glBindFramebuffer(GL_FRAMEBUFFER, mCloudCompositeFBO);
+    glViewport(0, 0, mBackbufferWidth, mBackbufferHeight);
+    glEnable(GL_FRAMEBUFFER_SRGB);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(*mCloudCompositeSP);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDisable(GL_BLEND);
+    glDisable(GL_FRAMEBUFFER_SRGB);
+
+    glUseProgram(0);
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // the last step count read back is done, so average the new ones down to the last mip level and read that back
+    if (mCloudStepsFence)
+    {
+        GLenum status = glClientWaitSync(mCloudStepsFence, 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, mCloudStepsPBO);
+            float averageSteps;
+            glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(float), &averageSteps);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            mCloudStepsPerRay = averageSteps * mCloudStepsWidth * mCloudStepsHeight / (mCloudTargetWidth * mCloudTargetHeight);
+            glDeleteSync(mCloudStepsFence);
+            mCloudStepsFence = 0;
+        }
+    }
+    if (!mCloudStepsFence)
+    {
+        int lastLevel = 0;
+        while ((std::max(mCloudStepsWidth, mCloudStepsHeight) >> (lastLevel + 1)) > 0)
+        {
+            lastLevel++;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, mCloudStepsTO);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, mCloudStepsPBO);
+        glGetTexImage(GL_TEXTURE_2D, lastLevel, GL_RED, GL_FLOAT, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        mCloudStepsFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    if (startCloudQuery)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        mCloudQueryPending = true;
+    }
+}
+
+void Renderer::BindTerrainHeightmap(GLuint program, const Terrain& terrain)
+{
+    // the terrain mesh spans [-TERRAIN_WORLD_SIZE / 2, TERRAIN_WORLD_SIZE / 2] in model space
+    glm::vec2 terrainMin(-0.5f * TERRAIN_WORLD_SIZE);
+
+    glProgramUniform2fv(program, glGetUniformLocation(program, "TerrainMin"), 1, value_ptr(terrainMin));
+    glProgramUniform1f(program, glGetUniformLocation(program, "TerrainSize"), TERRAIN_WORLD_SIZE);
+    glProgramUniform2f(program, glGetUniformLocation(program, "HeightRange"), terrain.MinHeight, terrain.MaxHeight - terrain.MinHeight);
+
+    glActiveTexture(GL_TEXTURE0 + SCENE_HEIGHT_MAP_TEXTURE_BINDING);
+    glBindTexture(GL_TEXTURE_2D, terrain.HeightTO);
+    glActiveTexture(GL_TEXTURE0 + SCENE_NORMAL_MAP_TEXTURE_BINDING);
+    glBindTexture(GL_TEXTURE_2D, terrain.NormalTO);
+}
+
+void Renderer::RenderTerrainGrid(const Terrain& terrain, const glm::mat4& modelWorld, const glm::mat3& normal_ModelWorld, const glm::mat4& worldProjection)
+{
+    GLuint program = *mGridSP;
+    if (!program)
+    {
+        return;
+    }
+
+    glm::mat4 modelViewProjection = worldProjection * modelWorld;
+
+    glUseProgram(program);
+
+    glProgramUniformMatrix4fv(program, glGetUniformLocation(program, "ModelWorld"), 1, GL_FALSE, value_ptr(modelWorld));
+    glProgramUniformMatrix3fv(program, glGetUniformLocation(program, "Normal_ModelWorld"), 1, GL_FALSE, value_ptr(normal_ModelWorld));
+    glProgramUniformMatrix4fv(program, glGetUniformLocation(program, "ModelViewProjection"), 1, GL_FALSE, value_ptr(modelViewProjection));
+    BindTerrainHeightmap(program, terrain);
+
+    // the grid's shared vertex array, or the adaptive mesh's own, which only have their indices
+    glBindVertexArray(terrain.MeshVAO);
+    glDrawElements(GL_TRIANGLES, terrain.IndexCount, terrain.IndexType, 0);
+    glBindVertexArray(0);
+
+    mTerrainDrawCalls++;
+    mTerrainTrianglesDrawn += terrain.IndexCount / 3;
+
+    glUseProgram(*mSceneSP);
+}
+
+void Renderer::RenderTerrainCdlod(const Terrain& terrain, const glm::mat4& modelWorld, const glm::mat3& normal_ModelWorld, const glm::mat4& worldProjection)
+{
+    const Camera& mainCamera = mScene->MainCamera;
+
+    glm::mat4 modelViewProjection = worldProjection * modelWorld;
+    glm::vec3 localEye = glm::vec3(inverse(modelWorld) * glm::vec4(mainCamera.Eye, 1.0f));
+
+    // the terrain mesh spans [-TERRAIN_WORLD_SIZE / 2, TERRAIN_WORLD_SIZE / 2] in model space
+    glm::vec2 terrainMin(-0.5f * TERRAIN_WORLD_SIZE);
+
+    CdlodSettings settings;
+    settings.PixelError = mCdlodPixelError;
+    settings.ViewportHeight = (float)mBackbufferHeight;
+    settings.FovY = mainCamera.FovY;
+    settings.MorphRatio = mCdlodMorphRatio;
+
+    CdlodRanges ranges;
+    ComputeCdlodRanges(TERRAIN_WORLD_SIZE, GetCdlodNumLevels(terrain.gridSize), settings, &ranges);
+
+    mCdlodNodes.clear();
+    SelectCdlodNodes(ranges, terrainMin, TERRAIN_WORLD_SIZE, terrain.MinHeight, terrain.MaxHeight, localEye, modelViewProjection, &mCdlodNodes);
+
+    glUseProgram(*mCdlodSP);
+
+    glProgramUniformMatrix4fv(*mCdlodSP, glGetUniformLocation(*mCdlodSP, "ModelWorld"), 1, GL_FALSE, value_ptr(modelWorld));
+    glProgramUniformMatrix3fv(*mCdlodSP, glGetUniformLocation(*mCdlodSP, "Normal_ModelWorld"), 1, GL_FALSE, value_ptr(normal_ModelWorld));
+    glProgramUniformMatrix4fv(*mCdlodSP, glGetUniformLocation(*mCdlodSP, "ModelViewProjection"), 1, GL_FALSE, value_ptr(modelViewProjection));
+    glProgramUniform3fv(*mCdlodSP, glGetUniformLocation(*mCdlodSP, "LocalCameraPos"), 1, value_ptr(localEye));
+    BindTerrainHeightmap(*mCdlodSP, terrain);
+
+    GLint NODE_MIN_UNIFORM_LOCATION = glGetUniformLocation(*mCdlodSP, "NodeMin");
+    GLint NODE_SIZE_UNIFORM_LOCATION = glGetUniformLocation(*mCdlodSP, "NodeSize");
+    GLint MORPH_CONSTS_UNIFORM_LOCATION = glGetUniformLocation(*mCdlodSP, "MorphConsts");
+
+    glBindVertexArray(mCdlodPatchVAO);
+
+    const GLsizei quadrantIndexCount = CDLOD_PATCH_RESOLUTION * CDLOD_PATCH_RESOLUTION / 4 * 6;
+
+    for (const CdlodNode& node : mCdlodNodes)
+    {
+        glProgramUniform2fv(*mCdlodSP, NODE_MIN_UNIFORM_LOCATION, 1, value_ptr(node.Min));
+        glProgramUniform1f(*mCdlodSP, NODE_SIZE_UNIFORM_LOCATION, node.Size);
+        glProgramUniform2fv(*mCdlodSP, MORPH_CONSTS_UNIFORM_LOCATION, 1, value_ptr(ranges.MorphConsts[node.Level]));
+
+        if (node.Quadrant == -1)
+        {
+            glDrawElements(GL_TRIANGLES, quadrantIndexCount * 4, GL_UNSIGNED_SHORT, 0);
+            mTerrainTrianglesDrawn += quadrantIndexCount * 4 / 3;
+        }
+        else
+        {
+            glDrawElements(GL_TRIANGLES, quadrantIndexCount, GL_UNSIGNED_SHORT, (const GLvoid*)(node.Quadrant * quadrantIndexCount * sizeof(GLushort)));
+            mTerrainTrianglesDrawn += quadrantIndexCount / 3;
+        }
+        mTerrainDrawCalls++;
+    }
+
+    glBindVertexArray(0);
+
+    glUseProgram(*mSceneSP);
+}
+
+void Renderer::RenderTerrainTessellated(const Terrain& terrain, const glm::mat4& modelWorld, const glm::mat3& normal_ModelWorld, const glm::mat4& worldProjection)
+{
+    const Camera& mainCamera = mScene->MainCamera;
+
+    glm::mat4 modelViewProjection = worldProjection * modelWorld;
+    glm::vec3 localEye = glm::vec3(inverse(modelWorld) * glm::vec4(mainCamera.Eye, 1.0f));
+
+    // patches of ~16 heightfield texels, so the full resolution is reachable well below the GL minimum of 64 for GL_MAX_TESS_GEN_LEVEL
+    int patchesPerSide = std::max(terrain.gridSize / 16, 1);
+    float maxTessLevel = (float)terrain.gridSize / patchesPerSide;
+
+    float pixelsPerUnit = mBackbufferHeight / (2.0f * tan(mainCamera.FovY * 0.5f));
+
+    glUseProgram(*mTessSP);
+
+    glProgramUniformMatrix4fv(*mTessSP, glGetUniformLocation(*mTessSP, "ModelWorld"), 1, GL_FALSE, value_ptr(modelWorld));
+    glProgramUniformMatrix3fv(*mTessSP, glGetUniformLocation(*mTessSP, "Normal_ModelWorld"), 1, GL_FALSE, value_ptr(normal_ModelWorld));
+    glProgramUniformMatrix4fv(*mTessSP, glGetUniformLocation(*mTessSP, "ModelViewProjection"), 1, GL_FALSE, value_ptr(modelViewProjection));
+    glProgramUniform3fv(*mTessSP, glGetUniformLocation(*mTessSP, "LocalCameraPos"), 1, value_ptr(localEye));
+    glProgramUniform1i(*mTessSP, glGetUniformLocation(*mTessSP, "PatchesPerSide"), patchesPerSide);
+    glProgramUniform1f(*mTessSP, glGetUniformLocation(*mTessSP, "PixelsPerUnit"), pixelsPerUnit);
+    glProgramUniform1f(*mTessSP, glGetUniformLocation(*mTessSP, "TargetEdgePixels"), mTessTargetEdgePixels);
+    glProgramUniform1f(*mTessSP, glGetUniformLocation(*mTessSP, "MaxTessLevel"), maxTessLevel);
+    glProgramUniform1f(*mTessSP, glGetUniformLocation(*mTessSP, "MinHeight"), terrain.MinHeight);
+    glProgramUniform1f(*mTessSP, glGetUniformLocation(*mTessSP, "MaxHeight"), terrain.MaxHeight);
+    BindTerrainHeightmap(*mTessSP, terrain);
+
+    glBindVertexArray(mTessPatchVAO);
+    glPatchParameteri(GL_PATCH_VERTICES, 4);
+    glDrawArraysInstanced(GL_PATCHES, 0, 4, patchesPerSide * patchesPerSide);
+    glBindVertexArray(0);
+
+    mTerrainDrawCalls++;
+
+    glUseProgram(*mSceneSP);
+}
+
 void* Renderer::operator new(size_t sz)
 {
     // zero out the memory initially, for convenience.
@@ -1,9 +1,26 @@
 #pragma once
 
 #include "shaderset.h"
+#include "cdlod.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
 
 struct SDL_Window;
 class Scene;
+struct Terrain;
+
+enum class TerrainRenderMode
+{
+    // every terrain triangle (or those of its adaptive mesh, see rtin.h), every frame.
+    // The vertices are fetched from the heightfield textures by terrain_grid.vert.
+    FullGrid,
+    // quadtree LOD (see cdlod.h)
+    Cdlod,
+    // coarse patch grid, tessellated on the GPU by terrain_tess.tesc/.tese
+    Tessellation
+};
 
 class Renderer
 {
@@ -12,8 +29,16 @@ class Renderer
     // ShaderSet explanation:
     // https://nlguillemot.wordpress.com/2016/07/28/glsl-shader-live-reloading/
     ShaderSet mShaders;
+    // compute shaders need GLSL 4.30, so they're in their own set. Empty on GL 4.1 contexts.
+    ShaderSet mComputeShaders;
 
     GLuint* mSceneSP;
+    GLuint* mGridSP;
+    GLuint* mCdlodSP;
+    GLuint* mTessSP;
+    GLuint* mCloudMarchSP;
+    GLuint* mCloudCompositeSP;
+    GLuint* mCloudShadowSP;
 
     int mBackbufferWidth;
     int mBackbufferHeight;
@@ -38,12 +63,115 @@ class Renderer
     float mCloudGreen = 0.75;
     float mCloudBlue = 0.75;
 	float mCloudThickness = 0.5;
+    // how much of the noise is cloud (see clouds.glsl)
+    float mCloudCoverage = 1.0f;
+
+    // volumetric clouds, marched at 1/mCloudDownsample of the backbuffer's resolution by cloud_march.frag,
+    // then upsampled and blended over it by cloud_composite.frag
+    int mCloudDownsample = 2;
+    // the size the target was made with. It's remade when mCloudDownsample changes.
+    int mCloudTargetDownsample;
+    int mCloudTargetWidth;
+    int mCloudTargetHeight;
+    GLuint mCloudSampleTO;
+    // steps each ray took, averaged by the texture's mipmaps. The average is read back through mCloudStepsPBO
+    // a few frames late, once mCloudStepsFence is done.
+    // The texture is rounded up to a power of two in each direction, so the mipmaps average it exactly.
+    GLuint mCloudStepsTO;
+    int mCloudStepsWidth;
+    int mCloudStepsHeight;
+    GLuint mCloudSampleFBO;
+    GLuint mCloudStepsPBO;
+    GLsync mCloudStepsFence;
+    float mCloudStepsPerRay;
+    // while on, the march skips the empty space around the clouds (see cast_ray)
+    bool mCloudSkipEmpty = true;
+    // and jumps over the bricks of the noise with no cloud in them
+    bool mCloudUseBricks = true;
+    // the backbuffer's color without its depth, which the composite reads
+    GLuint mCloudCompositeFBO;
+    // the fullscreen triangle has no vertex attributes
+    GLuint mFullscreenVAO;
+    GLuint mCloudTimeQuery;
+    bool mCloudQueryPending;
+    float mCloudGpuMs;
+
+    // the clouds' density noise, baked into a 3D texture (see cloud_noise.h). It's baked again, or loaded from the cache,
+    // when mCloudSeed changes.
+    int mCloudSeed = 0;
+    int mCloudNoiseSeed;
+    GLuint mCloudNoiseTO;
+    // the min and max of the noise in bricks, for skipping empty space. Built with the noise.
+    GLuint mCloudBricksTO;
+    bool mCloudNoiseCached;
+    float mCloudNoiseMs;
+
+    // the clouds' shadows on the scene, from the main light (see cloud_shadow.frag). The map is only drawn again when the
+    // light's direction, the program, or anything the clouds' density depends on changes.
+    bool mCloudShadows = true;
+    GLuint mCloudShadowTO;
+    GLuint mCloudShadowFBO;
+    // what the map was last drawn with. scene.frag projects onto it along mCloudShadowToLight.
+    bool mCloudShadowDrawn;
+    GLuint mCloudShadowProgram;
+    glm::vec3 mCloudShadowToLight;
+    float mCloudShadowThickness;
+    float mCloudShadowCoverage;
+    int mCloudShadowSeed;
+    int mCloudShadowDraws;
+
+    // terrain rendering
+    TerrainRenderMode mTerrainRenderMode = TerrainRenderMode::Cdlod;
+    float mCdlodPixelError = 2.0f;
+    float mCdlodMorphRatio = 0.3f;
+    float mTessTargetEdgePixels = 8.0f;
+    int mTerrainDrawCalls;
+    size_t mTerrainTrianglesDrawn;
+
+    // GPU side counts of the terrain passes. Results are read a few frames late, once they're available, to avoid stalling.
+    GLuint mTerrainPrimitivesQuery;
+    GLuint mTerrainTimeQuery;
+    bool mTerrainQueriesPending;
+    GLuint64 mTerrainPrimitivesGenerated;
+    float mTerrainGpuMs;
+    // vertex shader invocations, only counted when the driver has GL_ARB_pipeline_statistics_query (0 otherwise)
+    GLuint mTerrainVertexInvocationsQuery;
+    GLuint64 mTerrainVertexInvocations;
+
+    // the patch mesh drawn for every CDLOD node. Its indices are sorted by quadrant, so a quarter of the patch can be drawn on its own.
+    GLuint mCdlodPatchVAO;
+    GLuint mCdlodPatchPositionBO;
+    GLuint mCdlodPatchIndexBO;
+    std::vector<CdlodNode> mCdlodNodes;
+
+    // the tessellated patches have no vertex attributes, but GL core still needs a VAO to draw
+    GLuint mTessPatchVAO;
+
+    // terrain generation thread scaling measurements
+    std::vector<float> mGenerationScalingMs;
+    bool mGenerationScalingDeterministic;
 
     // shadowmap debugging
     GLuint* mDepthVisSP;
     GLuint mNullVAO;
     bool mShowDepthVis = true;
 
+    // sets the uniforms and binds the textures terrain_heightmap.glsl reads
+    void BindTerrainHeightmap(GLuint program, const Terrain& terrain);
+    void RenderTerrainGrid(const Terrain& terrain, const glm::mat4& modelWorld, const glm::mat3& normal_ModelWorld, const glm::mat4& worldProjection);
+    void RenderTerrainCdlod(const Terrain& terrain, const glm::mat4& modelWorld, const glm::mat3& normal_ModelWorld, const glm::mat4& worldProjection);
+    void RenderTerrainTessellated(const Terrain& terrain, const glm::mat4& modelWorld, const glm::mat3& normal_ModelWorld, const glm::mat4& worldProjection);
+    // (re)makes the target the clouds are marched into, for the backbuffer's size and mCloudDownsample
+    void ResizeCloudTarget();
+    // makes the cloud noise texture for mCloudSeed, unless it's made already
+    void UpdateCloudNoise();
+    // sets the uniforms and binds the textures the density in clouds.glsl reads
+    void BindCloudDensity(GLuint program);
+    // draws the clouds' shadow map again if what it was drawn with changed. Returns false if the scene shouldn't use it.
+    bool UpdateCloudShadows();
+    // marches the clouds against the backbuffer's depth and blends them over its color
+    void RenderClouds(const glm::mat4& worldProjection, const glm::vec3& eye);
+
 public:
     void Init(Scene* scene);
     void Resize(int width, int height);
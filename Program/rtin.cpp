@@ -0,0 +1,234 @@
+#include "rtin.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdlib>
+
+namespace
+{
+    // where a triangle of the tile is, relative to the grid in its corner
+    enum class TrianglePlacement
+    {
+        Inside,
+        Outside,
+        // partly inside and partly outside, so it has to be split
+        Crossing,
+    };
+
+    TrianglePlacement GetPlacement(int gridSize, int ax, int ay, int bx, int by, int cx, int cy)
+    {
+        int maxX = std::max(ax, std::max(bx, cx));
+        int maxY = std::max(ay, std::max(by, cy));
+        if (maxX <= gridSize && maxY <= gridSize)
+        {
+            return TrianglePlacement::Inside;
+        }
+
+        int minX = std::min(ax, std::min(bx, cx));
+        int minY = std::min(ay, std::min(by, cy));
+        if (minX >= gridSize || minY >= gridSize)
+        {
+            return TrianglePlacement::Outside;
+        }
+        return TrianglePlacement::Crossing;
+    }
+
+    int GetTileSize(int gridSize)
+    {
+        int tileSize = 1;
+        while (tileSize < gridSize)
+        {
+            tileSize *= 2;
+        }
+        return tileSize;
+    }
+
+    struct ErrorContext
+    {
+        int GridSize;
+        int TileSize;
+        const uint16_t* Heights;
+        float HeightScale;
+        float* Errors;
+    };
+
+    // a is (ax, ay) and so on, with x the column j and y the row i. ab is the hypotenuse, and c the right angle.
+    // adds the triangle's error to its hypotenuse's midpoint, along with the errors of its children's midpoints (those of ac and bc).
+    void AddTriangle(const ErrorContext& context, int ax, int ay, int bx, int by, int cx, int cy, bool hasChildren)
+    {
+        TrianglePlacement placement = GetPlacement(context.GridSize, ax, ay, bx, by, cx, cy);
+        if (placement == TrianglePlacement::Outside)
+        {
+            return;
+        }
+
+        size_t tileVertices = (size_t)context.TileSize + 1;
+        int mx = (ax + bx) >> 1;
+        int my = (ay + by) >> 1;
+        float& middleError = context.Errors[my * tileVertices + mx];
+
+        if (placement == TrianglePlacement::Crossing)
+        {
+            middleError = FLT_MAX;
+            return;
+        }
+
+        size_t rowVertices = (size_t)context.GridSize + 1;
+        const uint16_t* heights = context.Heights;
+        float interpolated = 0.5f * ((float)heights[ay * rowVertices + ax] + (float)heights[by * rowVertices + bx]);
+        float error = std::abs(interpolated - (float)heights[my * rowVertices + mx]) * context.HeightScale;
+        middleError = std::max(middleError, error);
+
+        if (hasChildren)
+        {
+            float leftError = context.Errors[((ay + cy) >> 1) * tileVertices + ((ax + cx) >> 1)];
+            float rightError = context.Errors[((by + cy) >> 1) * tileVertices + ((bx + cx) >> 1)];
+            middleError = std::max(middleError, std::max(leftError, rightError));
+        }
+    }
+
+    struct MeshContext
+    {
+        int GridSize;
+        int TileSize;
+        const float* Errors;
+        float MaxError;
+        std::vector<uint32_t>* Indices;
+    };
+
+    // a is (ax, ay) and so on, with x the column j and y the row i. ab is the hypotenuse.
+    void MeshTriangle(const MeshContext& context, int ax, int ay, int bx, int by, int cx, int cy)
+    {
+        if (GetPlacement(context.GridSize, ax, ay, bx, by, cx, cy) == TrianglePlacement::Outside)
+        {
+            return;
+        }
+
+        int mx = (ax + bx) >> 1;
+        int my = (ay + by) >> 1;
+        bool canSplit = abs(ax - cx) + abs(ay - cy) > 1;
+        if (canSplit && context.Errors[my * (context.TileSize + 1) + mx] > context.MaxError)
+        {
+            MeshTriangle(context, cx, cy, ax, ay, mx, my);
+            MeshTriangle(context, bx, by, cx, cy, mx, my);
+            return;
+        }
+
+        // the full grid's triangles turn clockwise in (x, y)
+        if ((bx - ax) * (cy - ay) - (by - ay) * (cx - ax) > 0)
+        {
+            std::swap(bx, cx);
+            std::swap(by, cy);
+        }
+
+        uint32_t rowVertices = (uint32_t)context.GridSize + 1;
+        context.Indices->push_back(ay * rowVertices + ax);
+        context.Indices->push_back(by * rowVertices + bx);
+        context.Indices->push_back(cy * rowVertices + cx);
+    }
+}
+
+void ComputeRtinErrors(int gridSize, const uint16_t* heights, float heightScale, std::vector<float>* errors)
+{
+    ErrorContext context;
+    context.GridSize = gridSize;
+    context.TileSize = GetTileSize(gridSize);
+    context.Heights = heights;
+    context.HeightScale = heightScale;
+
+    size_t tileVertices = (size_t)context.TileSize + 1;
+    errors->assign(tileVertices * tileVertices, 0.0f);
+    context.Errors = errors->data();
+
+    // the triangles are visited a level at a time, from the smallest up, so a triangle's children are always done before it.
+    // Within a level they're visited in rows rather than down the tree, which keeps the heights and errors in the cache.
+    // Levels alternate between triangles with their hypotenuse along a square's edge, and triangles that are half a square.
+    // Past the grid (plus half a square), triangles are outside of it.
+    int tileSize = context.TileSize;
+    for (int squareSize = 2; squareSize <= tileSize; squareSize *= 2)
+    {
+        int half = squareSize / 2;
+        int end = std::min(tileSize, gridSize + half - 1);
+        bool hasChildren = squareSize > 2;
+
+        // the triangles on either side of each edge of the squares, with their right angle at the squares' centers
+        for (int y = 0; y <= end; y += half)
+        {
+            bool horizontalEdges = y % squareSize == 0;
+            for (int x = horizontalEdges ? half : 0; x <= end; x += squareSize)
+            {
+                if (horizontalEdges)
+                {
+                    if (y > 0)
+                    {
+                        AddTriangle(context, x - half, y, x + half, y, x, y - half, hasChildren);
+                    }
+                    if (y < tileSize)
+                    {
+                        AddTriangle(context, x + half, y, x - half, y, x, y + half, hasChildren);
+                    }
+                }
+                else
+                {
+                    if (x > 0)
+                    {
+                        AddTriangle(context, x, y + half, x, y - half, x - half, y, hasChildren);
+                    }
+                    if (x < tileSize)
+                    {
+                        AddTriangle(context, x, y - half, x, y + half, x + half, y, hasChildren);
+                    }
+                }
+            }
+        }
+
+        // the two halves of each square. The diagonals alternate, like a checkerboard.
+        for (int y = 0; y + half <= end; y += squareSize)
+        {
+            for (int x = 0; x + half <= end; x += squareSize)
+            {
+                if ((x / squareSize + y / squareSize) % 2 == 0)
+                {
+                    AddTriangle(context, x, y, x + squareSize, y + squareSize, x + squareSize, y, true);
+                    AddTriangle(context, x + squareSize, y + squareSize, x, y, x, y + squareSize, true);
+                }
+                else
+                {
+                    AddTriangle(context, x + squareSize, y, x, y + squareSize, x + squareSize, y + squareSize, true);
+                    AddTriangle(context, x, y + squareSize, x + squareSize, y, x, y, true);
+                }
+            }
+        }
+    }
+}
+
+void BuildRtinIndices(int gridSize, const std::vector<float>& errors, float maxError, std::vector<uint32_t>* indices)
+{
+    MeshContext context;
+    context.GridSize = gridSize;
+    context.TileSize = GetTileSize(gridSize);
+    context.Errors = errors.data();
+    context.MaxError = maxError;
+    context.Indices = indices;
+
+    indices->clear();
+
+    int tileSize = context.TileSize;
+    MeshTriangle(context, 0, 0, tileSize, tileSize, tileSize, 0);
+    MeshTriangle(context, tileSize, tileSize, 0, 0, 0, tileSize);
+}
+
+size_t CountRtinVertices(int gridSize, const std::vector<uint32_t>& indices)
+{
+    std::vector<bool> used((size_t)(gridSize + 1) * (gridSize + 1), false);
+    size_t count = 0;
+    for (uint32_t index : indices)
+    {
+        if (!used[index])
+        {
+            used[index] = true;
+            count++;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Adaptive triangulation of a terrain heightfield as a right-triangulated irregular network ("RTIN", W. Evans et al. 2001),
+// meshed the way MARTINI does it (V. Agafonkin 2019).
+//
+// A square of 2^k grid squares per side is split along its diagonal into two right triangles, and every triangle is split
+// recursively at the midpoint of its hypotenuse, down to the grid's own triangles. Each split adds one vertex, whose error is
+// how far the heightfield is from the unsplit triangle there. Errors are propagated up so a vertex's error covers all the vertices
+// under it, and then a triangle is only split if its hypotenuse's midpoint is off by more than the allowed error. Neighbours
+// share that midpoint, so they always split together, and the mesh has no cracks.
+//
+// Grids that aren't a power of two are meshed as part of the next power of two up: triangles that cross the grid's edge
+// are always split, and the ones past it are dropped, so the grid's edge is only as coarse as its largest power of two factor.
+//
+// The indices are the full grid's vertices (i * (gridSize+1) + j), the same as GenerateGridIndices, so an adaptive mesh is drawn
+// over the same heightfield textures as the full grid and only the vertices it uses are transformed.
+// Triangles are wound like the full grid's, and come out in the order of the recursion, which keeps neighbours close together.
+
+// the vertex errors of a heightfield, in units of heightScale. heights has the (gridSize+1)^2 grid vertices, and the height of
+// vertex i * (gridSize+1) + j is heights[i * (gridSize+1) + j] * heightScale.
+// errors gets (tileSize+1)^2 entries, where tileSize is the power of two the grid is meshed in.
+void ComputeRtinErrors(int gridSize, const uint16_t* heights, float heightScale, std::vector<float>* errors);
+
+// replaces indices with the coarsest mesh that has every vertex with an error over maxError, from ComputeRtinErrors.
+// the error is measured against the edge a vertex splits, not the final triangles, so the mesh is within about maxError of the
+// heightfield rather than strictly (up to about 1.5 times it on rough terrain).
+void BuildRtinIndices(int gridSize, const std::vector<float>& errors, float maxError, std::vector<uint32_t>* indices);
+
+// number of distinct vertices the indices use, out of the grid's (gridSize+1)^2
+size_t CountRtinVertices(int gridSize, const std::vector<uint32_t>& indices);
@@ -1,12 +1,20 @@
 #include "scene.h"
 
 #include "preamble.glsl"
+#include "arena.h"
+#include "noise.h"
+#include "rtin.h"
+#include "spectral.h"
+#include "threadpool.h"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
 #include <map>
 
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <stack>
 
@@ -16,9 +24,10 @@
 
 #include <stdlib.h>   // for random
 
-#define GRIDSIZE    120
 #define TERRAINSIZE 128
 
+static_assert(0.125 * TERRAINSIZE == TERRAIN_WORLD_SIZE, "terrain mesh extent must match TERRAIN_WORLD_SIZE");
+
 void Scene::Init()
 {
     // Need to specify size up front. These numbers are pretty arbitrary.
@@ -28,8 +37,12 @@ void Scene::Init()
     Transforms = packed_freelist<Transform>(4096);
     Instances = packed_freelist<Instance>(4096);
 
-    Terrains = packed_freelist<Terrain>(64);
+    // large enough for the streamed terrain chunks plus the water plane
+    Terrains = packed_freelist<Terrain>(1024);
     Particles = packed_freelist<ParticleSet>(4096);
+
+    TerrainGenMaxThreads = GetThreadPool().GetMaxThreads();
+    TerrainChunks.GridSize = TERRAIN_DEFAULT_GRID_SIZE;
 }
 
 void LoadMeshesFromFile(
@@ -320,464 +333,651 @@ void LoadTexFromFile(Scene* scene, const std::string& filename)
 	}
 }
 
-// perlin noise-related functions
-// taken from https://connex.csc.uvic.ca/access/content/group/feae68d4-a86f-4c6a-af57-9a21e665f7d0/Reading%20Material/Noise/Understanding%20Perlin%20Noise.pdf
-
-int p[] = {
-    151,160,137,91,90,15,
-    131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,
-    190, 6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,
-    88,237,149,56,87,174,20,125,136,171,168, 68,175,74,165,71,134,139,48,27,166,
-    77,146,158,231,83,111,229,122,60,211,133,230,220,105,92,41,55,46,245,40,244,
-    102,143,54, 65,25,63,161, 1,216,80,73,209,76,132,187,208, 89,18,169,200,196,
-    135,130,116,188,159,86,164,100,109,198,173,186, 3,64,52,217,226,250,124,123,
-    5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,189,28,42,
-    223,183,170,213,119,248,152, 2,44,154,163, 70,221,153,101,155,167, 43,172,9,
-    129,22,39,253, 19,98,108,110,79,113,224,232,178,185, 112,104,218,246,97,228,
-    251,34,242,193,238,210,144,12,191,179,162,241, 81,51,145,235,249,14,239,107,
-    49,192,214, 31,181,199,106,157,184, 84,204,176,115,121,50,45,127, 4,150,254,
-    138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180,
-    151,160,137,91,90,15,   // after this point, the permutation repeats
-    131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,
-    190, 6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,
-    88,237,149,56,87,174,20,125,136,171,168, 68,175,74,165,71,134,139,48,27,166,
-    77,146,158,231,83,111,229,122,60,211,133,230,220,105,92,41,55,46,245,40,244,
-    102,143,54, 65,25,63,161, 1,216,80,73,209,76,132,187,208, 89,18,169,200,196,
-    135,130,116,188,159,86,164,100,109,198,173,186, 3,64,52,217,226,250,124,123,
-    5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,189,28,42,
-    223,183,170,213,119,248,152, 2,44,154,163, 70,221,153,101,155,167, 43,172,9,
-    129,22,39,253, 19,98,108,110,79,113,224,232,178,185, 112,104,218,246,97,228,
-    251,34,242,193,238,210,144,12,191,179,162,241, 81,51,145,235,249,14,239,107,
-    49,192,214, 31,181,199,106,157,184, 84,204,176,115,121,50,45,127, 4,150,254,
-    138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180
-};
-
-int ps[512];   // shuffled table
-
-double fade(double t) {
-    return t * t * t * (t * (t * 6 - 15) + 10);
-}
+void AddMeshInstance(
+    Scene* scene,
+    uint32_t meshID,
+    uint32_t* newInstanceID)
+{
+    Transform newTransform;
+    newTransform.Scale = glm::vec3(1.0f);
 
-double lerp(double a, double b, double x) {
-    return a + x * (b - a);
-}
+    uint32_t newTransformID = scene->Transforms.insert(newTransform);
 
-// 2d select gradient
-double grad(int hash, double x, double y){
-    switch(hash & 0x3)
+    Instance newInstance;
+    newInstance.MeshID = meshID;
+    newInstance.TransformID = newTransformID;
+
+    uint32_t tmpNewInstanceID = scene->Instances.insert(newInstance);
+    if (newInstanceID)
     {
-    case 0x0: return x + y;
-    case 0x1: return -x + y;
-    case 0x2: return x - y;
-    case 0x3: return -x - y;
-    default: return 0; // never happens
+        *newInstanceID = tmpNewInstanceID;
     }
 }
 
-// 3d select gradient
-double grad(int hash, double x, double y, double z){
-    switch(hash & 0xF)
-    {
-    case 0x0: return x + y;
-    case 0x1: return -x + y;
-    case 0x2: return x - y;
-    case 0x3: return -x - y;
-    case 0x4: return x + z;
-    case 0x5: return -x + z;
-    case 0x6: return x - z;
-    case 0x7: return -x - z;
-    case 0x8: return y + z;
-    case 0x9: return -y + z;
-    case 0xA: return y - z;
-    case 0xB: return -y - z;
-    case 0xC: return y + x;
-    case 0xD: return -y + z;
-    case 0xE: return y - x;
-    case 0xF: return -y - z;
-    default: return 0; // never happens
+void WriteTerrainRow(int gridSize, int i, float heightScale, float heightOffset, const float* value, const float* value_dx, const float* value_dy, GLfloat (*rowVertices)[3], GLfloat (*rowNormals)[3], float* rowHeights) {
+    // noise space is one unit per chunk, so d(noise space)/d(model space) = 1 / TERRAIN_WORLD_SIZE
+    // (a power of two, so this is exact when heightScale is 1)
+    float slopeScale = heightScale / TERRAIN_WORLD_SIZE;
+
+    // the vertices may be a mapped buffer, which mustn't be read
+    if (rowVertices) {
+        for(int j = 0; j < (gridSize+1); j++) {
+            rowVertices[j][0] = 0.125 * (i - gridSize * 0.5f) * TERRAINSIZE / gridSize;
+            rowVertices[j][1] = value[j] * heightScale + heightOffset;
+            rowVertices[j][2] = 0.125 * (j - gridSize * 0.5f) * TERRAINSIZE / gridSize;
+        }
+    }
+
+    for(int j = 0; j < (gridSize+1); j++) {
+        float vertexHeight = value[j] * heightScale + heightOffset;
+        if (rowHeights) {
+            rowHeights[j] = vertexHeight;
+        }
+
+        // the normal of the surface y = h(x, z) is (-dh/dx, 1, -dh/dz)
+        glm::vec3 normal = normalize(glm::vec3(-value_dx[j] * slopeScale, 1.0f, -value_dy[j] * slopeScale));
+        rowNormals[j][0] = normal.x;
+        rowNormals[j][1] = normal.y;
+        rowNormals[j][2] = normal.z;
     }
 }
 
-// 2d perlin noise
-double perlin(double x, double y) {
-    int xi = (int)x & 255;
-    int yi = (int)y & 255;
-
-    double xf = x - (int)x;
-    double yf = y - (int)y;
-
-    double u = fade(xf);
-    double v = fade(yf);
-
-    /*int aa, ab, ba, bb;
-    aa = p[p[xi] + yi];
-    ab = p[p[xi] + yi+1];
-    ba = p[p[xi+1] + yi];
-    bb = p[p[xi+1] + yi+1];*/
-
-    int aa, ab, ba, bb;
-    aa = ps[ps[xi] + yi];
-    ab = ps[ps[xi] + yi+1];
-    ba = ps[ps[xi+1] + yi];
-    bb = ps[ps[xi+1] + yi+1];
-
-    double x1, x2;
-    x1 = lerp( grad (aa, xf , yf),
-               grad (ba, xf-1, yf),
-               u);
-    x2 = lerp( grad (ab, xf , yf-1),
-               grad (bb, xf-1, yf-1),
-               u);
-    return(lerp(x1, x2, v)+1)/2;
+// height added to each fractal, so its typical range sits around the water (at TERRAIN_WATER_HEIGHT)
+static float GetTerrainBaseHeight(FractalType fractal) {
+    switch (fractal) {
+    case FractalType::FBm:
+        return 3.5f;
+    case FractalType::HybridMultifractal:
+    case FractalType::RidgedMultifractal:
+    case FractalType::Spectral:
+    default:
+        return 0.75f;
+    }
 }
 
-// 3d perlin noise
-double perlin(double x, double y, double z) {
-    int xi = (int)x & 255;
-    int yi = (int)y & 255;
-    int zi = (int)z & 255;
-
-    double xf = x - (int)x;
-    double yf = y - (int)y;
-    double zf = z - (int)z;
-
-    double u = fade(xf);
-    double v = fade(yf);
-    double w = fade(zf);
-
-    /*int aa, ab, ba, bb;
-    aa = p[p[xi] + yi];
-    ab = p[p[xi] + yi+1];
-    ba = p[p[xi+1] + yi];
-    bb = p[p[xi+1] + yi+1];*/
-
-    int aaa, aba, aab, abb, baa, bba, bab, bbb;
-    aaa = ps[ps[ps[ xi ]+ yi ]+ zi ];
-    aba = ps[ps[ps[ xi ]+yi+1]+ zi ];
-    aab = ps[ps[ps[ xi ]+ yi ]+zi+1];
-    abb = ps[ps[ps[ xi ]+yi+1]+zi+1];
-    baa = ps[ps[ps[xi+1]+ yi ]+ zi ];
-    bba = ps[ps[ps[xi+1]+yi+1]+ zi ];
-    bab = ps[ps[ps[xi+1]+ yi ]+zi+1];
-    bbb = ps[ps[ps[xi+1]+yi+1]+zi+1];
-
-    double x1, x2, y1, y2;
-    x1 = lerp( grad (aaa, xf , yf , zf),
-               grad (baa, xf-1, yf , zf),
-               u);
-    x2 = lerp( grad (aba, xf , yf-1, zf),
-               grad (bba, xf-1, yf-1, zf),
-               u);
-    y1 = lerp(x1, x2, v);
-    x1 = lerp( grad (aab, xf , yf , zf-1),
-               grad (bab, xf-1, yf , zf-1),
-               u);
-    x2 = lerp( grad (abb, xf , yf-1, zf-1),
-               grad (bbb, xf-1, yf-1, zf-1),
-               u);
-    y2 = lerp (x1, x2, v);
-
-    return (lerp (y1, y2, w)+1)/2;
+float GetTerrainHeightOffset(const TerrainFractalSettings& settings) {
+    // (value + baseHeight - water) * scale + water. In double, so a scale of 1 leaves exactly the base height.
+    double baseHeight = GetTerrainBaseHeight(settings.Fractal);
+    return (float)((baseHeight - TERRAIN_WATER_HEIGHT) * settings.HeightScale + TERRAIN_WATER_HEIGHT);
 }
 
-// perlin function produces values generally between 0.25 and 0.75, so this function creates values between 0 and 1
-// note: there may be some clustering at 0 and 1
-double perlin_clamped(double x, double y) {
-    double value = perlin(x, y);
-    value -= 0.25;
-    value *= 2.0;
-    return fmax(0, fmin(1, value));
+// fills row i of a terrain chunk's vertices and normals
+static void GenerateTerrainRow(const PermutationTable& perm, FractalFunction fractal, const SpectralTable& spectrum, float heightScale, float heightOffset, int chunkX, int chunkZ, int gridSize, int i, GLfloat (*terrainMeshVerticies)[3], GLfloat (*terrainMeshNormals)[3], float* heights) {
+    // the fractal runs over the whole row at a time, so the batched noise kernel can evaluate it several samples per instruction
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+    float* value = scratch.Allocate<float>(gridSize+1);
+    float* value_dx = scratch.Allocate<float>(gridSize+1);
+    float* value_dy = scratch.Allocate<float>(gridSize+1);
+
+    // each chunk covers one unit of noise space, so neighbouring chunks share their edge samples.
+    // the row is a column of the noise grid: x is fixed and y runs along it.
+    NoiseGrid row;
+    row.OriginX = chunkX * gridSize + i;
+    row.OriginY = chunkZ * gridSize;
+    row.SizeX = 1;
+    row.SizeY = gridSize+1;
+    row.SamplesPerUnit = (float)gridSize;
+
+    fractal(perm, row, spectrum, value, value_dx, value_dy);
+
+    size_t rowStart = (size_t)i * (gridSize+1);
+    WriteTerrainRow(gridSize, i, heightScale, heightOffset, value, value_dx, value_dy, terrainMeshVerticies ? terrainMeshVerticies + rowStart : nullptr, terrainMeshNormals + rowStart, heights ? heights + rowStart : nullptr);
 }
 
-// this function is used to ensure that shuffle uses rand(), so it can be seeded
-unsigned int random_for_p(int n) {
-    return rand() % n;
+// the spectral heightfield is scaled to the hybrid multifractal's typical mean and spread (measured over a few seeds),
+// so with the same base height it sits around the water like the hybrid does and GenerateHeightColors' bands still fit
+#define SPECTRAL_TERRAIN_MEAN 3.05f
+#define SPECTRAL_TERRAIN_SPREAD 1.0f
+
+// the hybrid multifractal damps its high octaves in the valleys, so plain fBm with the terrain's H comes out far rougher.
+// The spectral terrain defaults to a higher H, which gives it about the hybrid's slopes (rms gradient ~15 against ~16).
+#define SPECTRAL_TERRAIN_H 1.0f
+
+float GetDefaultTerrainH(FractalType fractal) {
+    return fractal == FractalType::Spectral ? SPECTRAL_TERRAIN_H : (float)TerrainSpectrum::H;
 }
 
-void AddMeshInstance(
-    Scene* scene,
-    uint32_t meshID,
-    uint32_t* newInstanceID)
-{
-    Transform newTransform;
-    newTransform.Scale = glm::vec3(1.0f);
+// fills a terrain chunk with spectral synthesis. The heightfield tiles every chunk, so the chunk coordinates don't matter.
+static void GenerateSpectralTerrainHeights(const PermutationTable& perm, const TerrainFractalSettings& settings, int gridSize, GLfloat (*terrainMeshVerticies)[3], GLfloat (*terrainMeshNormals)[3], float* heights, int maxThreads) {
+    size_t numVertices = (size_t)(gridSize+1) * (gridSize+1);
+    float heightOffset = GetTerrainHeightOffset(settings);
+    int octaves = std::max(FRACTAL_MIN_OCTAVES, std::min(settings.Octaves, FRACTAL_MAX_OCTAVES));
+
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+    float* value = scratch.Allocate<float>(numVertices);
+    float* value_dx = scratch.Allocate<float>(numVertices);
+    float* value_dy = scratch.Allocate<float>(numVertices);
+
+    GenerateSpectralHeightfield(perm.GetSeed(), settings.H, settings.Lacunarity, octaves, gridSize, value, value_dx, value_dy, maxThreads);
+
+    GetThreadPool().ParallelFor(gridSize + 1, maxThreads, [&](int i) {
+        size_t rowStart = (size_t)i * (gridSize+1);
+        for (int j = 0; j < gridSize + 1; j++) {
+            value[rowStart + j] = value[rowStart + j] * SPECTRAL_TERRAIN_SPREAD + SPECTRAL_TERRAIN_MEAN;
+            value_dx[rowStart + j] *= SPECTRAL_TERRAIN_SPREAD;
+            value_dy[rowStart + j] *= SPECTRAL_TERRAIN_SPREAD;
+        }
+        WriteTerrainRow(gridSize, i, settings.HeightScale, heightOffset, value + rowStart, value_dx + rowStart, value_dy + rowStart, terrainMeshVerticies ? terrainMeshVerticies + rowStart : nullptr, terrainMeshNormals + rowStart, heights ? heights + rowStart : nullptr);
+    });
+}
 
-    uint32_t newTransformID = scene->Transforms.insert(newTransform);
+static_assert(FRACTAL_MAX_OCTAVES <= TERRAIN_GEN_MAX_OCTAVES, "too many octaves for terrain_heights.comp");
 
-    Instance newInstance;
-    newInstance.MeshID = meshID;
-    newInstance.TransformID = newTransformID;
+void GenerateTerrainHeights(const PermutationTable& perm, const TerrainFractalSettings& settings, int chunkX, int chunkZ, int gridSize, GLfloat (*terrainMeshVerticies)[3], GLfloat (*terrainMeshNormals)[3], float* heights, int maxThreads) {
+    if (settings.Fractal == FractalType::Spectral) {
+        GenerateSpectralTerrainHeights(perm, settings, gridSize, terrainMeshVerticies, terrainMeshNormals, heights, maxThreads);
+        return;
+    }
 
-    uint32_t tmpNewInstanceID = scene->Instances.insert(newInstance);
-    if (newInstanceID)
+    FractalFunction fractal = GetFractalFunction(settings.Fractal, settings.Octaves);
+    SpectralTable spectrum = MakeSpectralTable(settings.H, settings.Lacunarity);
+    float heightOffset = GetTerrainHeightOffset(settings);
+
+    // one job per row. Rows don't share any state, so the heights are bit-identical for any number of threads.
+    GetThreadPool().ParallelFor(gridSize + 1, maxThreads, [&](int i) {
+        GenerateTerrainRow(perm, fractal, spectrum, settings.HeightScale, heightOffset, chunkX, chunkZ, gridSize, i, terrainMeshVerticies, terrainMeshNormals, heights);
+    });
+}
+
+bool MeasureTerrainGenerationScaling(const PermutationTable& perm, const TerrainFractalSettings& settings, int gridSize, std::vector<float>* millisecondsPerThreadCount) {
+    // vertices then normals
+    std::vector<glm::vec3> reference((size_t)(gridSize+1)*(gridSize+1) * 2);
+    std::vector<glm::vec3> vertices((size_t)(gridSize+1)*(gridSize+1) * 2);
+    size_t numVertices = vertices.size() / 2;
+
+    GenerateTerrainHeights(perm, settings, 0, 0, gridSize, (GLfloat(*)[3])reference.data(), (GLfloat(*)[3])(reference.data() + numVertices), nullptr, 1);
+
+    bool identical = true;
+    millisecondsPerThreadCount->clear();
+    for (int numThreads = 1; numThreads <= GetThreadPool().GetMaxThreads(); numThreads++)
     {
-        *newInstanceID = tmpNewInstanceID;
+        auto start = std::chrono::high_resolution_clock::now();
+        GenerateTerrainHeights(perm, settings, 0, 0, gridSize, (GLfloat(*)[3])vertices.data(), (GLfloat(*)[3])(vertices.data() + numVertices), nullptr, numThreads);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        millisecondsPerThreadCount->push_back(std::chrono::duration<float, std::milli>(end - start).count());
+
+        if (memcmp(reference.data(), vertices.data(), vertices.size() * sizeof(vertices[0])) != 0)
+        {
+            identical = false;
+        }
     }
+
+    return identical;
 }
 
-void GenerateTerrainMesh(int seed, Scene* scene, uint32_t* newTerrainID) {
-    srand(seed);
+TerrainCacheKey GetTerrainCacheKey(const Scene* scene, uint32_t seed, int gridSize) {
+    TerrainCacheKey key;
+    key.Seed = seed;
+    key.GridSize = gridSize;
+    key.Fractal = (int32_t)scene->TerrainSettings.Fractal;
+    key.Octaves = std::max(FRACTAL_MIN_OCTAVES, std::min(scene->TerrainSettings.Octaves, FRACTAL_MAX_OCTAVES));
+    key.H = scene->TerrainSettings.H;
+    key.Lacunarity = scene->TerrainSettings.Lacunarity;
+    key.HeightScale = scene->TerrainSettings.HeightScale;
+    return key;
+}
+
+// makes the terrain from its disk cache file, uploading straight from the mapping. returns false if it isn't cached.
+static bool LoadTerrainMeshFromCache(Scene* scene, const TerrainCacheKey& key, uint32_t* newTerrainID) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    CachedHeightfield cached;
+    if (!scene->HeightfieldCache.Enabled || !scene->HeightfieldCache.Load(key, &cached)) {
+        return false;
+    }
 
     Terrain terrain;
+    CreateTerrainObjects(scene, key.GridSize, &terrain);
+    UploadTerrainRows(terrain, 0, key.GridSize + 1, 0, cached.Texels);
+    terrain.MinHeight = cached.Header->MinHeight;
+    terrain.MaxHeight = cached.Header->MaxHeight;
+
+    if (scene->TerrainAdaptiveMesh) {
+        std::vector<uint32_t> indices;
+        BuildTerrainAdaptiveIndices(key.GridSize, cached.Texels, terrain.MinHeight, terrain.MaxHeight, scene->TerrainMeshMaxError, &indices);
+        SetTerrainAdaptiveIndices(scene, &terrain, indices);
+    }
 
-    terrain.gridSize = GRIDSIZE;
+    AddTerrainChunk(scene, key.ChunkX, key.ChunkZ, &terrain, newTerrainID);
 
-    Transform newTransform;
-    newTransform.Scale = glm::vec3(1.0f);
+    auto end = std::chrono::high_resolution_clock::now();
+    scene->TerrainGenHeightfieldMs = std::chrono::duration<float, std::milli>(end - start).count();
+    scene->TerrainGenThreadsUsed = 0;
+    scene->TerrainGenOnGPU = false;
+    scene->TerrainGenFromCache = true;
+    return true;
+}
 
-    uint32_t newTransformID = scene->Transforms.insert(newTransform);
+static void GenerateTerrainChunkOnCPU(Scene* scene, int chunkX, int chunkZ, Terrain* terrain);
+static bool GenerateTerrainChunkOnGPU(Scene* scene, int chunkX, int chunkZ, Terrain* terrain);
 
-    terrain.TransformID = newTransformID;
+void ReadTerrainTexels(const Terrain& terrain, void* texels) {
+    size_t numVertices = (size_t)(terrain.gridSize+1) * (terrain.gridSize+1);
 
-    int perlin_iterations = 6;
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, terrain.HeightTO);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_UNSIGNED_SHORT, texels);
+    glBindTexture(GL_TEXTURE_2D, terrain.NormalTO);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_BYTE, (uint8_t*)texels + numVertices * sizeof(uint16_t));
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+}
 
-    float height = 8.0;
+void GenerateTerrainMesh(int seed, Scene* scene, uint32_t* newTerrainID) {
+    scene->TerrainNoise = PermutationTable(seed);
 
-    // if the seed is 0, use the default permutation
-    if(seed != 0) {
-        // copy and re-order the Perlin noise permutation table randomly
-        for(int i = 0; i < 256; i++) {
-            ps[i] = p[i];
-        }
-        //std::shuffle(&ps[0], &ps[256], random_for_p);
-		std::random_shuffle(std::begin(ps), std::end(ps));
-		for(int i = 256; i < 511; i++) {
-            ps[i] = ps[i - 256];
-        }
-    } else {
-        for(int i = 0; i < 256; i++) {
-            ps[i] = p[i];
-            ps[i+256] = p[i];
+    int gridSize = std::min(std::max(scene->TerrainGridSize, TERRAIN_MIN_GRID_SIZE), TERRAIN_MAX_GRID_SIZE);
+    TerrainCacheKey key = GetTerrainCacheKey(scene, scene->TerrainNoise.GetSeed(), gridSize);
+
+    uint32_t tmpNewTerrainID;
+    if (LoadTerrainMeshFromCache(scene, key, &tmpNewTerrainID)) {
+        if (newTerrainID) {
+            *newTerrainID = tmpNewTerrainID;
         }
+        return;
     }
 
-    // from "Procedural Fractal Terrains", F. Kenton Musgrave
-    float H = 0.25;
-    float lacunarity = 2.0;
-    int octaves = 8;
-    //float exponent_array[octaves];
-	float* exponent_array = new float[octaves];
+    Terrain terrain;
+    CreateTerrainObjects(scene, gridSize, &terrain);
 
-    float frequency = 1.0;
-    for(int i = 0; i < octaves; i++) {
-        exponent_array[i] = pow(frequency, -H);
-        frequency *= lacunarity;
+    if (!scene->TerrainGenUseGPU || !GenerateTerrainChunkOnGPU(scene, 0, 0, &terrain)) {
+        GenerateTerrainChunkOnCPU(scene, 0, 0, &terrain);
     }
 
-	// end code from "Procedural Fractal Terrains"
+    // the disk cache and the adaptive mesh are made from the texels, read back since the compute programs may have made them
+    if (scene->HeightfieldCache.Enabled || scene->TerrainAdaptiveMesh) {
+        ScratchArena& scratch = GetScratchArena();
+        ScratchScope scratchScope(scratch);
+        uint8_t* texels = scratch.Allocate<uint8_t>(GetTerrainTexelBytes(gridSize));
+        ReadTerrainTexels(terrain, texels);
 
-    // points for a 2x2 terrain
-    GLfloat terrainMeshVerticies[(GRIDSIZE+1)*(GRIDSIZE+1)][3];
-    for(int i = 0; i < (GRIDSIZE+1); i++) {
-        for(int j = 0; j < (GRIDSIZE+1); j++) {
-            terrainMeshVerticies[i*(GRIDSIZE+1) + j][0] = 0.125 * (i * 1.0f - GRIDSIZE/2) * TERRAINSIZE / GRIDSIZE;
-            terrainMeshVerticies[i*(GRIDSIZE+1) + j][2] = 0.125 * (j * 1.0f - GRIDSIZE/2) * TERRAINSIZE / GRIDSIZE;
-
-            terrainMeshVerticies[i*(GRIDSIZE+1) + j][1] = 0;
+        if (scene->HeightfieldCache.Enabled) {
+            size_t numVertices = (size_t)(gridSize+1) * (gridSize+1);
+            scene->HeightfieldCache.Store(key, terrain.MinHeight, terrain.MaxHeight, numVertices, texels);
+        }
+        if (scene->TerrainAdaptiveMesh) {
+            std::vector<uint32_t> indices;
+            BuildTerrainAdaptiveIndices(gridSize, texels, terrain.MinHeight, terrain.MaxHeight, scene->TerrainMeshMaxError, &indices);
+            SetTerrainAdaptiveIndices(scene, &terrain, indices);
+        }
+    }
 
-            // hybrid multifractal, from Musgrave
-            float x = (float)i / GRIDSIZE;
-            float y = (float)j / GRIDSIZE;
-            float value = 0;
+    AddTerrainChunk(scene, 0, 0, &terrain, &tmpNewTerrainID);
 
-            value += perlin(x, y) * 2 * exponent_array[0];
-            float weight = value;
+    if (newTerrainID) {
+        *newTerrainID = tmpNewTerrainID;
+    }
+}
 
-            x *= lacunarity;
-            y *= lacunarity;
+void CreateTerrainObjects(Scene* scene, int gridSize, Terrain* terrain) {
+    terrain->gridSize = gridSize;
 
-            for(int k = 1; k < octaves; k++) {
-                if(weight > 2.0) weight = 2.0;
+    // 4 bytes per vertex, where vertex buffers took 24 (and the float textures the renderers sampled another 12)
+    terrain->HeightTO = scene->GLPool.AcquireTexture2D(GL_R16, gridSize+1, gridSize+1);
+    terrain->NormalTO = scene->GLPool.AcquireTexture2D(GL_RG8_SNORM, gridSize+1, gridSize+1);
 
-                float signal = perlin(x, y) * 2 * exponent_array[k];
-                value += signal * weight;
+    for (GLuint texture : { terrain->HeightTO, terrain->NormalTO }) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-                weight *= signal;
+static_assert(sizeof(uint16_t) + 2 * sizeof(int8_t) == TERRAIN_CACHE_BYTES_PER_VERTEX, "the disk cache stores the packed texels");
 
-                x *= lacunarity;
-                y *= lacunarity;
-            }
+size_t GetTerrainTexelBytes(int gridSize) {
+    size_t numVertices = (size_t)(gridSize+1) * (gridSize+1);
+    return numVertices * (sizeof(uint16_t) + 2 * sizeof(int8_t));
+}
 
-			// end code from "Procedural Fractal Terrains"
+void PackTerrainTexels(int gridSize, const float* heights, const GLfloat (*normals)[3], float minHeight, float maxHeight, void* texels) {
+    size_t numVertices = (size_t)(gridSize+1) * (gridSize+1);
+    uint16_t* packedHeights = (uint16_t*)texels;
+    int8_t (*packedNormals)[2] = (int8_t(*)[2])(packedHeights + numVertices);
 
-            terrainMeshVerticies[i*(GRIDSIZE+1) + j][1] = value + 0.75;
+    // rounded like GL converts floats to normalized integers, so this matches what terrain_heights.comp stores
+    float heightScale = maxHeight > minHeight ? 65535.0f / (maxHeight - minHeight) : 0.0f;
+    for (size_t i = 0; i < numVertices; i++) {
+        float height = std::min(std::max((heights[i] - minHeight) * heightScale, 0.0f), 65535.0f);
+        packedHeights[i] = (uint16_t)(height + 0.5f);
+    }
+    for (size_t i = 0; i < numVertices; i++) {
+        packedNormals[i][0] = (int8_t)lroundf(std::min(std::max(normals[i][0], -1.0f), 1.0f) * 127.0f);
+        packedNormals[i][1] = (int8_t)lroundf(std::min(std::max(normals[i][2], -1.0f), 1.0f) * 127.0f);
+    }
+}
 
-            // basic fBm algorithm
-            // H = 1, lacunarity = 2, ocaves = 6
-            /*
-            float x = (float)i / GRIDSIZE;
-            float y = (float)j / GRIDSIZE;
-            float value = 0;
-            for(int k = 0; k < octaves; k++) {
-                value += perlin(x, y) * exponent_array[k];
-                x *= lacunarity;
-                y *= lacunarity;
-            }
+void UploadTerrainRows(const Terrain& terrain, int firstRow, int numRows, GLuint texelBO, const void* texels) {
+    UploadTerrainRect(terrain, 0, firstRow, terrain.gridSize + 1, numRows, texelBO, texels);
+}
 
-            terrainMeshVerticies[i*(GRIDSIZE+1) + j][1] = value * 8.0 - 4.0;
-            */
+void UploadTerrainRect(const Terrain& terrain, int firstColumn, int firstRow, int numColumns, int numRows, GLuint texelBO, const void* texels) {
+    size_t rowVertices = (size_t)terrain.gridSize + 1;
+    size_t numVertices = rowVertices * rowVertices;
+    size_t firstVertex = firstRow * rowVertices + firstColumn;
+    const char* heights = (const char*)texels + firstVertex * sizeof(uint16_t);
+    const char* normals = (const char*)texels + numVertices * sizeof(uint16_t) + firstVertex * 2 * sizeof(int8_t);
+
+    // texture row i is grid row i, and the rectangle's rows are a grid row apart in texels.
+    // With a buffer bound, the pointers are offsets into it.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)rowVertices);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texelBO);
+    glBindTexture(GL_TEXTURE_2D, terrain.HeightTO);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, firstColumn, firstRow, numColumns, numRows, GL_RED, GL_UNSIGNED_SHORT, heights);
+    glBindTexture(GL_TEXTURE_2D, terrain.NormalTO);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, firstColumn, firstRow, numColumns, numRows, GL_RG, GL_BYTE, normals);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
 
-            // original implementation
-            /*
-            float perlin_multiplier = 1.0;
+// fills the terrain's heightfield textures on the CPU
+static void GenerateTerrainChunkOnCPU(Scene* scene, int chunkX, int chunkZ, Terrain* terrain) {
+    int gridSize = terrain->gridSize;
+    size_t numVertices = (size_t)(gridSize+1) * (gridSize+1);
 
-            for(int k = 0; k < perlin_iterations; k++) {
-                terrainMeshVerticies[i*(GRIDSIZE+1) + j][1] += (height / perlin_multiplier) * perlin((float)i * perlin_multiplier / GRIDSIZE, (float)j * perlin_multiplier / GRIDSIZE);
-                perlin_multiplier *= 2.0;
-            }
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
 
-            terrainMeshVerticies[i*(GRIDSIZE+1) + j][1] -= height / 2;
-            */
+    // x/z follow from the grid, so only the heights and normals are generated
+    float* heights = scratch.Allocate<float>(numVertices);
+    GLfloat (*normals)[3] = scratch.Allocate<GLfloat[3]>(numVertices);
 
-        }
-    }
+    auto heightfieldStart = std::chrono::high_resolution_clock::now();
 
-    GLuint newPositionBO;
-    glGenBuffers(1, &newPositionBO);
-    glBindBuffer(GL_ARRAY_BUFFER, newPositionBO);
-    glBufferData(GL_ARRAY_BUFFER, (GRIDSIZE+1) * (GRIDSIZE+1) * 3 * sizeof(GLfloat), terrainMeshVerticies, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GenerateTerrainHeights(scene->TerrainNoise, scene->TerrainSettings, chunkX, chunkZ, gridSize, nullptr, normals, heights, scene->TerrainGenMaxThreads);
 
-    terrain.PositionBO = newPositionBO;
+    auto heightfieldEnd = std::chrono::high_resolution_clock::now();
+    scene->TerrainGenHeightfieldMs = std::chrono::duration<float, std::milli>(heightfieldEnd - heightfieldStart).count();
+    scene->TerrainGenThreadsUsed = std::min(scene->TerrainGenMaxThreads, GetThreadPool().GetMaxThreads());
+    scene->TerrainGenOnGPU = false;
+    scene->TerrainGenFromCache = false;
 
 	//Currently commented out to avoid a stack overflow
 	/*
 	//Nick
-	GLuint terrainMeshTexCoord[(GRIDSIZE)*(GRIDSIZE)][2][3][2];
-	for (int i = 0; i < GRIDSIZE; i++) {
-		for (int j = 0; j < GRIDSIZE; j++) {
+	GLuint terrainMeshTexCoord[(gridSize)*(gridSize)][2][3][2];
+	for (int i = 0; i < gridSize; i++) {
+		for (int j = 0; j < gridSize; j++) {
 			//top left
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][0][0][0] = 0;
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][0][0][1] = 1;
+			terrainMeshTexCoord[i*(gridSize)+j][0][0][0] = 0;
+			terrainMeshTexCoord[i*(gridSize)+j][0][0][1] = 1;
 			//bottom left
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][0][1][0] = 0;
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][0][1][1] = 0;
+			terrainMeshTexCoord[i*(gridSize)+j][0][1][0] = 0;
+			terrainMeshTexCoord[i*(gridSize)+j][0][1][1] = 0;
 			//top right
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][0][2][0] = 1;
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][0][2][1] = 1;
+			terrainMeshTexCoord[i*(gridSize)+j][0][2][0] = 1;
+			terrainMeshTexCoord[i*(gridSize)+j][0][2][1] = 1;
 			//bottom right
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][1][0][0] = 1;
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][1][0][1] = 0;
+			terrainMeshTexCoord[i*(gridSize)+j][1][0][0] = 1;
+			terrainMeshTexCoord[i*(gridSize)+j][1][0][1] = 0;
 			//bottom left
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][1][1][0] = 0;
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][1][1][1] = 0;
+			terrainMeshTexCoord[i*(gridSize)+j][1][1][0] = 0;
+			terrainMeshTexCoord[i*(gridSize)+j][1][1][1] = 0;
 			//top right
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][1][2][0] = 1;
-			terrainMeshTexCoord[i*(GRIDSIZE)+j][1][2][1] = 1;
+			terrainMeshTexCoord[i*(gridSize)+j][1][2][0] = 1;
+			terrainMeshTexCoord[i*(gridSize)+j][1][2][1] = 1;
 		}
 	}
 
 	GLuint newTexCoordBO;
 	glGenBuffers(1, &newTexCoordBO);
 	glBindBuffer(GL_ARRAY_BUFFER, newTexCoordBO);
-	glBufferData(GL_ARRAY_BUFFER, GRIDSIZE * GRIDSIZE * 2 * 3 * 2 * sizeof(terrainMeshTexCoord[0][0][0][0]), terrainMeshTexCoord, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, gridSize * gridSize * 2 * 3 * 2 * sizeof(terrainMeshTexCoord[0][0][0][0]), terrainMeshTexCoord, GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	terrain.TexCoordBO = newTexCoordBO;
+	terrain->TexCoordBO = newTexCoordBO;
 	*/
 
-    GLuint TerrainIndexBO[GRIDSIZE*GRIDSIZE][2][3];    // 100 squares, 2 triangles/square, 3 points/triangle
-    for(int i = 0; i < GRIDSIZE; i++) {
-        for(int j = 0; j < GRIDSIZE; j++) {
-            // triangle 1
-            TerrainIndexBO[i*(GRIDSIZE) + j][0][0] = i*(GRIDSIZE+1) + j;
-            TerrainIndexBO[i*(GRIDSIZE) + j][0][1] = (i+1) * (GRIDSIZE+1) + j;
-            TerrainIndexBO[i*(GRIDSIZE) + j][0][2] = i*(GRIDSIZE+1) + j + 1;
-            // triangle 2
-            TerrainIndexBO[i*(GRIDSIZE) + j][1][0] = (i+1) * (GRIDSIZE+1) + j + 1;
-            TerrainIndexBO[i*(GRIDSIZE) + j][1][1] = (i+1) * (GRIDSIZE+1) + j;
-            TerrainIndexBO[i*(GRIDSIZE) + j][1][2] = i*(GRIDSIZE+1) + j + 1;
-        }
+    terrain->MinHeight = heights[0];
+    terrain->MaxHeight = heights[0];
+    for(size_t i = 0; i < numVertices; i++) {
+        terrain->MinHeight = std::min(terrain->MinHeight, heights[i]);
+        terrain->MaxHeight = std::max(terrain->MaxHeight, heights[i]);
     }
 
-    glm::vec3 normals[(GRIDSIZE+1)*(GRIDSIZE+1)];
-
-    for(int i = 0; i < GRIDSIZE*GRIDSIZE; i++) {
-        GLuint t1_i[3] = {TerrainIndexBO[i][0][0], TerrainIndexBO[i][0][1], TerrainIndexBO[i][0][2]};   // indicies of vertices of first triangle
-        glm::vec3 t1_a(terrainMeshVerticies[t1_i[0]][0], terrainMeshVerticies[t1_i[0]][1], terrainMeshVerticies[t1_i[0]][2]);
-        glm::vec3 t1_b(terrainMeshVerticies[t1_i[1]][0], terrainMeshVerticies[t1_i[1]][1], terrainMeshVerticies[t1_i[1]][2]);
-        glm::vec3 t1_c(terrainMeshVerticies[t1_i[2]][0], terrainMeshVerticies[t1_i[2]][1], terrainMeshVerticies[t1_i[2]][2]);
+    uint8_t* texels = scratch.Allocate<uint8_t>(GetTerrainTexelBytes(gridSize));
+    PackTerrainTexels(gridSize, heights, normals, terrain->MinHeight, terrain->MaxHeight, texels);
+    UploadTerrainRows(*terrain, 0, gridSize + 1, 0, texels);
+}
 
-        normals[TerrainIndexBO[i][0][0]] += normalize(cross(t1_b - t1_a, t1_b - t1_c));
-        normals[TerrainIndexBO[i][0][1]] += normalize(cross(t1_b - t1_a, t1_b - t1_c));
-        normals[TerrainIndexBO[i][0][2]] += normalize(cross(t1_b - t1_a, t1_b - t1_c));
+// fills the terrain's heightfield textures with terrain_heights.comp.
+// returns false (having written nothing) if the compute programs aren't available, eg. on a GL 4.1 context,
+// or if the terrain isn't a hybrid multifractal, the only fractal the shader implements.
+static bool GenerateTerrainChunkOnGPU(Scene* scene, int chunkX, int chunkZ, Terrain* terrain) {
+    if (!scene->TerrainHeightsCS || !*scene->TerrainHeightsCS) {
+        return false;
+    }
+    const TerrainFractalSettings& settings = scene->TerrainSettings;
+    if (settings.Fractal != FractalType::HybridMultifractal) {
+        return false;
+    }
 
-        GLuint t2_i[3] = {TerrainIndexBO[i][1][0], TerrainIndexBO[i][1][1], TerrainIndexBO[i][1][2]};   // indicies of vertices of second triangle
-        glm::vec3 t2_a(terrainMeshVerticies[t1_i[0]][0], terrainMeshVerticies[t1_i[0]][1], terrainMeshVerticies[t1_i[0]][2]);
-        glm::vec3 t2_b(terrainMeshVerticies[t1_i[1]][0], terrainMeshVerticies[t1_i[1]][1], terrainMeshVerticies[t1_i[1]][2]);
-        glm::vec3 t2_c(terrainMeshVerticies[t1_i[2]][0], terrainMeshVerticies[t1_i[2]][1], terrainMeshVerticies[t1_i[2]][2]);
+    GLuint heightsCS = *scene->TerrainHeightsCS;
 
-        normals[TerrainIndexBO[i][1][0]] += normalize(cross(t1_b - t1_a, t1_b - t1_c));
-        normals[TerrainIndexBO[i][1][1]] += normalize(cross(t1_b - t1_a, t1_b - t1_c));
-        normals[TerrainIndexBO[i][1][2]] += normalize(cross(t1_b - t1_a, t1_b - t1_c));
+    int gridSize = terrain->gridSize;
+    int octaves = std::max(FRACTAL_MIN_OCTAVES, std::min(settings.Octaves, FRACTAL_MAX_OCTAVES));
+    SpectralTable spectrum = MakeSpectralTable(settings.H, settings.Lacunarity);
 
+    auto heightfieldStart = std::chrono::high_resolution_clock::now();
 
-        //normals[2*i] = glm::normalize(glm::vec3(1.0f, 1.0f, 0.0f));
-        //normals[2*i + 1] = glm::normalize(glm::vec3(0.0f, 1.0f, 1.0f));
+    // the table is re-uploaded every time, since GenerateWorld might have reseeded it
+    if (!scene->TerrainPermutationBO) {
+        glGenBuffers(1, &scene->TerrainPermutationBO);
     }
-
-    for(int i = 0; i < (GRIDSIZE+1)*(GRIDSIZE+1); i++) {
-        normals[i] = normalize(normals[i]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, scene->TerrainPermutationBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 512 * sizeof(int), scene->TerrainNoise.Data(), GL_DYNAMIC_DRAW);
+
+    // see sortable_bits in terrain_heights.comp
+    GLuint bounds[2] = { 0xFFFFFFFF, 0 };
+    GLuint boundsBO;
+    glGenBuffers(1, &boundsBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(bounds), bounds, GL_DYNAMIC_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // the float heights, kept between the passes
+    size_t numVertices = (size_t)(gridSize+1) * (gridSize+1);
+    GLuint heightsBO = scene->GLPool.AcquireBuffer(numVertices * sizeof(GLfloat));
+
+    glProgramUniform1i(heightsCS, glGetUniformLocation(heightsCS, "GridSize"), gridSize);
+    glProgramUniform2i(heightsCS, glGetUniformLocation(heightsCS, "Chunk"), chunkX, chunkZ);
+    glProgramUniform1f(heightsCS, glGetUniformLocation(heightsCS, "ChunkSize"), TERRAIN_WORLD_SIZE);
+    glProgramUniform1f(heightsCS, glGetUniformLocation(heightsCS, "Lacunarity"), settings.Lacunarity);
+    glProgramUniform1i(heightsCS, glGetUniformLocation(heightsCS, "Octaves"), octaves);
+    glProgramUniform1fv(heightsCS, glGetUniformLocation(heightsCS, "Exponents"), octaves, spectrum.Weights);
+    glProgramUniform1f(heightsCS, glGetUniformLocation(heightsCS, "HeightScale"), settings.HeightScale);
+    glProgramUniform1f(heightsCS, glGetUniformLocation(heightsCS, "HeightOffset"), GetTerrainHeightOffset(settings));
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TERRAIN_GEN_PERMUTATION_BUFFER_BINDING, scene->TerrainPermutationBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TERRAIN_GEN_HEIGHT_BUFFER_BINDING, heightsBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TERRAIN_GEN_BOUNDS_BUFFER_BINDING, boundsBO);
+    glBindImageTexture(TERRAIN_GEN_HEIGHT_IMAGE_BINDING, terrain->HeightTO, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R16);
+    glBindImageTexture(TERRAIN_GEN_NORMAL_IMAGE_BINDING, terrain->NormalTO, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG8_SNORM);
+
+    GLuint numGroups = (gridSize + 1 + TERRAIN_GEN_LOCAL_SIZE - 1) / TERRAIN_GEN_LOCAL_SIZE;
+    GLint passLocation = glGetUniformLocation(heightsCS, "Pass");
+
+    // the heights are normalized over their range, which is only known once they've all been generated
+    glUseProgram(heightsCS);
+    glProgramUniform1i(heightsCS, passLocation, 0);
+    glDispatchCompute(numGroups, numGroups, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glProgramUniform1i(heightsCS, passLocation, 1);
+    glDispatchCompute(numGroups, numGroups, 1);
+    glUseProgram(0);
+
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    for (GLuint binding : { TERRAIN_GEN_PERMUTATION_BUFFER_BINDING, TERRAIN_GEN_HEIGHT_BUFFER_BINDING, TERRAIN_GEN_BOUNDS_BUFFER_BINDING }) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+    glBindImageTexture(TERRAIN_GEN_HEIGHT_IMAGE_BINDING, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R16);
+    glBindImageTexture(TERRAIN_GEN_NORMAL_IMAGE_BINDING, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG8_SNORM);
+    scene->GLPool.RetireBuffer(heightsBO);
+
+    // the height range is the only thing read back, for culling. This waits for the dispatches, so the timing below is the GPU's.
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBO);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(bounds), bounds);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glDeleteBuffers(1, &boundsBO);
+
+    for (int k = 0; k < 2; k++) {
+        GLuint bits = (bounds[k] & 0x80000000) ? (bounds[k] & 0x7FFFFFFF) : ~bounds[k];
+        memcpy(k == 0 ? &terrain->MinHeight : &terrain->MaxHeight, &bits, sizeof(bits));
     }
 
-    GLuint newIndexBO;
-    glGenBuffers(1, &newIndexBO);
-    // Why not bind to GL_ELEMENT_ARRAY_BUFFER?
-    // Because binding to GL_ELEMENT_ARRAY_BUFFER attaches the EBO to the currently bound VAO, which might stomp somebody else's state.
-    glBindBuffer(GL_ARRAY_BUFFER, newIndexBO);
-    glBufferData(GL_ARRAY_BUFFER, GRIDSIZE * GRIDSIZE * 2 * 3 * sizeof(TerrainIndexBO[0][0][0]), TerrainIndexBO, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    auto heightfieldEnd = std::chrono::high_resolution_clock::now();
+    scene->TerrainGenHeightfieldMs = std::chrono::duration<float, std::milli>(heightfieldEnd - heightfieldStart).count();
+    scene->TerrainGenThreadsUsed = 0;
+    scene->TerrainGenOnGPU = true;
+    scene->TerrainGenFromCache = false;
 
-    terrain.IndexBO = newIndexBO;
+    return true;
+}
 
-    GLuint newNormalBO;
+void BuildTerrainAdaptiveIndices(int gridSize, const void* texels, float minHeight, float maxHeight, float maxError, std::vector<uint32_t>* indices) {
+    // the mesh is fit to the 16-bit heights the textures have, so the error is against what the full grid draws
+    std::vector<float> errors;
+    ComputeRtinErrors(gridSize, (const uint16_t*)texels, (maxHeight - minHeight) / 65535.0f, &errors);
+    BuildRtinIndices(gridSize, errors, maxError, indices);
+}
 
-    glGenBuffers(1, &newNormalBO);
-    glBindBuffer(GL_ARRAY_BUFFER, newNormalBO);
-    glBufferData(GL_ARRAY_BUFFER, (GRIDSIZE+1)*(GRIDSIZE+1) * sizeof(normals[0]), normals, GL_STATIC_DRAW);
+void SetTerrainAdaptiveIndices(Scene* scene, Terrain* terrain, const std::vector<uint32_t>& indices) {
+    size_t numVertices = (size_t)(terrain->gridSize+1) * (terrain->gridSize+1);
+
+    // a terrain that already has one is being remeshed, eg. after sculpting
+    bool replacing = terrain->AdaptiveMesh;
+    if (replacing) {
+        scene->GLPool.RetireBuffer(terrain->IndexBO);
+    }
+
+    terrain->AdaptiveMesh = true;
+    terrain->IndexCount = (GLsizei)indices.size();
+    terrain->IndexBO = scene->GLPool.AcquireBuffer(indices.size() * sizeof(GLuint));
+
+    // 16-bit where they fit, like the grid's. Not bound to GL_ELEMENT_ARRAY_BUFFER, which would attach it to the bound vertex array.
+    glBindBuffer(GL_ARRAY_BUFFER, terrain->IndexBO);
+    if (numVertices <= 65536) {
+        ScratchArena& scratch = GetScratchArena();
+        ScratchScope scratchScope(scratch);
+        GLushort* shortIndices = scratch.Allocate<GLushort>(indices.size());
+        std::copy(indices.begin(), indices.end(), shortIndices);
+
+        terrain->IndexType = GL_UNSIGNED_SHORT;
+        glBufferSubData(GL_ARRAY_BUFFER, 0, indices.size() * sizeof(GLushort), shortIndices);
+    } else {
+        terrain->IndexType = GL_UNSIGNED_INT;
+        glBufferSubData(GL_ARRAY_BUFFER, 0, indices.size() * sizeof(GLuint), indices.data());
+    }
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    terrain.NormalBO = newNormalBO;
+    if (replacing) {
+        glBindVertexArray(terrain->MeshVAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain->IndexBO);
+        glBindVertexArray(0);
+    }
+}
+
+// the vertex array is recycled too. Every water and preview grid sets the same attributes, so any retired one will do.
+// terrain with a heightfield has no attributes, so it draws with the grid's shared vertex array. Previews come with their own index buffer.
+static void CreateTerrainVertexArray(Scene* scene, Terrain* terrain) {
+    if (terrain->AdaptiveMesh) {
+        // no attributes either, but the terrain's own indices. Not from the pool, whose vertex arrays have the attributes enabled.
+        glGenVertexArrays(1, &terrain->MeshVAO);
+        glBindVertexArray(terrain->MeshVAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain->IndexBO);
+        glBindVertexArray(0);
+        return;
+    }
+
+    if (terrain->PreviewStep == 1) {
+        const GridIndexBuffer& indices = scene->GridIndices.Acquire(terrain->gridSize);
+        terrain->IndexBO = indices.IndexBO;
+        terrain->IndexType = indices.IndexType;
+        terrain->IndexCount = indices.IndexCount;
 
+        if (terrain->HeightTO) {
+            terrain->MeshVAO = indices.VertexArray;
+            return;
+        }
+    }
 
-    GLuint newMeshVAO;
-    glGenVertexArrays(1, &newMeshVAO);
+    GLuint newMeshVAO = scene->GLPool.AcquireVertexArray();
 
     glBindVertexArray(newMeshVAO);
 
-    if (terrain.PositionBO)
-    {
-        glBindBuffer(GL_ARRAY_BUFFER, terrain.PositionBO);
-        glVertexAttribPointer(SCENE_POSITION_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, terrain->PositionBO);
+    glVertexAttribPointer(SCENE_POSITION_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-        glEnableVertexAttribArray(SCENE_POSITION_ATTRIB_LOCATION);
-    }
+    glEnableVertexAttribArray(SCENE_POSITION_ATTRIB_LOCATION);
 
-    glBindBuffer(GL_ARRAY_BUFFER, terrain.NormalBO);
+    glBindBuffer(GL_ARRAY_BUFFER, terrain->NormalBO);
     glVertexAttribPointer(SCENE_NORMAL_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     glEnableVertexAttribArray(SCENE_NORMAL_ATTRIB_LOCATION);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain.IndexBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain->IndexBO);
 
     glBindVertexArray(0);
 
-    terrain.MeshVAO = newMeshVAO;
+    terrain->MeshVAO = newMeshVAO;
+}
+
+void AddTerrainChunk(Scene* scene, int chunkX, int chunkZ, Terrain* terrain, uint32_t* newTerrainID) {
+    Transform newTransform;
+    newTransform.Scale = glm::vec3(1.0f);
+    newTransform.Translation = glm::vec3(chunkX * TERRAIN_WORLD_SIZE, 0.0f, chunkZ * TERRAIN_WORLD_SIZE);
+
+    uint32_t newTransformID = scene->Transforms.insert(newTransform);
 
+    terrain->TransformID = newTransformID;
 
-    uint32_t tmpNewTerrainID = scene->Terrains.insert(terrain);
+    CreateTerrainVertexArray(scene, terrain);
+
+    uint32_t tmpNewTerrainID = scene->Terrains.insert(*terrain);
     if (newTerrainID)
     {
         *newTerrainID = tmpNewTerrainID;
     }
 }
 
-void GenerateWaterMesh(Scene* scene, uint32_t* newTerrainID) {
+void GenerateTerrainChunk(Scene* scene, int chunkX, int chunkZ, int gridSize, uint32_t* newTerrainID) {
+    Terrain terrain;
+
+    gridSize = std::min(std::max(gridSize, TERRAIN_MIN_GRID_SIZE), TERRAIN_MAX_GRID_SIZE);
+
+    CreateTerrainObjects(scene, gridSize, &terrain);
+
+    if (!scene->TerrainGenUseGPU || !GenerateTerrainChunkOnGPU(scene, chunkX, chunkZ, &terrain)) {
+        GenerateTerrainChunkOnCPU(scene, chunkX, chunkZ, &terrain);
+    }
+
+    AddTerrainChunk(scene, chunkX, chunkZ, &terrain, newTerrainID);
+}
+
+void GenerateWaterMesh(Scene* scene, int gridSize, uint32_t* newTerrainID) {
     Terrain water;
 
-    water.gridSize = GRIDSIZE;
+    gridSize = std::min(std::max(gridSize, TERRAIN_MIN_GRID_SIZE), TERRAIN_MAX_GRID_SIZE);
+
+    water.gridSize = gridSize;
+
+    size_t numVertices = (size_t)(gridSize+1) * (gridSize+1);
+
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
 
     Transform newTransform;
     newTransform.Scale = glm::vec3(1.0f);
@@ -787,106 +987,99 @@ void GenerateWaterMesh(Scene* scene, uint32_t* newTerrainID) {
     water.TransformID = newTransformID;
 
     // points for a 100x100 water mesh
-    GLfloat waterMeshVerticies[(GRIDSIZE+1)*(GRIDSIZE+1)][3];
+    GLfloat (*waterMeshVerticies)[3] = scratch.Allocate<GLfloat[3]>(numVertices);
 
-	for (int i = 0; i < GRIDSIZE+1; i++) {
-		for (int j = 0; j < GRIDSIZE+1; j++) {
-			waterMeshVerticies[i * (GRIDSIZE + 1) + j][0] = 0.125 * (i * 1.0f - GRIDSIZE / 2) * TERRAINSIZE / GRIDSIZE;
-			waterMeshVerticies[i * (GRIDSIZE + 1) + j][1] = 2.745;
-			waterMeshVerticies[i * (GRIDSIZE + 1) + j][2] = 0.125 * (j * 1.0f - GRIDSIZE / 2) * TERRAINSIZE / GRIDSIZE;
+	for (int i = 0; i < gridSize+1; i++) {
+		for (int j = 0; j < gridSize+1; j++) {
+			waterMeshVerticies[i * (gridSize + 1) + j][0] = 0.125 * (i - gridSize * 0.5f) * TERRAINSIZE / gridSize;
+			waterMeshVerticies[i * (gridSize + 1) + j][1] = TERRAIN_WATER_HEIGHT;
+			waterMeshVerticies[i * (gridSize + 1) + j][2] = 0.125 * (j - gridSize * 0.5f) * TERRAINSIZE / gridSize;
 		}
 	}
 
-    GLuint newPositionBO;
-    glGenBuffers(1, &newPositionBO);
+    GLuint newPositionBO = scene->GLPool.AcquireBuffer(numVertices * 3 * sizeof(GLfloat));
     glBindBuffer(GL_ARRAY_BUFFER, newPositionBO);
-    glBufferData(GL_ARRAY_BUFFER, (GRIDSIZE+1)*(GRIDSIZE+1) * 3 * sizeof(GLfloat), waterMeshVerticies, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, numVertices * 3 * sizeof(GLfloat), waterMeshVerticies);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     water.PositionBO = newPositionBO; 
-	
-	GLuint WaterIndexBO[GRIDSIZE*GRIDSIZE][2][3];    // 100 squares, 2 triangles/square, 3 points/triangle
-	for (int i = 0; i < GRIDSIZE; i++) {
-		for (int j = 0; j < GRIDSIZE; j++) {
-			// triangle 1
-			WaterIndexBO[i*(GRIDSIZE)+j][0][0] = i*(GRIDSIZE + 1) + j;
-			WaterIndexBO[i*(GRIDSIZE)+j][0][1] = (i + 1) * (GRIDSIZE + 1) + j;
-			WaterIndexBO[i*(GRIDSIZE)+j][0][2] = i*(GRIDSIZE + 1) + j + 1;
-			// triangle 2
-			WaterIndexBO[i*(GRIDSIZE)+j][1][0] = (i + 1) * (GRIDSIZE + 1) + j + 1;
-			WaterIndexBO[i*(GRIDSIZE)+j][1][1] = (i + 1) * (GRIDSIZE + 1) + j;
-			WaterIndexBO[i*(GRIDSIZE)+j][1][2] = i*(GRIDSIZE + 1) + j + 1;
-		}
-	}
 
-    glm::vec3 normals[(GRIDSIZE + 1)*(GRIDSIZE + 1)];
+    glm::vec3* normals = scratch.Allocate<glm::vec3>(numVertices);
 
-    for(int i = 0; i < (GRIDSIZE + 1)*(GRIDSIZE + 1); i++) {
+    for(size_t i = 0; i < numVertices; i++) {
         normals[i] = glm::vec3(0.0f, 1.0f, 0.0f);
         normals[i] = normalize(normals[i]); // just in case
     }
 
-    GLuint newIndexBO;
-    glGenBuffers(1, &newIndexBO);
-    // Why not bind to GL_ELEMENT_ARRAY_BUFFER?
-    // Because binding to GL_ELEMENT_ARRAY_BUFFER attaches the EBO to the currently bound VAO, which might stomp somebody else's state.
-    glBindBuffer(GL_ARRAY_BUFFER, newIndexBO);
-    glBufferData(GL_ARRAY_BUFFER, (GRIDSIZE + 1)*(GRIDSIZE + 1) * 2 * 3 * sizeof(WaterIndexBO[0][0][0]), WaterIndexBO, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    water.IndexBO = newIndexBO;
-
-    GLuint newNormalBO;
-
-    glGenBuffers(1, &newNormalBO);
+    GLuint newNormalBO = scene->GLPool.AcquireBuffer(numVertices * sizeof(normals[0]));
     glBindBuffer(GL_ARRAY_BUFFER, newNormalBO);
-    glBufferData(GL_ARRAY_BUFFER, (GRIDSIZE + 1)*(GRIDSIZE + 1) * sizeof(normals[0]), normals, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, numVertices * sizeof(normals[0]), normals);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     water.NormalBO = newNormalBO;
 
+    // same indices as the terrain grids
+    CreateTerrainVertexArray(scene, &water);
 
-    GLuint newMeshVAO;
-    glGenVertexArrays(1, &newMeshVAO);
-
-    glBindVertexArray(newMeshVAO);
 
-    if (water.PositionBO)
+    uint32_t tmpNewTerrainID = scene->Terrains.insert(water);
+    if (newTerrainID)
     {
-        glBindBuffer(GL_ARRAY_BUFFER, water.PositionBO);
-        glVertexAttribPointer(SCENE_POSITION_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-        glEnableVertexAttribArray(SCENE_POSITION_ATTRIB_LOCATION);
+        *newTerrainID = tmpNewTerrainID;
     }
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, water.NormalBO);
-    glVertexAttribPointer(SCENE_NORMAL_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    glEnableVertexAttribArray(SCENE_NORMAL_ATTRIB_LOCATION);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, water.IndexBO);
-
-    glBindVertexArray(0);
-
-    water.MeshVAO = newMeshVAO;
+void DestroyTerrain(Scene* scene, uint32_t terrainID) {
+    Terrain& terrain = scene->Terrains[terrainID];
 
+    // a heightfield's vertex array is the grid's, unless it has an adaptive mesh
+    if (terrain.AdaptiveMesh)
+    {
+        glDeleteVertexArrays(1, &terrain.MeshVAO);
+    }
+    else if (!terrain.HeightTO)
+    {
+        scene->GLPool.RetireVertexArray(terrain.MeshVAO);
+    }
+    scene->GLPool.RetireBuffer(terrain.PositionBO);
+    scene->GLPool.RetireBuffer(terrain.NormalBO);
+    // a preview's coarser index buffer is its own, and so is an adaptive mesh's
+    if (terrain.PreviewStep > 1 || terrain.AdaptiveMesh)
+    {
+        scene->GLPool.RetireBuffer(terrain.IndexBO);
+    }
+    else
+    {
+        scene->GridIndices.Release(terrain.gridSize);
+    }
+    scene->GLPool.RetireTexture2D(terrain.HeightTO);
+    scene->GLPool.RetireTexture2D(terrain.NormalTO);
 
-    uint32_t tmpNewTerrainID = scene->Terrains.insert(water);
-    if (newTerrainID)
+    if (scene->Transforms.contains(terrain.TransformID))
     {
-        *newTerrainID = tmpNewTerrainID;
+        scene->Transforms.erase(terrain.TransformID);
     }
+
+    scene->Terrains.erase(terrainID);
 }
 
 void ClearTerrains(Scene* scene) {
+    // DestroyTerrain erases from the freelist, so don't iterate it while destroying
+    std::vector<uint32_t> terrainIDs;
     for (uint32_t terrainID : scene->Terrains) {
+        terrainIDs.push_back(terrainID);
+    }
+    for (uint32_t terrainID : terrainIDs) {
         if(scene->Terrains.contains(terrainID)) {
-            scene->Terrains.erase(terrainID);
+            DestroyTerrain(scene, terrainID);
         }
     }
+    // same for the particles
+    std::vector<uint32_t> particlesIDs;
     for (uint32_t particlesID : scene->Particles) {
+        particlesIDs.push_back(particlesID);
+    }
+    for (uint32_t particlesID : particlesIDs) {
         if(scene->Particles.contains(particlesID)) {
             scene->Particles.erase(particlesID);
         }
@@ -1088,17 +1281,40 @@ void ClearTerrains(Scene* scene) {
 
 void GenerateWorld(int seed, Scene* scene) {
 
+    // streamed chunks own their GL objects, so release them before the freelist entries go away
+    FlushTerrainChunks(scene);
+
     ClearTerrains(scene);
 
+    if (scene->TerrainChunks.Enabled)
+    {
+        // chunks get generated lazily around the camera by UpdateTerrainChunks
+        scene->TerrainNoise = PermutationTable(seed);
+        scene->TerrainChunks.Seed = seed;
+
+        GenerateWaterMesh(scene, TERRAIN_DEFAULT_GRID_SIZE, &scene->TerrainChunks.WaterID);
+
+        if (!scene->heightColorTexture)
+        {
+            scene->heightColorTexture = GenerateHeightColors();
+        }
+        return;
+    }
+
     uint32_t newTerrainID;
 
     GenerateTerrainMesh(seed, scene, &newTerrainID);
 
     uint32_t waterID;
 
-    GenerateWaterMesh(scene, &waterID);
+    // the water is flat, so a finer grid would only cost vertices
+    GenerateWaterMesh(scene, TERRAIN_DEFAULT_GRID_SIZE, &waterID);
 
-	scene->heightColorTexture = GenerateHeightColors();
+    // the colors don't depend on the seed
+    if (!scene->heightColorTexture)
+    {
+        scene->heightColorTexture = GenerateHeightColors();
+    }
 }
 
 GLuint GenerateHeightColors() {
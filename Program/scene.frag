@@ -11,6 +11,14 @@ uniform sampler2D DiffuseMap;
 
 uniform sampler1D HeightColorTexture;
 
+// how much light the clouds let through, on the bottom plane of their layer (see cloud_shadow.frag)
+uniform bool CloudShadows;
+uniform sampler2D CloudShadow;
+uniform vec3 CloudShadowToLight;
+
+// the sculpting brush's outline: center (x, z) and radius (0 when there's no brush)
+uniform vec3 SculptBrush;
+
 //Nick
 uniform sampler2D waterTex;
 uniform sampler2D grassTex;
@@ -24,11 +32,17 @@ in vec4 position_worldspace;
 in vec4 camera_position;
 in float altitude;
 
-in vec4 cloud_color;
-in float cloud_block_ratio;
-
 out vec4 FragColor;
 
+float cloud_shadow(vec3 point)
+{
+    // the map starts at the bottom of the layer, so it leaves out the clouds below points inside it
+    if (!CloudShadows || point.y >= CLOUD_BOTTOM)
+        return 1.0;
+    vec3 bottom = point + CloudShadowToLight * ((CLOUD_BOTTOM - point.y) / CloudShadowToLight.y);
+    return texture(CloudShadow, bottom.xz / CLOUD_NOISE_TILE).r;
+}
+
 void main()
 {
     vec3 vector_to_camera = normalize(CameraPos - position_worldspace.xyz);
@@ -44,9 +58,11 @@ void main()
 	vec3 BaseColor = texture(HeightColorTexture, textureCoordinate).xyz;
 
 
+    float shadow = cloud_shadow(position_worldspace.xyz);
+
     vec3 Color = 0.2 * BaseColor
-            + 0.5 * max(dot(vector_to_light, surface_normal), 0) * BaseColor
-            + 0.6 * pow(max(0, dot(surface_normal, normalize(halfway_vector))), 4 * 1) * BaseColor;
+            + shadow * 0.5 * max(dot(vector_to_light, surface_normal), 0) * BaseColor
+            + shadow * 0.6 * pow(max(0, dot(surface_normal, normalize(halfway_vector))), 4 * 1) * BaseColor;
 	
 	/*
 	//Nick
@@ -60,9 +76,6 @@ void main()
 	}
 	*/
 
-    vec3 origin = camera_position.xyz;    // location of the camera
-    vec3 target = position_worldspace.xyz;
-
     FragColor = vec4(Color.x, Color.y, Color.z, 1);
 
 	/*
@@ -72,5 +85,10 @@ void main()
 		FragColor = texture2D(waterTex, UV);
 	*/
 
-	FragColor = cloud_color * cloud_block_ratio + FragColor * (1 - cloud_block_ratio);
+    if (SculptBrush.z > 0)
+    {
+        float distance_to_ring = abs(length(position_worldspace.xz - SculptBrush.xy) - SculptBrush.z);
+        float ring = 1 - smoothstep(0, 0.03 * SculptBrush.z, distance_to_ring);
+        FragColor.rgb = mix(FragColor.rgb, vec3(1, 1, 1), 0.75 * ring);
+    }
 }
@@ -3,6 +3,14 @@
 
 #include "opengl.h"
 #include "packed_freelist.h"
+#include "fractal.h"
+#include "glpool.h"
+#include "gridindex.h"
+#include "noise.h"
+#include "sculpt.h"
+#include "terrain_cache.h"
+#include "terrain_chunks.h"
+#include "world_regen.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -10,6 +18,32 @@
 #include <vector>
 #include <string>
 
+// world-space width of one generated terrain grid (and so of one streamed terrain chunk)
+#define TERRAIN_WORLD_SIZE 16.0f
+
+// grid squares per side of a terrain mesh
+#define TERRAIN_DEFAULT_GRID_SIZE 120
+#define TERRAIN_MIN_GRID_SIZE 64
+#define TERRAIN_MAX_GRID_SIZE 4096
+
+// how far (in world units) a vertex of the terrain may be from its adaptive mesh, by default. The grid spacing is 0.0156 at 1024.
+#define TERRAIN_DEFAULT_MESH_MAX_ERROR 0.0025f
+
+// height of the water plane. The terrain's height scale stretches it about this level, so the coastlines stay put.
+#define TERRAIN_WATER_HEIGHT 2.745f
+
+// what the terrain's heightfield is made of, besides the seed
+struct TerrainFractalSettings
+{
+    FractalType Fractal = FractalType::HybridMultifractal;
+    int Octaves = 8;
+    // octave k is weighted by Lacunarity^(-H k) and sampled at Lacunarity^k (see MakeSpectralTable)
+    float H = (float)TerrainSpectrum::H;
+    float Lacunarity = (float)TerrainSpectrum::Lacunarity;
+    // stretches the relief vertically about TERRAIN_WATER_HEIGHT
+    float HeightScale = 1.0f;
+};
+
 struct DiffuseMap
 {
     GLuint DiffuseMapTO;
@@ -19,13 +53,34 @@ struct Terrain
 {
     GLuint MeshVAO;
     GLuint IndexBO;
-    GLuint PositionBO;
-    GLuint NormalBO;
-    GLuint AltitudeBO;
+    // vertex buffers, for the meshes without a heightfield (the water, and previews). 0 for generated terrain.
+    GLuint PositionBO = 0;
+    GLuint NormalBO = 0;
 	//Nick
 	GLuint TexCoordBO;
 
     int gridSize;
+    // IndexBO is shared by all the grids of the same size (see GridIndexCache), so it isn't owned by the terrain
+    GLenum IndexType = GL_UNSIGNED_INT;
+    // number of indices in IndexBO
+    GLsizei IndexCount;
+
+    // the heightfield of generated terrain, as (gridSize+1)^2 textures. 0 for the meshes with vertex buffers.
+    // texel (j, i) is vertex i * (gridSize+1) + j, so the rows of the textures run along x, and x/z follow from the texel.
+    // Heights are GL_R16, normalized over [MinHeight, MaxHeight]. Normals are GL_RG8_SNORM, holding x and z (y is always positive).
+    // Every grid of the same size shares MeshVAO too: it has no attributes, just the grid's indices (see GridIndexBuffer).
+    GLuint HeightTO = 0;
+    GLuint NormalTO = 0;
+    float MinHeight = 0.0f;
+    float MaxHeight = 0.0f;
+
+    // > 1 for the world regeneration's preview of a terrain, which only has every PreviewStep-th row and column of it (or finer).
+    // IndexBO is a coarser grid over those, owned by the terrain. It has vertex buffers rather than textures.
+    int PreviewStep = 1;
+
+    // whether IndexBO is an adaptive mesh of the heightfield (see rtin.h) rather than the full grid.
+    // It indexes the same grid vertices, but the terrain owns it, and MeshVAO with it.
+    bool AdaptiveMesh = false;
 
     uint32_t TransformID;
 };
@@ -127,13 +182,63 @@ public:
     packed_freelist<Terrain> Terrains;
     packed_freelist<ParticleSet> Particles;
 
+    // chunks of Terrains that are streamed in around the camera (when enabled)
+    TerrainChunkCache TerrainChunks;
+
+    // index buffers of the terrain and water grids
+    GridIndexCache GridIndices;
+
+    // retired terrain GL objects, reused by the next terrain of the same size
+    GLResourcePool GLPool;
+
+    // generated worlds (not streamed chunks), keyed by seed, grid size and noise settings.
+    // declared before WorldRegen, since its worker thread stores to it until WorldRegen is destroyed.
+    TerrainHeightfieldCache HeightfieldCache;
+
+    // world being built in the background by RequestWorldRegeneration
+    WorldRegeneration WorldRegen;
+
+    // brush editing of the world terrain
+    TerrainSculpt Sculpt;
+
 	// Nick
 	GLuint m_texture;
 
     Camera MainCamera;
     Light MainLight;
 
-	GLuint heightColorTexture;
+	GLuint heightColorTexture = 0;
+
+    // noise the terrain is generated with. GenerateWorld reseeds it.
+    PermutationTable TerrainNoise;
+
+    // the fractal the terrain is made of. Regenerate the world after changing these, or streamed chunks won't match.
+    // the compute programs only implement the hybrid multifractal, so the other fractals are generated on the CPU.
+    TerrainFractalSettings TerrainSettings;
+
+    // grid squares per side of the terrain made by GenerateWorld (streamed chunks use TerrainChunks.GridSize)
+    int TerrainGridSize = TERRAIN_DEFAULT_GRID_SIZE;
+
+    // whether the terrain made by GenerateWorld is drawn with an adaptive mesh of its heightfield (see rtin.h) instead of
+    // the full grid, and how far (in world units) a vertex may be from the mesh before it has to be kept.
+    // streamed chunks always use the full grid, since their adaptive meshes wouldn't match along the chunk borders.
+    bool TerrainAdaptiveMesh = false;
+    float TerrainMeshMaxError = TERRAIN_DEFAULT_MESH_MAX_ERROR;
+
+    // max number of threads used to generate terrain heightfields, and how long the last one took
+    int TerrainGenMaxThreads = 64;
+    int TerrainGenThreadsUsed = 0;
+    float TerrainGenHeightfieldMs = 0.0f;
+
+    // compute program for GenerateTerrainChunk, set up by the renderer on GL 4.3+ contexts.
+    // the heightfields are generated on the CPU while this is null (or 0, if it failed to compile), or if TerrainGenUseGPU is off.
+    GLuint* TerrainHeightsCS = nullptr;
+    bool TerrainGenUseGPU = true;
+    // whether the last heightfield came from the compute programs, or from the disk cache
+    bool TerrainGenOnGPU = false;
+    bool TerrainGenFromCache = false;
+    // the Perlin permutation table, for the compute programs
+    GLuint TerrainPermutationBO = 0;
 
     void Init();
 };
@@ -149,17 +254,149 @@ void AddMeshInstance(
     uint32_t meshID,
     uint32_t* newInstanceID);
 
+// the world terrain (chunk (0, 0), the one GenerateWorld makes) with the scene's noise settings.
+// it is loaded from Scene::HeightfieldCache if it was generated before, and stored there otherwise.
+// with Scene::TerrainAdaptiveMesh on, it gets an adaptive mesh instead of the full grid.
 void GenerateTerrainMesh(
     int seed,
     Scene* scene,
     uint32_t* newTerrainID);
 
+// disk cache key of the world terrain with the scene's noise settings. gridSize should already be clamped.
+TerrainCacheKey GetTerrainCacheKey(const Scene* scene, uint32_t seed, int gridSize);
+
+// the H each fractal looks right with. The spectral terrain wants a smoother spectrum than the multifractals (see scene.cpp).
+float GetDefaultTerrainH(FractalType fractal);
+
+// the fractal's value v becomes the terrain height v * settings.HeightScale + offset
+float GetTerrainHeightOffset(const TerrainFractalSettings& settings);
+
+// fills the (gridSize+1)^2 vertices of a terrain chunk's heightfield with fractal noise of perm, using up to maxThreads threads.
+// the normals come from the noise's analytic derivatives in the same pass. vertices and heights are optional (null to skip),
+// heights gets the vertices' y coordinates. nothing is read back, so the arrays can be mapped GL buffers.
+// the result is the same for any number of threads.
+// FractalType::Spectral makes the whole grid with one FFT instead, and repeats every chunk (see spectral.h).
+void GenerateTerrainHeights(
+    const PermutationTable& perm,
+    const TerrainFractalSettings& settings,
+    int chunkX,
+    int chunkZ,
+    int gridSize,
+    GLfloat (*vertices)[3],
+    GLfloat (*normals)[3],
+    float* heights,
+    int maxThreads);
+
+// writes the gridSize+1 normals (and vertices and heights, if rowVertices/rowHeights aren't null) of a terrain's row i
+// from the fractal's values and derivatives along it.
+// the height is value * heightScale + heightOffset. Part of GenerateTerrainHeights, exposed for the benchmarks.
+void WriteTerrainRow(
+    int gridSize,
+    int i,
+    float heightScale,
+    float heightOffset,
+    const float* value,
+    const float* valueDx,
+    const float* valueDy,
+    GLfloat (*rowVertices)[3],
+    GLfloat (*rowNormals)[3],
+    float* rowHeights);
+
+// times GenerateTerrainHeights with 1 to N threads (result[n - 1] = milliseconds with n threads).
+// returns whether every thread count produced bit-identical heights and normals.
+bool MeasureTerrainGenerationScaling(const PermutationTable& perm, const TerrainFractalSettings& settings, int gridSize, std::vector<float>* millisecondsPerThreadCount);
+
+// generates the terrain grid at integer chunk coordinates (chunkX, chunkZ) with Scene::TerrainNoise.
+// chunk (0, 0) is the same grid that GenerateTerrainMesh makes.
+// gridSize is clamped to [TERRAIN_MIN_GRID_SIZE, TERRAIN_MAX_GRID_SIZE]. The chunk covers the same area for any grid size.
+void GenerateTerrainChunk(
+    Scene* scene,
+    int chunkX,
+    int chunkZ,
+    int gridSize,
+    uint32_t* newTerrainID);
+
+// takes the heightfield textures for a gridSize terrain from Scene::GLPool. Their contents are undefined
+// until they are filled, eg. with UploadTerrainRows.
+void CreateTerrainObjects(
+    Scene* scene,
+    int gridSize,
+    Terrain* terrain);
+
+// size of a gridSize terrain's texels, packed for UploadTerrainRows: all the heights, then all the normals
+size_t GetTerrainTexelBytes(int gridSize);
+
+// packs a heightfield into the texture formats (see Terrain): the heights as 16-bit unorms over [minHeight, maxHeight],
+// then the normals' x and z as 8-bit snorms. texels gets GetTerrainTexelBytes(gridSize) bytes, and is only written.
+void PackTerrainTexels(
+    int gridSize,
+    const float* heights,
+    const GLfloat (*normals)[3],
+    float minHeight,
+    float maxHeight,
+    void* texels);
+
+// uploads grid rows [firstRow, firstRow + numRows) of a heightfield to the terrain's textures. texels holds all the
+// (gridSize+1)^2 vertices, packed by PackTerrainTexels. If texelBO isn't 0, texels is an offset into that buffer instead.
+void UploadTerrainRows(
+    const Terrain& terrain,
+    int firstRow,
+    int numRows,
+    GLuint texelBO,
+    const void* texels);
+
+// uploads the rectangle of grid rows [firstRow, firstRow + numRows) and columns [firstColumn, firstColumn + numColumns)
+// of a heightfield to the terrain's textures, like UploadTerrainRows
+void UploadTerrainRect(
+    const Terrain& terrain,
+    int firstColumn,
+    int firstRow,
+    int numColumns,
+    int numRows,
+    GLuint texelBO,
+    const void* texels);
+
+// reads a terrain's texels back from its textures, packed like PackTerrainTexels does
+void ReadTerrainTexels(
+    const Terrain& terrain,
+    void* texels);
+
+// the indices of an adaptive mesh (see rtin.h) of a heightfield packed by PackTerrainTexels, within about maxError of it
+void BuildTerrainAdaptiveIndices(
+    int gridSize,
+    const void* texels,
+    float minHeight,
+    float maxHeight,
+    float maxError,
+    std::vector<uint32_t>* indices);
+
+// gives a terrain made with CreateTerrainObjects an index buffer of its own with the indices, to draw instead of the full grid.
+// call before AddTerrainChunk, or on a terrain in the scene that has an adaptive mesh already, to replace it.
+void SetTerrainAdaptiveIndices(
+    Scene* scene,
+    Terrain* terrain,
+    const std::vector<uint32_t>& indices);
+
+// sets up the vertex array and index buffer of a terrain made with CreateTerrainObjects,
+// then adds it to the scene at chunk coordinates (chunkX, chunkZ)
+void AddTerrainChunk(
+    Scene* scene,
+    int chunkX,
+    int chunkZ,
+    Terrain* terrain,
+    uint32_t* newTerrainID);
+
 void GenerateWaterMesh(
     Scene* scene,
+    int gridSize,
     uint32_t* newTerrainID);
 
+// hands the terrain's GL objects to Scene::GLPool, releases its transform, then removes it from the scene
+void DestroyTerrain(Scene* scene, uint32_t terrainID);
+
 void ClearTerrains(Scene* scene);
 
+// regenerates the world right away. RequestWorldRegeneration does the same without stalling the frame.
 void GenerateWorld(
         int seed,
         Scene* scene);
@@ -0,0 +1,428 @@
+#include "sculpt.h"
+
+#include "scene.h"
+#include "arena.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace
+{
+    // grid coordinate of world x (rows) or z (columns) on the world terrain, which is at chunk (0, 0)
+    float GetGridCoordinate(int gridSize, float world)
+    {
+        return (world / TERRAIN_WORLD_SIZE + 0.5f) * gridSize;
+    }
+
+    float SampleHeight(int gridSize, const float* heights, float x, float z)
+    {
+        float fi = std::min(std::max(GetGridCoordinate(gridSize, x), 0.0f), (float)gridSize);
+        float fj = std::min(std::max(GetGridCoordinate(gridSize, z), 0.0f), (float)gridSize);
+        int i = std::min((int)fi, gridSize - 1);
+        int j = std::min((int)fj, gridSize - 1);
+        float u = fi - i;
+        float v = fj - j;
+
+        size_t rowVertices = (size_t)gridSize + 1;
+        const float* row = heights + i * rowVertices + j;
+        float h0 = row[0] + (row[1] - row[0]) * v;
+        float h1 = row[rowVertices] + (row[rowVertices + 1] - row[rowVertices]) * v;
+        return h0 + (h1 - h0) * u;
+    }
+
+    // the ray through the cursor, with the projection the renderer uses
+    void GetCursorRay(const Camera& camera, glm::vec2 cursor, float aspect, glm::vec3* origin, glm::vec3* direction)
+    {
+        glm::mat4 worldView = glm::lookAt(camera.Eye, camera.Eye + camera.Look, camera.Up);
+        glm::mat4 viewProjection = glm::perspective(camera.FovY, aspect, 0.01f, 100.0f);
+        glm::mat4 projectionWorld = glm::inverse(viewProjection * worldView);
+
+        glm::vec4 nearPoint = projectionWorld * glm::vec4(cursor, -1.0f, 1.0f);
+        glm::vec4 farPoint = projectionWorld * glm::vec4(cursor, 1.0f, 1.0f);
+        *origin = glm::vec3(nearPoint) / nearPoint.w;
+        *direction = normalize(glm::vec3(farPoint) / farPoint.w - *origin);
+    }
+
+    // where the ray first goes under the heightfield, marching through the terrain's bounding box half a grid square at a time
+    bool IntersectHeightfield(int gridSize, const float* heights, float minHeight, float maxHeight, glm::vec3 origin, glm::vec3 direction, glm::vec3* hit)
+    {
+        glm::vec3 boxMin(-0.5f * TERRAIN_WORLD_SIZE, minHeight, -0.5f * TERRAIN_WORLD_SIZE);
+        glm::vec3 boxMax(0.5f * TERRAIN_WORLD_SIZE, maxHeight, 0.5f * TERRAIN_WORLD_SIZE);
+        float tEnter = 0.0f;
+        float tExit = 100.0f;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (direction[axis] == 0.0f)
+            {
+                if (origin[axis] < boxMin[axis] || origin[axis] > boxMax[axis])
+                {
+                    return false;
+                }
+                continue;
+            }
+            float t0 = (boxMin[axis] - origin[axis]) / direction[axis];
+            float t1 = (boxMax[axis] - origin[axis]) / direction[axis];
+            tEnter = std::max(tEnter, std::min(t0, t1));
+            tExit = std::min(tExit, std::max(t0, t1));
+        }
+        if (tEnter > tExit)
+        {
+            return false;
+        }
+
+        auto below = [&](float t) {
+            glm::vec3 p = origin + direction * t;
+            return p.y <= SampleHeight(gridSize, heights, p.x, p.z);
+        };
+
+        float step = 0.5f * TERRAIN_WORLD_SIZE / gridSize;
+        float tAbove = tEnter;
+        if (below(tAbove))
+        {
+            *hit = origin + direction * tAbove;
+            return true;
+        }
+        for (float t = tEnter + step; t < tExit + step; t += step)
+        {
+            float tBelow = std::min(t, tExit);
+            if (below(tBelow))
+            {
+                // the crossing is between the last two samples
+                for (int k = 0; k < 8; k++)
+                {
+                    float tMiddle = 0.5f * (tAbove + tBelow);
+                    (below(tMiddle) ? tBelow : tAbove) = tMiddle;
+                }
+                *hit = origin + direction * tBelow;
+                return true;
+            }
+            tAbove = tBelow;
+        }
+        return false;
+    }
+
+    void PackHeights(int gridSize, const float* heights, const SculptRect& rect, float minHeight, float maxHeight, void* texels)
+    {
+        size_t rowVertices = (size_t)gridSize + 1;
+        uint16_t* packedHeights = (uint16_t*)texels;
+
+        // rounded like PackTerrainTexels
+        float heightScale = maxHeight > minHeight ? 65535.0f / (maxHeight - minHeight) : 0.0f;
+        for (int i = rect.FirstRow; i < rect.FirstRow + rect.NumRows; i++)
+        {
+            for (int j = rect.FirstColumn; j < rect.FirstColumn + rect.NumColumns; j++)
+            {
+                size_t k = i * rowVertices + j;
+                float height = std::min(std::max((heights[k] - minHeight) * heightScale, 0.0f), 65535.0f);
+                packedHeights[k] = (uint16_t)(height + 0.5f);
+            }
+        }
+    }
+
+    // the vertices whose normals depend on the heights in rect: it, and one more around it
+    SculptRect GetNormalsRect(int gridSize, const SculptRect& rect)
+    {
+        SculptRect normalsRect;
+        normalsRect.FirstColumn = std::max(rect.FirstColumn - 1, 0);
+        normalsRect.FirstRow = std::max(rect.FirstRow - 1, 0);
+        normalsRect.NumColumns = std::min(rect.FirstColumn + rect.NumColumns + 1, gridSize + 1) - normalsRect.FirstColumn;
+        normalsRect.NumRows = std::min(rect.FirstRow + rect.NumRows + 1, gridSize + 1) - normalsRect.FirstRow;
+        return normalsRect;
+    }
+
+    // the world terrain, if there's one to sculpt
+    Terrain* FindSculptableTerrain(Scene* scene, uint32_t* terrainID)
+    {
+        // streamed chunks, and the terrain while the world is being replaced, are left alone
+        if (scene->TerrainChunks.Enabled ||
+            scene->WorldRegen.CurrentStage != WorldRegeneration::Idle || scene->WorldRegen.HasPendingRequest)
+        {
+            return nullptr;
+        }
+
+        // the water has vertex buffers rather than a heightfield
+        for (uint32_t id : scene->Terrains)
+        {
+            Terrain& terrain = scene->Terrains[id];
+            if (terrain.HeightTO && terrain.PreviewStep == 1)
+            {
+                *terrainID = id;
+                return &terrain;
+            }
+        }
+        return nullptr;
+    }
+
+    void ReleaseSculptHeightfield(TerrainSculpt* sculpt)
+    {
+        sculpt->TerrainID = (uint32_t)-1;
+        sculpt->GridSize = 0;
+        sculpt->Stroking = false;
+        sculpt->HasTarget = false;
+        std::vector<float>().swap(sculpt->Heights);
+        std::vector<uint8_t>().swap(sculpt->Texels);
+    }
+
+    void LoadSculptHeightfield(TerrainSculpt* sculpt, uint32_t terrainID, const Terrain& terrain)
+    {
+        int gridSize = terrain.gridSize;
+        size_t numVertices = (size_t)(gridSize+1) * (gridSize+1);
+
+        sculpt->TerrainID = terrainID;
+        sculpt->GridSize = gridSize;
+        sculpt->Stroking = false;
+        sculpt->Texels.resize(GetTerrainTexelBytes(gridSize));
+        sculpt->Heights.resize(numVertices);
+
+        ReadTerrainTexels(terrain, sculpt->Texels.data());
+
+        const uint16_t* packedHeights = (const uint16_t*)sculpt->Texels.data();
+        float heightScale = (terrain.MaxHeight - terrain.MinHeight) / 65535.0f;
+        for (size_t k = 0; k < numVertices; k++)
+        {
+            sculpt->Heights[k] = terrain.MinHeight + packedHeights[k] * heightScale;
+        }
+    }
+
+    // widens the terrain's height range to fit heights in rect, repacking all of the heights if it has to.
+    // returns whether it did.
+    bool FitHeightRange(TerrainSculpt* sculpt, Terrain* terrain, const SculptRect& rect)
+    {
+        size_t rowVertices = (size_t)sculpt->GridSize + 1;
+        float low = terrain->MinHeight;
+        float high = terrain->MaxHeight;
+        for (int i = rect.FirstRow; i < rect.FirstRow + rect.NumRows; i++)
+        {
+            for (int j = rect.FirstColumn; j < rect.FirstColumn + rect.NumColumns; j++)
+            {
+                float height = sculpt->Heights[i * rowVertices + j];
+                low = std::min(low, height);
+                high = std::max(high, height);
+            }
+        }
+        if (low >= terrain->MinHeight && high <= terrain->MaxHeight)
+        {
+            return false;
+        }
+
+        // room for a while of sculpting in the same direction. The 16-bit steps get a little coarser each time.
+        float headroom = 0.125f * (high - low);
+        if (low < terrain->MinHeight)
+        {
+            terrain->MinHeight = low - headroom;
+        }
+        if (high > terrain->MaxHeight)
+        {
+            terrain->MaxHeight = high + headroom;
+        }
+
+        SculptRect grid;
+        grid.NumColumns = sculpt->GridSize + 1;
+        grid.NumRows = sculpt->GridSize + 1;
+        PackHeights(sculpt->GridSize, sculpt->Heights.data(), grid, terrain->MinHeight, terrain->MaxHeight, sculpt->Texels.data());
+        sculpt->NumRangeWidenings++;
+        return true;
+    }
+}
+
+SculptRect SculptHeights(int gridSize, float* heights, SculptBrush brush, glm::vec2 center, float radius, float amount, float flattenHeight)
+{
+    SculptRect rect;
+
+    // the brush in grid coordinates
+    float centerI = GetGridCoordinate(gridSize, center.x);
+    float centerJ = GetGridCoordinate(gridSize, center.y);
+    float gridRadius = radius * gridSize / TERRAIN_WORLD_SIZE;
+
+    int firstRow = std::max((int)std::ceil(centerI - gridRadius), 0);
+    int lastRow = std::min((int)std::floor(centerI + gridRadius), gridSize);
+    int firstColumn = std::max((int)std::ceil(centerJ - gridRadius), 0);
+    int lastColumn = std::min((int)std::floor(centerJ + gridRadius), gridSize);
+    if (firstRow > lastRow || firstColumn > lastColumn || gridRadius <= 0.0f)
+    {
+        return rect;
+    }
+
+    rect.FirstColumn = firstColumn;
+    rect.FirstRow = firstRow;
+    rect.NumColumns = lastColumn - firstColumn + 1;
+    rect.NumRows = lastRow - firstRow + 1;
+
+    size_t rowVertices = (size_t)gridSize + 1;
+
+    // smoothing averages the heights from before this edit, so it's the same in any order
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+    SculptRect sourceRect = GetNormalsRect(gridSize, rect);
+    float* source = nullptr;
+    if (brush == SculptBrush::Smooth)
+    {
+        source = scratch.Allocate<float>((size_t)sourceRect.NumColumns * sourceRect.NumRows);
+        for (int i = 0; i < sourceRect.NumRows; i++)
+        {
+            const float* row = heights + (sourceRect.FirstRow + i) * rowVertices + sourceRect.FirstColumn;
+            std::copy(row, row + sourceRect.NumColumns, source + (size_t)i * sourceRect.NumColumns);
+        }
+    }
+
+    float inverseRadiusSquared = 1.0f / (gridRadius * gridRadius);
+    for (int i = firstRow; i <= lastRow; i++)
+    {
+        for (int j = firstColumn; j <= lastColumn; j++)
+        {
+            float di = i - centerI;
+            float dj = j - centerJ;
+            float distanceSquared = (di * di + dj * dj) * inverseRadiusSquared;
+            if (distanceSquared >= 1.0f)
+            {
+                continue;
+            }
+            // (1 - d^2)^2 falls off smoothly to 0 at the radius
+            float weight = (1.0f - distanceSquared) * (1.0f - distanceSquared);
+
+            float& height = heights[i * rowVertices + j];
+            switch (brush)
+            {
+            case SculptBrush::Raise:
+                height += amount * weight;
+                break;
+            case SculptBrush::Lower:
+                height -= amount * weight;
+                break;
+            case SculptBrush::Smooth:
+            {
+                // the 3x3 neighbourhood, clamped to the grid
+                int si = i - sourceRect.FirstRow;
+                int sj = j - sourceRect.FirstColumn;
+                float sum = 0.0f;
+                int count = 0;
+                for (int ni = std::max(si - 1, 0); ni <= std::min(si + 1, sourceRect.NumRows - 1); ni++)
+                {
+                    for (int nj = std::max(sj - 1, 0); nj <= std::min(sj + 1, sourceRect.NumColumns - 1); nj++)
+                    {
+                        sum += source[(size_t)ni * sourceRect.NumColumns + nj];
+                        count++;
+                    }
+                }
+                height += (sum / count - height) * std::min(amount * weight, 1.0f);
+                break;
+            }
+            case SculptBrush::Flatten:
+                height += (flattenHeight - height) * std::min(amount * weight, 1.0f);
+                break;
+            }
+        }
+    }
+
+    return rect;
+}
+
+void PackSculptedTexels(int gridSize, const float* heights, const SculptRect& rect, float minHeight, float maxHeight, void* texels)
+{
+    size_t rowVertices = (size_t)gridSize + 1;
+    size_t numVertices = rowVertices * rowVertices;
+    int8_t (*packedNormals)[2] = (int8_t(*)[2])((uint16_t*)texels + numVertices);
+
+    PackHeights(gridSize, heights, rect, minHeight, maxHeight, texels);
+
+    // central differences, one-sided at the grid's edges. The normal of the surface y = h(x, z) is (-dh/dx, 1, -dh/dz),
+    // where x goes along the rows and z along the columns.
+    float spacing = TERRAIN_WORLD_SIZE / gridSize;
+    for (int i = rect.FirstRow; i < rect.FirstRow + rect.NumRows; i++)
+    {
+        int previousRow = std::max(i - 1, 0);
+        int nextRow = std::min(i + 1, gridSize);
+        for (int j = rect.FirstColumn; j < rect.FirstColumn + rect.NumColumns; j++)
+        {
+            int previousColumn = std::max(j - 1, 0);
+            int nextColumn = std::min(j + 1, gridSize);
+
+            float dhdx = (heights[nextRow * rowVertices + j] - heights[previousRow * rowVertices + j]) / ((nextRow - previousRow) * spacing);
+            float dhdz = (heights[i * rowVertices + nextColumn] - heights[i * rowVertices + previousColumn]) / ((nextColumn - previousColumn) * spacing);
+            glm::vec3 normal = normalize(glm::vec3(-dhdx, 1.0f, -dhdz));
+
+            // rounded like PackTerrainTexels
+            size_t k = i * rowVertices + j;
+            packedNormals[k][0] = (int8_t)lroundf(normal.x * 127.0f);
+            packedNormals[k][1] = (int8_t)lroundf(normal.z * 127.0f);
+        }
+    }
+}
+
+void UpdateTerrainSculpt(Scene* scene, glm::vec2 cursor, float aspect, bool apply, float deltaTime)
+{
+    TerrainSculpt& sculpt = scene->Sculpt;
+
+    uint32_t terrainID;
+    Terrain* terrain = sculpt.Enabled ? FindSculptableTerrain(scene, &terrainID) : nullptr;
+    if (!terrain)
+    {
+        // regenerating the world drops the edits, so the heights are read back again after
+        if (sculpt.TerrainID != (uint32_t)-1)
+        {
+            ReleaseSculptHeightfield(&sculpt);
+        }
+        return;
+    }
+    if (sculpt.TerrainID != terrainID)
+    {
+        LoadSculptHeightfield(&sculpt, terrainID, *terrain);
+    }
+
+    int gridSize = sculpt.GridSize;
+
+    glm::vec3 origin, direction;
+    GetCursorRay(scene->MainCamera, cursor, aspect, &origin, &direction);
+    sculpt.HasTarget = IntersectHeightfield(gridSize, sculpt.Heights.data(), terrain->MinHeight, terrain->MaxHeight, origin, direction, &sculpt.Target);
+
+    if (!apply)
+    {
+        // the adaptive mesh was made for the heights before the stroke
+        if (sculpt.Stroking && terrain->AdaptiveMesh)
+        {
+            std::vector<uint32_t> indices;
+            BuildTerrainAdaptiveIndices(gridSize, sculpt.Texels.data(), terrain->MinHeight, terrain->MaxHeight, scene->TerrainMeshMaxError, &indices);
+            SetTerrainAdaptiveIndices(scene, terrain, indices);
+        }
+        sculpt.Stroking = false;
+        return;
+    }
+    if (!sculpt.HasTarget)
+    {
+        return;
+    }
+    if (!sculpt.Stroking)
+    {
+        sculpt.Stroking = true;
+        sculpt.FlattenHeight = sculpt.Target.y;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    glm::vec2 center(sculpt.Target.x, sculpt.Target.z);
+    SculptRect rect = SculptHeights(gridSize, sculpt.Heights.data(), sculpt.Brush, center, sculpt.Radius, sculpt.Strength * deltaTime, sculpt.FlattenHeight);
+    if (rect.NumColumns == 0)
+    {
+        return;
+    }
+
+    // the normals around the changed heights change too
+    SculptRect uploadRect = GetNormalsRect(gridSize, rect);
+    bool widened = FitHeightRange(&sculpt, terrain, rect);
+    PackSculptedTexels(gridSize, sculpt.Heights.data(), uploadRect, terrain->MinHeight, terrain->MaxHeight, sculpt.Texels.data());
+    if (widened)
+    {
+        UploadTerrainRows(*terrain, 0, gridSize + 1, 0, sculpt.Texels.data());
+    }
+    else
+    {
+        UploadTerrainRect(*terrain, uploadRect.FirstColumn, uploadRect.FirstRow, uploadRect.NumColumns, uploadRect.NumRows, 0, sculpt.Texels.data());
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    sculpt.LastEditVertices = uploadRect.NumColumns * uploadRect.NumRows;
+    sculpt.LastEditMs = std::chrono::duration<float, std::milli>(end - start).count();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class Scene;
+
+enum class SculptBrush
+{
+    Raise,
+    Lower,
+    // moves the heights towards the average of their neighbours
+    Smooth,
+    // moves the heights towards the height under the brush when the stroke started
+    Flatten
+};
+
+// rectangle of grid vertices, rows [FirstRow, FirstRow + NumRows) and columns [FirstColumn, FirstColumn + NumColumns).
+// row i and column j are vertex i * (gridSize+1) + j, like the terrain textures.
+struct SculptRect
+{
+    int FirstColumn = 0;
+    int FirstRow = 0;
+    int NumColumns = 0;
+    int NumRows = 0;
+};
+
+// Brush editing of the world terrain (the one GenerateTerrainMesh makes), without regenerating it.
+// The heights are kept on the CPU as floats, read back from the terrain's textures when sculpting is turned on. Each frame of
+// a stroke changes the heights under the brush, recomputes the normals of those vertices and their neighbours, and packs and
+// uploads just that rectangle of the textures, so an edit costs as much as the brush is big, whatever the grid size.
+// Heights outside of the terrain's [MinHeight, MaxHeight] widen the range, which repacks and uploads all of the heights
+// (with some headroom, so it's rare). An adaptive mesh is rebuilt when the stroke ends.
+// Streamed chunks can't be sculpted, and the edits are gone when the world is regenerated.
+struct TerrainSculpt
+{
+    // while on, the left mouse button applies the brush
+    bool Enabled = false;
+    SculptBrush Brush = SculptBrush::Raise;
+    // world-space radius of the brush. Its weight falls off smoothly from 1 at the center to 0 there.
+    float Radius = 0.75f;
+    // for Raise and Lower, world units per second at the brush's center.
+    // For Smooth and Flatten, how fast the heights move towards their target (about all the way in 1 / Strength seconds).
+    float Strength = 1.0f;
+
+    // where the cursor's ray hits the terrain, if it does
+    bool HasTarget = false;
+    glm::vec3 Target;
+
+    // the terrain being sculpted, or (uint32_t)-1. Its heights, and its texels packed like PackTerrainTexels does.
+    uint32_t TerrainID = (uint32_t)-1;
+    int GridSize = 0;
+    std::vector<float> Heights;
+    std::vector<uint8_t> Texels;
+
+    // whether a stroke is in progress, and the height it flattens to
+    bool Stroking = false;
+    float FlattenHeight = 0.0f;
+
+    // vertices changed by the last frame of a stroke, and how long that took (including the upload)
+    int LastEditVertices = 0;
+    float LastEditMs = 0.0f;
+    // number of times an edit went outside of the height range
+    int NumRangeWidenings = 0;
+};
+
+// picks the brush's target under the cursor, given in normalized device coordinates of a view with the aspect ratio,
+// and applies the brush while apply is on. Call once per frame.
+void UpdateTerrainSculpt(Scene* scene, glm::vec2 cursor, float aspect, bool apply, float deltaTime);
+
+// applies a brush centered at world (x, z) = center to a (gridSize+1)^2 heightfield of the world terrain,
+// with amount = Strength * deltaTime. returns the rectangle of vertices whose heights may have changed.
+SculptRect SculptHeights(
+    int gridSize,
+    float* heights,
+    SculptBrush brush,
+    glm::vec2 center,
+    float radius,
+    float amount,
+    float flattenHeight);
+
+// packs the heights, and normals computed from the heights around them, of the vertices in rect into texels
+// (all the grid's, packed like PackTerrainTexels). The heights should be within [minHeight, maxHeight].
+void PackSculptedTexels(
+    int gridSize,
+    const float* heights,
+    const SculptRect& rect,
+    float minHeight,
+    float maxHeight,
+    void* texels);
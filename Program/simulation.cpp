@@ -120,6 +120,15 @@ void Simulation::Update(float deltaTime)
 	mDeltaMouseX = 0;
 	mDeltaMouseY = 0;
 
+    UpdateWorldRegeneration(mScene);
+    UpdateTerrainChunks(mScene);
+
+    // the left mouse button sculpts, unless it's over a window
+    ImGuiIO& io = ImGui::GetIO();
+    glm::vec2 cursor(2.0f * mx / io.DisplaySize.x - 1.0f, 1.0f - 2.0f * my / io.DisplaySize.y);
+    bool sculpting = (mouse & SDL_BUTTON(SDL_BUTTON_LEFT)) != 0 && !io.WantCaptureMouse;
+    UpdateTerrainSculpt(mScene, cursor, io.DisplaySize.x / io.DisplaySize.y, sculpting, deltaTime);
+
 	//mScene->MainCamera.Pi_rollercoaster
 	if (ImGui::Begin("Catmull-Rom Spline"))
 	{
@@ -0,0 +1,367 @@
+#include "spectral.h"
+
+#include "arena.h"
+#include "noise.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define SPECTRAL_X86 1
+#include <emmintrin.h>
+#endif
+
+static const double kPi = 3.14159265358979323846;
+
+// columns transformed together by InverseColumns. 16 floats is one cache line of each of the real and imaginary parts.
+#define FFT_COLUMN_STRIP 16
+
+int NextPowerOfTwo(int n)
+{
+    int size = 1;
+    while (size < n)
+    {
+        size *= 2;
+    }
+    return size;
+}
+
+// count butterflies between u and v, each with its own twiddle w: (u, v) = (u + w v, u - w v)
+static inline void Butterflies(float* ur, float* ui, float* vr, float* vi, const float* wr, const float* wi, int count)
+{
+    int k = 0;
+#ifdef SPECTRAL_X86
+    for (; k + 4 <= count; k += 4)
+    {
+        __m128 vr4 = _mm_loadu_ps(vr + k);
+        __m128 vi4 = _mm_loadu_ps(vi + k);
+        __m128 wr4 = _mm_loadu_ps(wr + k);
+        __m128 wi4 = _mm_loadu_ps(wi + k);
+        __m128 tr = _mm_sub_ps(_mm_mul_ps(vr4, wr4), _mm_mul_ps(vi4, wi4));
+        __m128 ti = _mm_add_ps(_mm_mul_ps(vr4, wi4), _mm_mul_ps(vi4, wr4));
+        __m128 ur4 = _mm_loadu_ps(ur + k);
+        __m128 ui4 = _mm_loadu_ps(ui + k);
+        _mm_storeu_ps(vr + k, _mm_sub_ps(ur4, tr));
+        _mm_storeu_ps(vi + k, _mm_sub_ps(ui4, ti));
+        _mm_storeu_ps(ur + k, _mm_add_ps(ur4, tr));
+        _mm_storeu_ps(ui + k, _mm_add_ps(ui4, ti));
+    }
+#endif
+    for (; k < count; k++)
+    {
+        float tr = vr[k] * wr[k] - vi[k] * wi[k];
+        float ti = vr[k] * wi[k] + vi[k] * wr[k];
+        vr[k] = ur[k] - tr;
+        vi[k] = ui[k] - ti;
+        ur[k] += tr;
+        ui[k] += ti;
+    }
+}
+
+// the same, with one twiddle for all of them
+static inline void Butterflies(float* ur, float* ui, float* vr, float* vi, float wr, float wi, int count)
+{
+    int k = 0;
+#ifdef SPECTRAL_X86
+    __m128 wr4 = _mm_set1_ps(wr);
+    __m128 wi4 = _mm_set1_ps(wi);
+    for (; k + 4 <= count; k += 4)
+    {
+        __m128 vr4 = _mm_loadu_ps(vr + k);
+        __m128 vi4 = _mm_loadu_ps(vi + k);
+        __m128 tr = _mm_sub_ps(_mm_mul_ps(vr4, wr4), _mm_mul_ps(vi4, wi4));
+        __m128 ti = _mm_add_ps(_mm_mul_ps(vr4, wi4), _mm_mul_ps(vi4, wr4));
+        __m128 ur4 = _mm_loadu_ps(ur + k);
+        __m128 ui4 = _mm_loadu_ps(ui + k);
+        _mm_storeu_ps(vr + k, _mm_sub_ps(ur4, tr));
+        _mm_storeu_ps(vi + k, _mm_sub_ps(ui4, ti));
+        _mm_storeu_ps(ur + k, _mm_add_ps(ur4, tr));
+        _mm_storeu_ps(ui + k, _mm_add_ps(ui4, ti));
+    }
+#endif
+    for (; k < count; k++)
+    {
+        float tr = vr[k] * wr - vi[k] * wi;
+        float ti = vr[k] * wi + vi[k] * wr;
+        vr[k] = ur[k] - tr;
+        vi[k] = ui[k] - ti;
+        ur[k] += tr;
+        ui[k] += ti;
+    }
+}
+
+FFTPlan::FFTPlan(int size)
+    : mSize(size)
+    , mTwiddlesReal(std::max(size, 2))
+    , mTwiddlesImaginary(std::max(size, 2))
+    , mBitReverse(size)
+{
+    for (int half = 1; half < size; half *= 2)
+    {
+        for (int k = 0; k < half; k++)
+        {
+            double angle = kPi * k / half;
+            mTwiddlesReal[half + k] = (float)cos(angle);
+            mTwiddlesImaginary[half + k] = (float)sin(angle);
+        }
+    }
+
+    int bits = 0;
+    while ((1 << bits) < size)
+    {
+        bits++;
+    }
+    for (int i = 0; i < size; i++)
+    {
+        uint32_t reversed = 0;
+        for (int b = 0; b < bits; b++)
+        {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        mBitReverse[i] = reversed;
+    }
+}
+
+void FFTPlan::Inverse(float* real, float* imaginary) const
+{
+    for (int i = 0; i < mSize; i++)
+    {
+        int j = (int)mBitReverse[i];
+        if (i < j)
+        {
+            std::swap(real[i], real[j]);
+            std::swap(imaginary[i], imaginary[j]);
+        }
+    }
+
+    // iterative Cooley-Tukey
+    for (int half = 1; half < mSize; half *= 2)
+    {
+        for (int start = 0; start < mSize; start += 2 * half)
+        {
+            Butterflies(real + start, imaginary + start, real + start + half, imaginary + start + half,
+                &mTwiddlesReal[half], &mTwiddlesImaginary[half], half);
+        }
+    }
+}
+
+void FFTPlan::InverseColumns(float* real, float* imaginary, size_t rowStride, int numColumns) const
+{
+    // the same butterflies as Inverse, between whole row segments, so the inner loops run along the rows
+    for (int i = 0; i < mSize; i++)
+    {
+        int j = (int)mBitReverse[i];
+        if (i < j)
+        {
+            std::swap_ranges(real + i * rowStride, real + i * rowStride + numColumns, real + j * rowStride);
+            std::swap_ranges(imaginary + i * rowStride, imaginary + i * rowStride + numColumns, imaginary + j * rowStride);
+        }
+    }
+
+    for (int half = 1; half < mSize; half *= 2)
+    {
+        for (int start = 0; start < mSize; start += 2 * half)
+        {
+            for (int k = 0; k < half; k++)
+            {
+                size_t u = (start + k) * rowStride;
+                size_t v = (start + k + half) * rowStride;
+                Butterflies(real + u, imaginary + u, real + v, imaginary + v,
+                    mTwiddlesReal[half + k], mTwiddlesImaginary[half + k], numColumns);
+            }
+        }
+    }
+}
+
+void FFTPlan::Inverse2D(float* real, float* imaginary, int bandwidth, int maxThreads) const
+{
+    // rows [0, bandwidth] and [size - bandwidth, size) are the nonzero wavenumbers
+    int numLowRows = std::min(bandwidth + 1, mSize);
+    int numHighRows = std::min(bandwidth, mSize - numLowRows);
+    GetThreadPool().ParallelFor(numLowRows + numHighRows, maxThreads, [&](int n) {
+        int row = n < numLowRows ? n : mSize - numHighRows + (n - numLowRows);
+        Inverse(real + (size_t)row * mSize, imaginary + (size_t)row * mSize);
+    });
+
+    // then the columns, in strips of adjacent columns. Each strip is copied out to a contiguous buffer first:
+    // the rows are a power of two floats apart, so in place every row of a strip would land in the same few cache sets.
+    int numStrips = (mSize + FFT_COLUMN_STRIP - 1) / FFT_COLUMN_STRIP;
+    GetThreadPool().ParallelFor(numStrips, maxThreads, [&](int strip) {
+        int firstColumn = strip * FFT_COLUMN_STRIP;
+        int numColumns = std::min(FFT_COLUMN_STRIP, mSize - firstColumn);
+
+        ScratchArena& scratch = GetScratchArena();
+        ScratchScope scratchScope(scratch);
+        float* stripReal = scratch.Allocate<float>((size_t)mSize * FFT_COLUMN_STRIP);
+        float* stripImaginary = scratch.Allocate<float>((size_t)mSize * FFT_COLUMN_STRIP);
+
+        for (int row = 0; row < mSize; row++)
+        {
+            float* toReal = stripReal + (size_t)row * FFT_COLUMN_STRIP;
+            float* toImaginary = stripImaginary + (size_t)row * FFT_COLUMN_STRIP;
+            if (row >= numLowRows && row < mSize - numHighRows)
+            {
+                std::fill(toReal, toReal + numColumns, 0.0f);
+                std::fill(toImaginary, toImaginary + numColumns, 0.0f);
+                continue;
+            }
+
+            size_t offset = (size_t)row * mSize + firstColumn;
+            std::copy(real + offset, real + offset + numColumns, toReal);
+            std::copy(imaginary + offset, imaginary + offset + numColumns, toImaginary);
+        }
+
+        InverseColumns(stripReal, stripImaginary, FFT_COLUMN_STRIP, numColumns);
+
+        for (int row = 0; row < mSize; row++)
+        {
+            size_t offset = (size_t)row * mSize + firstColumn;
+            std::copy(stripReal + (size_t)row * FFT_COLUMN_STRIP, stripReal + (size_t)row * FFT_COLUMN_STRIP + numColumns, real + offset);
+            std::copy(stripImaginary + (size_t)row * FFT_COLUMN_STRIP, stripImaginary + (size_t)row * FFT_COLUMN_STRIP + numColumns, imaginary + offset);
+        }
+    });
+}
+
+// unit-variance gaussian real and imaginary parts for wavenumber (kx, ky), from the seed's key.
+// only called for half of the wavenumbers (ky > 0, or ky == 0 and kx > 0): -k gets the conjugate, so the spectrum is Hermitian and its transform is real.
+static void GetSpectralCoefficient(uint64_t key, int kx, int ky, float* real, float* imaginary)
+{
+    // two numbers per wavenumber, for Box-Muller
+    uint64_t counter = (((uint64_t)(uint16_t)kx << 16) | (uint16_t)ky) * 2;
+    float u1 = (float)((SquaresRandom(counter, key) + 0.5) / 4294967296.0);
+    float u2 = (float)(SquaresRandom(counter + 1, key) / 4294967296.0);
+
+    float radius = sqrtf(-2.0f * logf(u1));
+    float angle = (float)(2.0 * kPi) * u2;
+    *real = radius * cosf(angle);
+    *imaginary = radius * sinf(angle);
+}
+
+void GenerateSpectralHeightfield(uint32_t seed, double H, double lacunarity, int octaves, int gridSize, float* value, float* valueDx, float* valueDy, int maxThreads)
+{
+    int size = NextPowerOfTwo(gridSize);
+    size_t numSamples = (size_t)size * size;
+    FFTPlan plan(size);
+
+    // the Nyquist wavenumber is left out along with everything above it, since it has no conjugate to pair with
+    double cutoff = std::min(pow(lacunarity, octaves), size * 0.5 - 1.0);
+    int bandwidth = (int)cutoff;
+    float exponent = (float)(-(H + 1.0) * 0.5);
+    uint64_t key = MakeRandomKey(seed);
+
+    // the height and its x derivative come out of one transform, as the real and imaginary parts of
+    // the transform of S(k) (1 - 2 pi kx), since d/dx multiplies coefficient k by 2 pi i kx.
+    // the y derivative gets a transform of its own, whose imaginary part comes out zero.
+    // rows outside the bandwidth are never read, so they're left uninitialized
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+    float* height = scratch.Allocate<float>(numSamples);
+    float* heightDx = scratch.Allocate<float>(numSamples);
+    float* heightDy = scratch.Allocate<float>(numSamples);
+    float* heightDyImaginary = scratch.Allocate<float>(numSamples);
+
+    // sum of the squared amplitudes of each job, for the normalization. Summed in order afterwards, so it doesn't depend on the threads.
+    std::vector<double> jobVariance(2 * bandwidth + 1);
+
+    // wavenumber k is FFT index k mod size. Only the rows within the bandwidth have any coefficients.
+    GetThreadPool().ParallelFor(2 * bandwidth + 1, maxThreads, [&](int n) {
+        size_t row = (size_t)((n - bandwidth + size) % size) * size;
+        for (float* plane : { height, heightDx, heightDy, heightDyImaginary })
+        {
+            std::fill(plane + row, plane + row + size, 0.0f);
+        }
+    });
+
+    GetThreadPool().ParallelFor(2 * bandwidth + 1, maxThreads, [&](int n) {
+        int kx = n - bandwidth;
+
+        auto store = [&](int kx, int ky, float sr, float si) {
+            float dx = (float)(2.0 * kPi * kx);
+            float dy = (float)(2.0 * kPi * ky);
+            size_t index = (size_t)((kx + size) % size) * size + (ky + size) % size;
+            height[index] = sr * (1.0f - dx);
+            heightDx[index] = si * (1.0f - dx);
+            heightDy[index] = -si * dy;
+            heightDyImaginary[index] = sr * dy;
+        };
+
+        // this job makes the half-plane wavenumbers of its row, and their conjugates in row -kx
+        double variance = 0.0;
+        for (int ky = kx > 0 ? 0 : 1; ky <= bandwidth; ky++)
+        {
+            float k2 = (float)kx * kx + (float)ky * ky;
+            if (k2 > cutoff * cutoff)
+            {
+                break;
+            }
+
+            float amplitude = powf(k2, exponent);
+            float sr, si;
+            GetSpectralCoefficient(key, kx, ky, &sr, &si);
+            store(kx, ky, sr * amplitude, si * amplitude);
+            store(-kx, -ky, sr * amplitude, -si * amplitude);
+            variance += 4.0 * (double)amplitude * amplitude;
+        }
+        jobVariance[n] = variance;
+    });
+
+    double variance = 0.0;
+    for (double v : jobVariance)
+    {
+        variance += v;
+    }
+    float scale = variance > 0.0 ? (float)(1.0 / sqrt(variance)) : 0.0f;
+
+    plan.Inverse2D(height, heightDx, bandwidth, maxThreads);
+    plan.Inverse2D(heightDy, heightDyImaginary, bandwidth, maxThreads);
+
+    // grid vertex (i, j) is FFT sample (i, j) * size / gridSize, wrapped, since the heightfield is periodic.
+    // Bilinear when the grid size isn't the FFT size.
+    int rowLength = gridSize + 1;
+    GetThreadPool().ParallelFor(rowLength, maxThreads, [&](int i) {
+        float* rowValue = value + (size_t)i * rowLength;
+        float* rowValueDx = valueDx + (size_t)i * rowLength;
+        float* rowValueDy = valueDy + (size_t)i * rowLength;
+
+        if (size == gridSize)
+        {
+            const float* h = height + (size_t)(i % size) * size;
+            const float* hx = heightDx + (size_t)(i % size) * size;
+            const float* hy = heightDy + (size_t)(i % size) * size;
+            for (int j = 0; j < rowLength; j++)
+            {
+                int q = j % size;
+                rowValue[j] = h[q] * scale;
+                rowValueDx[j] = hx[q] * scale;
+                rowValueDy[j] = hy[q] * scale;
+            }
+            return;
+        }
+
+        double x = (double)i * size / gridSize;
+        int x0 = (int)x;
+        float fx = (float)(x - x0);
+        size_t p0 = (size_t)(x0 % size) * size;
+        size_t p1 = (size_t)((x0 + 1) % size) * size;
+
+        for (int j = 0; j < rowLength; j++)
+        {
+            double y = (double)j * size / gridSize;
+            int y0 = (int)y;
+            float fy = (float)(y - y0);
+            int q0 = y0 % size;
+            int q1 = (y0 + 1) % size;
+
+            auto lerp = [&](const float* grid) {
+                float near = grid[p0 + q0] * (1.0f - fy) + grid[p0 + q1] * fy;
+                float far = grid[p1 + q0] * (1.0f - fy) + grid[p1 + q1] * fy;
+                return (near * (1.0f - fx) + far * fx) * scale;
+            };
+
+            rowValue[j] = lerp(height);
+            rowValueDx[j] = lerp(heightDx);
+            rowValueDy[j] = lerp(heightDy);
+        }
+    });
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Spectral synthesis of fractal terrain, from "Procedural Fractal Terrains", F. Kenton Musgrave (the Fourier synthesis section).
+//
+// Instead of summing octaves of a basis noise at every vertex (O(N^2 * octaves), with the permutation table lookups
+// scattered all over memory), the heightfield is built in the frequency domain: every wavenumber gets a random
+// coefficient whose amplitude falls off as a power law, and one inverse 2D FFT turns them into heights.
+// That costs at most O(N^2 log N) whatever the octave count (fewer octaves leave more of the spectrum empty, which the FFT skips),
+// and its passes stream through memory.
+//
+// The result is periodic over the FFT grid, which covers one chunk, so neighbouring chunks tile without seams
+// (but repeat each other).
+
+// in-place radix-2 complex FFT of one power of two size.
+// Data is split into separate real and imaginary arrays, so the butterflies run over contiguous floats.
+class FFTPlan
+{
+    int mSize = 0;
+    // twiddles of the butterfly stages: stage half (1, 2, 4, ... size / 2) uses [half, 2 * half), e^(2 pi i k / (2 half)) at half + k
+    std::vector<float> mTwiddlesReal;
+    std::vector<float> mTwiddlesImaginary;
+    // index that element i swaps with before the butterflies
+    std::vector<uint32_t> mBitReverse;
+
+public:
+    // size must be a power of two
+    explicit FFTPlan(int size);
+
+    int GetSize() const { return mSize; }
+
+    // unnormalized inverse transform of one contiguous sequence: x[n] = sum over k of X[k] e^(2 pi i k n / size)
+    void Inverse(float* real, float* imaginary) const;
+
+    // inverse transforms of numColumns adjacent columns of a row-major grid with rows of rowStride floats
+    void InverseColumns(float* real, float* imaginary, size_t rowStride, int numColumns) const;
+
+    // inverse transform of a size x size row-major grid, spread over up to maxThreads threads.
+    // rows whose wavenumber is above bandwidth are taken to be zero (as in a band-limited spectrum): they're skipped by the row transforms
+    // and never read, so they don't need to be initialized.
+    void Inverse2D(float* real, float* imaginary, int bandwidth, int maxThreads) const;
+};
+
+// the smallest power of two >= n
+int NextPowerOfTwo(int n);
+
+// fills the (gridSize+1)^2 samples of a spectral heightfield covering one chunk, and its derivatives by the noise space x and y.
+// sample i * (gridSize+1) + j is at noise space (i, j) / gridSize, the layout of the terrain's vertices.
+//
+// the amplitude of wavenumber k (in cycles per chunk) falls off as k^-(H + 1), the spectrum of fBm with the same H,
+// and wavenumbers above lacunarity^octaves are left out, like the detail a fractal of that many octaves doesn't reach.
+// The heights have a mean of 0 and a standard deviation of about 1.
+//
+// the FFT runs at the next power of two >= gridSize. Other grid sizes are resampled from it.
+// The coefficients only depend on the seed and their wavenumber, so every grid size shows the same landscape,
+// and the result is the same for any number of threads.
+void GenerateSpectralHeightfield(
+    uint32_t seed,
+    double H,
+    double lacunarity,
+    int octaves,
+    int gridSize,
+    float* value,
+    float* valueDx,
+    float* valueDy,
+    int maxThreads);
@@ -0,0 +1,253 @@
+#include "terrain_cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// "THFC" in a hex dump
+#define TERRAIN_CACHE_MAGIC 0x43464854
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const char* path)
+{
+    Close();
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    mFile = file;
+    mMapping = mapping;
+    mData = data;
+    mSize = (size_t)size.QuadPart;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (mData)
+    {
+        UnmapViewOfFile(mData);
+        CloseHandle(mMapping);
+        CloseHandle(mFile);
+    }
+    mData = nullptr;
+    mSize = 0;
+    mMapping = nullptr;
+    mFile = nullptr;
+}
+#else
+bool MappedFile::Open(const char* path)
+{
+    Close();
+
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0)
+    {
+        close(file);
+        return false;
+    }
+
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    // the mapping keeps the file open
+    close(file);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    // it's read front to back, once
+    madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+    mData = data;
+    mSize = (size_t)info.st_size;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (mData)
+    {
+        munmap(mData, mSize);
+    }
+    mData = nullptr;
+    mSize = 0;
+}
+#endif
+
+static size_t GetHeightfieldBytes(size_t numVertices)
+{
+    return sizeof(TerrainCacheHeader) + numVertices * TERRAIN_CACHE_BYTES_PER_VERTEX;
+}
+
+bool MakeCacheDirectory(const std::string& path)
+{
+#ifdef _WIN32
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+// (not ReplaceFile, which windows.h defines as a macro)
+bool ReplaceCacheFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+TerrainHeightfieldCache::TerrainHeightfieldCache(const std::string& directory)
+    : mDirectory(directory)
+{ }
+
+std::string TerrainHeightfieldCache::GetPath(const TerrainCacheKey& key) const
+{
+    // the parameters that aren't obvious from the rest of the name are hashed (FNV-1a), to keep it short
+    uint32_t hash = 2166136261u;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&key);
+    for (size_t i = 0; i < sizeof(key); i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+
+    char name[128];
+    snprintf(name, sizeof(name), "/seed%u_grid%d_chunk%d_%d_%08x.bin",
+        key.Seed, key.GridSize, key.ChunkX, key.ChunkZ, hash);
+    return mDirectory + name;
+}
+
+bool TerrainHeightfieldCache::Load(const TerrainCacheKey& key, CachedHeightfield* heightfield)
+{
+    std::string path = GetPath(key);
+    MappedFile& file = heightfield->File;
+    if (!file.Open(path.c_str()))
+    {
+        NumMisses++;
+        return false;
+    }
+
+    size_t numVertices = (size_t)(key.GridSize + 1) * (key.GridSize + 1);
+    const TerrainCacheHeader* header = static_cast<const TerrainCacheHeader*>(file.GetData());
+
+    bool valid = file.GetSize() == GetHeightfieldBytes(numVertices) &&
+        header->Magic == TERRAIN_CACHE_MAGIC &&
+        header->Version == TERRAIN_CACHE_VERSION &&
+        memcmp(&header->Key, &key, sizeof(key)) == 0 &&
+        header->NumVertices == numVertices;
+    if (!valid)
+    {
+        // it'll be overwritten when this heightfield is stored
+        fprintf(stderr, "Ignoring stale terrain cache file %s\n", path.c_str());
+        file.Close();
+        NumMisses++;
+        return false;
+    }
+
+    heightfield->Header = header;
+    heightfield->Texels = static_cast<const char*>(file.GetData()) + sizeof(TerrainCacheHeader);
+
+    NumHits++;
+    return true;
+}
+
+bool TerrainHeightfieldCache::Store(
+    const TerrainCacheKey& key,
+    float minHeight,
+    float maxHeight,
+    size_t numVertices,
+    const void* texels)
+{
+    if (!MakeCacheDirectory(mDirectory))
+    {
+        fprintf(stderr, "Failed to create terrain cache directory %s\n", mDirectory.c_str());
+        return false;
+    }
+
+    // unique per store, in case two threads store the same heightfield
+    static std::atomic<unsigned> tempCounter{ 0 };
+    std::string path = GetPath(key);
+    std::string tempPath = path + ".tmp" + std::to_string(tempCounter++);
+
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", tempPath.c_str());
+        return false;
+    }
+
+    TerrainCacheHeader header = {};
+    header.Magic = TERRAIN_CACHE_MAGIC;
+    header.Version = TERRAIN_CACHE_VERSION;
+    header.Key = key;
+    header.MinHeight = minHeight;
+    header.MaxHeight = maxHeight;
+    header.NumVertices = numVertices;
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(texels, TERRAIN_CACHE_BYTES_PER_VERTEX, numVertices, file) == numVertices;
+    written = (fclose(file) == 0) && written;
+
+    if (!written || !ReplaceCacheFile(tempPath, path))
+    {
+        fprintf(stderr, "Failed to write terrain cache file %s\n", path.c_str());
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    NumStored++;
+    return true;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Disk cache of generated terrain heightfields, so known worlds don't have to be generated again.
+//
+// Each heightfield is one file, named after everything its contents depend on (seed, grid size, noise parameters),
+// holding a header and then the heightfield's texels in the layout UploadTerrainRows takes (see PackTerrainTexels).
+// Loading maps the file into memory, so a cached world is uploaded straight from the page cache, with no parsing or copying.
+//
+// Bump TERRAIN_CACHE_VERSION whenever the generated heightfields change for the same key (eg. a change to the noise),
+// so stale files are regenerated instead of loaded.
+//
+// The files are written in the machine's byte order. They are a local cache, not an interchange format.
+
+#define TERRAIN_CACHE_VERSION 3
+
+// bytes per vertex after the header: a 16-bit height, and later on the normal's x and z as 8-bit snorms
+#define TERRAIN_CACHE_BYTES_PER_VERTEX 4
+
+// everything a heightfield depends on. Files whose key doesn't match exactly are ignored.
+struct TerrainCacheKey
+{
+    uint32_t Seed = 0;
+    int32_t GridSize = 0;
+    int32_t ChunkX = 0;
+    int32_t ChunkZ = 0;
+    int32_t Fractal = 0;
+    int32_t Octaves = 0;
+    float H = 0.0f;
+    float Lacunarity = 0.0f;
+    float HeightScale = 0.0f;
+};
+
+struct TerrainCacheHeader
+{
+    // TERRAIN_CACHE_MAGIC
+    uint32_t Magic;
+    uint32_t Version;
+    TerrainCacheKey Key;
+    float MinHeight;
+    float MaxHeight;
+    // pads the header to 64 bytes, so the arrays after it are aligned
+    uint32_t Reserved;
+    uint64_t NumVertices;
+};
+
+static_assert(sizeof(TerrainCacheHeader) == 64, "the heightfields should stay 64 byte aligned");
+
+// a read-only memory mapping of a whole file
+class MappedFile
+{
+    void* mData = nullptr;
+    size_t mSize = 0;
+#ifdef _WIN32
+    void* mFile = nullptr;
+    void* mMapping = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // returns false if the file doesn't exist or can't be mapped
+    bool Open(const char* path);
+    void Close();
+
+    const void* GetData() const { return mData; }
+    size_t GetSize() const { return mSize; }
+};
+
+// creates a cache directory, unless it exists already
+bool MakeCacheDirectory(const std::string& path);
+
+// replaces to with from, eg. to publish a file that was written under a temporary name
+bool ReplaceCacheFile(const std::string& from, const std::string& to);
+
+// a heightfield loaded from the cache. The arrays point into the mapping, so they stay valid as long as this does.
+struct CachedHeightfield
+{
+    MappedFile File;
+
+    const TerrainCacheHeader* Header = nullptr;
+    // NumVertices * TERRAIN_CACHE_BYTES_PER_VERTEX bytes
+    const void* Texels = nullptr;
+};
+
+class TerrainHeightfieldCache
+{
+    std::string mDirectory;
+
+public:
+    // the terrain generation neither loads nor stores heightfields while this is off
+    bool Enabled = true;
+
+    // for the stats display. Atomic since heightfields are stored from the world regeneration thread.
+    std::atomic<int> NumHits{ 0 };
+    std::atomic<int> NumMisses{ 0 };
+    std::atomic<int> NumStored{ 0 };
+
+    // the directory is created on the first store
+    explicit TerrainHeightfieldCache(const std::string& directory = "terrain_cache");
+
+    std::string GetPath(const TerrainCacheKey& key) const;
+
+    // maps the heightfield of key. Returns false if it isn't cached, or the file is stale or truncated.
+    bool Load(const TerrainCacheKey& key, CachedHeightfield* heightfield);
+
+    // writes the packed texels of a heightfield of numVertices vertices. Safe to call from any thread.
+    // the file is written under a temporary name and renamed, so a crash can't leave a truncated entry behind.
+    bool Store(
+        const TerrainCacheKey& key,
+        float minHeight,
+        float maxHeight,
+        size_t numVertices,
+        const void* texels);
+};
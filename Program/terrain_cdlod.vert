@@ -0,0 +1,55 @@
+// Terrain vertex shader for the CDLOD renderer (see cdlod.h).
+// Draws one quadtree node with the shared patch mesh, displaced by the terrain's height texture.
+// The outputs are the same as scene.vert, so it links with scene.frag.
+
+layout(location = SCENE_POSITION_ATTRIB_LOCATION)
+in vec2 GridPosition;   // position in the patch, in [0, 1]
+
+uniform mat4 ModelWorld;
+uniform mat4 ModelViewProjection;
+uniform mat3 Normal_ModelWorld;
+
+uniform vec3 CameraPos;
+
+// the node being drawn, in model space x/z
+uniform vec2 NodeMin;
+uniform float NodeSize;
+uniform vec2 MorphConsts;
+
+// camera in model space
+uniform vec3 LocalCameraPos;
+
+out vec3 surface_normal;
+out vec4 position_worldspace;
+out vec4 camera_position;
+
+out float altitude;
+
+// from terrain_heightmap.glsl
+vec2 heightmap_texcoord(vec2 xz);
+float terrain_height(vec2 texcoord);
+vec3 terrain_normal(vec2 texcoord);
+
+void main()
+{
+    vec2 xz = NodeMin + GridPosition * NodeSize;
+    float height = terrain_height(heightmap_texcoord(xz));
+
+    // move the odd vertices onto their even neighbours as the node approaches its next coarser level,
+    // so at the end of the range the patch has the same shape as the coarser level's patch.
+    float morph = 1.0 - clamp(MorphConsts.x - distance(LocalCameraPos, vec3(xz.x, height, xz.y)) * MorphConsts.y, 0.0, 1.0);
+    vec2 oddOffset = fract(GridPosition * CDLOD_PATCH_RESOLUTION * 0.5) * 2.0 / CDLOD_PATCH_RESOLUTION;
+    xz -= oddOffset * NodeSize * morph;
+
+    vec2 texcoord = heightmap_texcoord(xz);
+    vec4 Position = vec4(xz.x, terrain_height(texcoord), xz.y, 1.0);
+    vec3 Normal = terrain_normal(texcoord);
+
+    gl_Position = ModelViewProjection * Position;
+    surface_normal = Normal_ModelWorld * Normal;
+    position_worldspace = (ModelWorld * Position);
+
+    camera_position = vec4(CameraPos, 0);
+
+    altitude = Position.y;
+}
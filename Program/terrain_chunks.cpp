@@ -0,0 +1,157 @@
+#include "terrain_chunks.h"
+
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+static uint64_t ChunkKey(int x, int z)
+{
+    return ((uint64_t)(uint32_t)x << 32) | (uint32_t)z;
+}
+
+static size_t ChunkBytes(const Terrain& terrain)
+{
+    // the R16 height + RG8_SNORM normal textures. The index buffer and vertex array are shared with the other chunks.
+    return GetTerrainTexelBytes(terrain.gridSize);
+}
+
+static void EvictChunk(Scene* scene, std::list<TerrainChunk>::iterator chunk)
+{
+    TerrainChunkCache& cache = scene->TerrainChunks;
+
+    if (scene->Terrains.contains(chunk->TerrainID))
+    {
+        DestroyTerrain(scene, chunk->TerrainID);
+    }
+
+    cache.MemoryUsed -= chunk->Bytes;
+    cache.Lookup.erase(ChunkKey(chunk->X, chunk->Z));
+    cache.LRU.erase(chunk);
+}
+
+// evicts the least recently used chunk that isn't needed this frame. Returns false if there is none.
+static bool EvictLeastRecentlyUsed(Scene* scene)
+{
+    TerrainChunkCache& cache = scene->TerrainChunks;
+
+    if (cache.LRU.empty() || cache.LRU.back().LastUsedFrame == cache.Frame)
+    {
+        return false;
+    }
+
+    EvictChunk(scene, std::prev(cache.LRU.end()));
+    return true;
+}
+
+void UpdateTerrainChunks(Scene* scene)
+{
+    TerrainChunkCache& cache = scene->TerrainChunks;
+
+    if (!cache.Enabled)
+    {
+        return;
+    }
+
+    cache.Frame++;
+
+    // chunk (x, z) is centered on (x, z) * TERRAIN_WORLD_SIZE
+    const glm::vec3& eye = scene->MainCamera.Eye;
+    int cameraX = (int)floor(eye.x / TERRAIN_WORLD_SIZE + 0.5f);
+    int cameraZ = (int)floor(eye.z / TERRAIN_WORLD_SIZE + 0.5f);
+
+    // touch the chunks in range and collect the missing ones
+    std::vector<std::pair<int, int>> missing;
+    for (int dz = -cache.ViewRadius; dz <= cache.ViewRadius; dz++)
+    {
+        for (int dx = -cache.ViewRadius; dx <= cache.ViewRadius; dx++)
+        {
+            if (dx * dx + dz * dz > cache.ViewRadius * cache.ViewRadius)
+                continue;
+
+            auto found = cache.Lookup.find(ChunkKey(cameraX + dx, cameraZ + dz));
+            if (found == end(cache.Lookup))
+            {
+                missing.emplace_back(dx, dz);
+                continue;
+            }
+
+            found->second->LastUsedFrame = cache.Frame;
+            cache.LRU.splice(begin(cache.LRU), cache.LRU, found->second);
+        }
+    }
+
+    // evict chunks that fell out of range
+    for (auto chunk = begin(cache.LRU); chunk != end(cache.LRU);)
+    {
+        auto next = std::next(chunk);
+        if (std::abs(chunk->X - cameraX) > cache.KeepRadius || std::abs(chunk->Z - cameraZ) > cache.KeepRadius)
+        {
+            EvictChunk(scene, chunk);
+        }
+        chunk = next;
+    }
+
+    // generate the nearest missing chunks first
+    std::sort(begin(missing), end(missing), [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+        return a.first * a.first + a.second * a.second < b.first * b.first + b.second * b.second;
+    });
+
+    int numGenerated = 0;
+    for (const std::pair<int, int>& offset : missing)
+    {
+        if (numGenerated == cache.MaxGeneratedPerFrame)
+            break;
+
+        // make room. If everything left is in view, the budget is too small for the view radius, so stop growing.
+        bool hasRoom = true;
+        while (!cache.LRU.empty() &&
+               (cache.MemoryUsed + cache.LRU.front().Bytes > cache.MemoryBudget || scene->Terrains.size() + 1 >= scene->Terrains.capacity()))
+        {
+            if (!EvictLeastRecentlyUsed(scene))
+            {
+                hasRoom = false;
+                break;
+            }
+        }
+        if (!hasRoom)
+            break;
+
+        TerrainChunk chunk;
+        chunk.X = cameraX + offset.first;
+        chunk.Z = cameraZ + offset.second;
+        chunk.LastUsedFrame = cache.Frame;
+
+        GenerateTerrainChunk(scene, chunk.X, chunk.Z, cache.GridSize, &chunk.TerrainID);
+        chunk.Bytes = ChunkBytes(scene->Terrains[chunk.TerrainID]);
+
+        cache.LRU.push_front(chunk);
+        cache.Lookup.emplace(ChunkKey(chunk.X, chunk.Z), begin(cache.LRU));
+        cache.MemoryUsed += chunk.Bytes;
+
+        numGenerated++;
+    }
+
+    // the water plane is flat, so rather than tiling it, stretch one over the kept area and follow the camera
+    if (cache.WaterID != (uint32_t)-1 && scene->Terrains.contains(cache.WaterID))
+    {
+        Transform& waterTransform = scene->Transforms[scene->Terrains[cache.WaterID].TransformID];
+        float waterScale = (float)(2 * cache.KeepRadius + 1);
+        waterTransform.Scale = glm::vec3(waterScale, 1.0f, waterScale);
+        waterTransform.Translation = glm::vec3(cameraX * TERRAIN_WORLD_SIZE, 0.0f, cameraZ * TERRAIN_WORLD_SIZE);
+    }
+}
+
+void FlushTerrainChunks(Scene* scene)
+{
+    TerrainChunkCache& cache = scene->TerrainChunks;
+
+    while (!cache.LRU.empty())
+    {
+        EvictChunk(scene, begin(cache.LRU));
+    }
+
+    cache.MemoryUsed = 0;
+    cache.WaterID = (uint32_t)-1;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+class Scene;
+
+// A terrain grid that was generated at integer chunk coordinates.
+// The mesh itself lives in Scene::Terrains, so the renderer draws it like any other terrain.
+struct TerrainChunk
+{
+    int X;
+    int Z;
+    uint32_t TerrainID;
+
+    // GPU memory held by the chunk's buffers
+    size_t Bytes;
+
+    // last frame the chunk was inside the view radius
+    uint64_t LastUsedFrame;
+};
+
+// LRU cache of terrain chunks around the camera.
+// Chunks are generated on demand, evicted once they fall out of range,
+// and the least recently used ones are dropped when the memory budget is exceeded.
+struct TerrainChunkCache
+{
+    bool Enabled = false;
+    int Seed = 0;
+
+    // grid squares per side of each chunk (set up by Scene::Init)
+    int GridSize = 0;
+
+    // chunks within this many chunks of the camera get generated
+    int ViewRadius = 3;
+    // chunks are kept for one ring past the view radius, so flying back and forth over a border doesn't regenerate them
+    int KeepRadius = 4;
+    // limits the generation work per frame, to keep frame times flat while flying
+    int MaxGeneratedPerFrame = 1;
+    size_t MemoryBudget = 64 * 1024 * 1024;
+
+    size_t MemoryUsed = 0;
+    uint64_t Frame = 0;
+
+    // most recently used chunk at the front
+    std::list<TerrainChunk> LRU;
+    std::unordered_map<uint64_t, std::list<TerrainChunk>::iterator> Lookup;
+
+    // water plane that follows the camera instead of being tiled
+    uint32_t WaterID = (uint32_t)-1;
+};
+
+// generates/evicts chunks around Scene::MainCamera.Eye. Call once per frame.
+void UpdateTerrainChunks(Scene* scene);
+
+// destroys every cached chunk (eg. because the seed changed)
+void FlushTerrainChunks(Scene* scene);
@@ -0,0 +1,42 @@
+// Terrain vertex shader for the full grid renderer.
+// Draws the grid's shared index buffer with no vertex attributes: gl_VertexID is grid vertex i * (gridSize+1) + j,
+// so x/z follow from it, and the height and normal are fetched from the terrain's textures.
+// The outputs are the same as scene.vert, so it links with scene.frag.
+
+uniform mat4 ModelWorld;
+uniform mat4 ModelViewProjection;
+uniform mat3 Normal_ModelWorld;
+
+uniform vec3 CameraPos;
+
+out vec3 surface_normal;
+out vec4 position_worldspace;
+out vec4 camera_position;
+
+out float altitude;
+
+// from terrain_heightmap.glsl
+int terrain_grid_size();
+vec2 terrain_texel_xz(ivec2 texel);
+float terrain_height_texel(ivec2 texel);
+vec3 terrain_normal_texel(ivec2 texel);
+
+void main()
+{
+    int gridSize = terrain_grid_size();
+
+    // texel (j, i), since the rows of the textures run along x
+    ivec2 texel = ivec2(gl_VertexID % (gridSize + 1), gl_VertexID / (gridSize + 1));
+    vec2 xz = terrain_texel_xz(texel);
+
+    vec4 Position = vec4(xz.x, terrain_height_texel(texel), xz.y, 1.0);
+    vec3 Normal = terrain_normal_texel(texel);
+
+    gl_Position = ModelViewProjection * Position;
+    surface_normal = Normal_ModelWorld * Normal;
+    position_worldspace = (ModelWorld * Position);
+
+    camera_position = vec4(CameraPos, 0);
+
+    altitude = Position.y;
+}
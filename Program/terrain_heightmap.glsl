@@ -0,0 +1,58 @@
+// Heightfield sampling shared by the terrain shaders (the textures are described at Terrain, in scene.h).
+// Linked into a program as an extra shader object of each stage that reads the heightfield.
+
+// model space x/z of the heightfield's first texel, and its extent
+uniform vec2 TerrainMin;
+uniform float TerrainSize;
+
+// the heights are 16-bit unorms over the terrain's range: its MinHeight, and MaxHeight - MinHeight
+uniform vec2 HeightRange;
+
+uniform sampler2D HeightMap;
+uniform sampler2D NormalMap;
+
+vec2 heightmap_texcoord(vec2 xz)
+{
+    // texel centers sit on the grid vertices, and the rows of the textures run along x
+    vec2 size = vec2(textureSize(HeightMap, 0));
+    vec2 uv = (xz - TerrainMin) / TerrainSize;
+    return (uv.yx * (size - 1.0) + 0.5) / size;
+}
+
+// the normal map only holds x and z, since y is always positive
+vec3 unpack_normal(vec2 xz)
+{
+    return vec3(xz.x, sqrt(max(1.0 - dot(xz, xz), 0.0)), xz.y);
+}
+
+float terrain_height(vec2 texcoord)
+{
+    return HeightRange.x + textureLod(HeightMap, texcoord, 0.0).r * HeightRange.y;
+}
+
+vec3 terrain_normal(vec2 texcoord)
+{
+    return unpack_normal(textureLod(NormalMap, texcoord, 0.0).rg);
+}
+
+// squares per side of the terrain's grid
+int terrain_grid_size()
+{
+    return textureSize(HeightMap, 0).x - 1;
+}
+
+// the exact position and normal of grid vertex i * (gridSize+1) + j, which is texel (j, i), with no filtering
+vec2 terrain_texel_xz(ivec2 texel)
+{
+    return TerrainMin + vec2(texel.yx) * (TerrainSize / float(terrain_grid_size()));
+}
+
+float terrain_height_texel(ivec2 texel)
+{
+    return HeightRange.x + texelFetch(HeightMap, texel, 0).r * HeightRange.y;
+}
+
+vec3 terrain_normal_texel(ivec2 texel)
+{
+    return unpack_normal(texelFetch(NormalMap, texel, 0).rg);
+}
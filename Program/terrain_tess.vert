@@ -0,0 +1,24 @@
+// Terrain vertex shader for the tessellated renderer.
+// Draws PatchesPerSide^2 instances of a 4 vertex patch, with no vertex attributes:
+// the instance picks the patch in the coarse grid and gl_VertexID picks its corner.
+
+uniform int PatchesPerSide;
+
+// from terrain_heightmap.glsl
+uniform vec2 TerrainMin;
+uniform float TerrainSize;
+vec2 heightmap_texcoord(vec2 xz);
+float terrain_height(vec2 texcoord);
+
+out vec3 tc_position;
+
+void main()
+{
+    ivec2 patchIndex = ivec2(gl_InstanceID % PatchesPerSide, gl_InstanceID / PatchesPerSide);
+    ivec2 corner = ivec2(gl_VertexID & 1, gl_VertexID >> 1);
+
+    vec2 xz = TerrainMin + vec2(patchIndex + corner) * (TerrainSize / PatchesPerSide);
+
+    // the corner heights are only used to measure the patch edges
+    tc_position = vec3(xz.x, terrain_height(heightmap_texcoord(xz)), xz.y);
+}
@@ -0,0 +1,98 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int numWorkers)
+{
+    mNextIndex = 0;
+
+    for (int i = 0; i < numWorkers; i++)
+    {
+        mWorkers.emplace_back(&ThreadPool::WorkerMain, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mWake.notify_all();
+
+    for (std::thread& worker : mWorkers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::RunJob()
+{
+    for (;;)
+    {
+        int index = mNextIndex++;
+        if (index >= mJobCount)
+            break;
+
+        (*mJob)(index);
+    }
+}
+
+void ThreadPool::WorkerMain()
+{
+    uint64_t lastGeneration = 0;
+
+    for (;;)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWake.wait(lock, [&] { return mQuit || (mJobGeneration != lastGeneration && mWorkersWanted > 0); });
+        if (mQuit)
+            return;
+
+        lastGeneration = mJobGeneration;
+        mWorkersWanted--;
+        mWorkersBusy++;
+        lock.unlock();
+
+        RunJob();
+
+        lock.lock();
+        mWorkersBusy--;
+        if (mWorkersBusy == 0)
+        {
+            mDone.notify_all();
+        }
+    }
+}
+
+void ThreadPool::ParallelFor(int count, int maxThreads, const std::function<void(int)>& func)
+{
+    if (count <= 0)
+        return;
+
+    std::lock_guard<std::mutex> submit(mSubmitMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJob = &func;
+        mJobCount = count;
+        mNextIndex = 0;
+        mWorkersWanted = std::max(std::min(std::min(maxThreads, GetMaxThreads()), count), 1) - 1;
+        mJobGeneration++;
+    }
+    mWake.notify_all();
+
+    RunJob();
+
+    // workers that didn't wake up in time have nothing left to do, so they can skip this job
+    std::unique_lock<std::mutex> lock(mMutex);
+    mWorkersWanted = 0;
+    mDone.wait(lock, [&] { return mWorkersBusy == 0; });
+    mJob = nullptr;
+}
+
+ThreadPool& GetThreadPool()
+{
+    static ThreadPool pool(std::max((int)std::thread::hardware_concurrency(), 1) - 1);
+    return pool;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops (eg. one job per terrain row).
+// The calling thread participates in the work, so a pool of N-1 workers keeps N cores busy.
+class ThreadPool
+{
+    std::vector<std::thread> mWorkers;
+
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+
+    // only one ParallelFor runs at a time
+    std::mutex mSubmitMutex;
+
+    // the current job. Indices are handed out through mNextIndex, so every index runs exactly once
+    const std::function<void(int)>* mJob = nullptr;
+    int mJobCount = 0;
+    std::atomic<int> mNextIndex;
+    uint64_t mJobGeneration = 0;
+
+    // number of workers that may still join the current job, and number that are running it
+    int mWorkersWanted = 0;
+    int mWorkersBusy = 0;
+
+    bool mQuit = false;
+
+    void WorkerMain();
+    void RunJob();
+
+public:
+    explicit ThreadPool(int numWorkers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // number of threads that can work on a job, including the caller
+    int GetMaxThreads() const { return (int)mWorkers.size() + 1; }
+
+    // calls func(i) for every i in [0, count) on up to maxThreads threads (caller included), and returns when all are done.
+    // the order in which indices run is unspecified, so func(i) should only write to data owned by index i.
+    void ParallelFor(int count, int maxThreads, const std::function<void(int)>& func);
+};
+
+// shared pool with one thread per hardware core
+ThreadPool& GetThreadPool();
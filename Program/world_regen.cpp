@@ -0,0 +1,679 @@
+#include "world_regen.h"
+
+#include "scene.h"
+#include "arena.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// the preview's coarsest level has at most this many squares per side, so it can be made in the frame it's requested
+#define WORLD_PREVIEW_MIN_GRID_SIZE 64
+// and its finest level at most this many. Finer ones would take about as long to index and upload as the worker takes to finish.
+#define WORLD_PREVIEW_MAX_GRID_SIZE 1024
+
+// a world being built. The worker owns the heights' range, timing and adaptive mesh, and writes through Texels, until it sets Done.
+// Noise and Settings are only read by both sides. The rest is the main thread's.
+struct WorldBuildJob
+{
+    std::thread Worker;
+    std::atomic<bool> Done{ false };
+
+    int MaxThreads = 1;
+
+    // the new world's noise. The worker has its own table, so the scene's can keep generating chunks meanwhile.
+    PermutationTable Noise;
+    TerrainFractalSettings Settings;
+
+    // the heightfield of chunk (0, 0), as GenerateTerrainMesh would make it, packed for NewTerrain's textures.
+    // TexelBO is mapped while the worker runs, so the texels are packed in place, and then uploaded from it on the GPU.
+    GLuint TexelBO = 0;
+    void* Texels = nullptr;
+    float MinHeight = 0.0f;
+    float MaxHeight = 0.0f;
+    float HeightfieldMs = 0.0f;
+
+    // the disk cache the worker stores the heightfield in, or null to skip it
+    TerrainHeightfieldCache* Cache = nullptr;
+    TerrainCacheKey CacheKey;
+
+    // whether the worker makes an adaptive mesh of the heightfield (see rtin.h), within MeshMaxError of it
+    bool AdaptiveMesh = false;
+    float MeshMaxError = 0.0f;
+    std::vector<uint32_t> AdaptiveIndices;
+
+    // the heightfield, when it was in the disk cache. Uploaded from instead of TexelBO, with no worker unless it needs an adaptive mesh.
+    CachedHeightfield Cached;
+    bool FromCache = false;
+
+    // the terrain the heightfield goes to. It only joins the scene once it's complete.
+    Terrain NewTerrain;
+
+    // the preview shown until then. NewTerrain's textures aren't filled in until the worker is done, so the preview has its own
+    // vertex buffers, holding every PreviewMinStep-th row and column of the full grid (and the last): the grid of its finest level.
+    Terrain Preview;
+    // Preview's ID in the scene, once it's there. The scene owns its objects from then on.
+    uint32_t PreviewID = 0;
+    bool PreviewInScene = false;
+    int PreviewMinStep = 0;
+
+    // the preview level being filled in, every PreviewFillStep-th row and column (0 once no more levels will be),
+    // and the next of its rows, in units of that step
+    int PreviewFillStep = 0;
+    int PreviewFillRow = 0;
+    FractalFunction PreviewFractal = nullptr;
+    SpectralTable PreviewSpectrum;
+    float PreviewHeightOffset = 0.0f;
+};
+
+WorldRegeneration::WorldRegeneration() = default;
+
+WorldRegeneration::~WorldRegeneration()
+{
+    if (Job && Job->Worker.joinable())
+    {
+        Job->Worker.join();
+    }
+}
+
+// runs on the worker
+static void BuildWorld(WorldBuildJob* job, int gridSize)
+{
+    size_t numVertices = (size_t)(gridSize + 1) * (gridSize + 1);
+    size_t texelBytes = GetTerrainTexelBytes(gridSize);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // x/z follow from the grid, so only the heights and normals are generated
+    std::vector<float> heights(numVertices);
+    std::vector<glm::vec3> normals(numVertices);
+    GenerateTerrainHeights(job->Noise, job->Settings, 0, 0, gridSize, nullptr, (GLfloat(*)[3])normals.data(), heights.data(), job->MaxThreads);
+
+    job->MinHeight = heights[0];
+    job->MaxHeight = heights[0];
+    for (size_t i = 0; i < numVertices; i++)
+    {
+        job->MinHeight = std::min(job->MinHeight, heights[i]);
+        job->MaxHeight = std::max(job->MaxHeight, heights[i]);
+    }
+
+    // the disk cache and the adaptive mesh have to read the texels back, and the mapped buffer is write-only,
+    // so then they're packed in memory and copied to it afterwards
+    std::vector<uint8_t> localTexels;
+    void* texels = job->Texels;
+    if (job->Cache || job->AdaptiveMesh)
+    {
+        localTexels.resize(texelBytes);
+        texels = localTexels.data();
+    }
+
+    PackTerrainTexels(gridSize, heights.data(), (const GLfloat(*)[3])normals.data(), job->MinHeight, job->MaxHeight, texels);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    job->HeightfieldMs = std::chrono::duration<float, std::milli>(end - start).count();
+
+    if (job->Cache)
+    {
+        job->Cache->Store(job->CacheKey, job->MinHeight, job->MaxHeight, numVertices, localTexels.data());
+    }
+    if (job->AdaptiveMesh)
+    {
+        BuildTerrainAdaptiveIndices(gridSize, localTexels.data(), job->MinHeight, job->MaxHeight, job->MeshMaxError, &job->AdaptiveIndices);
+    }
+    if (texels != job->Texels)
+    {
+        memcpy(job->Texels, localTexels.data(), texelBytes);
+    }
+
+    job->Done = true;
+}
+
+// runs on the worker, for a world from the disk cache that only needs its adaptive mesh. It's read from the cache file's mapping
+// while the main thread uploads from it.
+static void MeshCachedWorld(WorldBuildJob* job, int gridSize)
+{
+    BuildTerrainAdaptiveIndices(gridSize, job->Cached.Texels, job->MinHeight, job->MaxHeight, job->MeshMaxError, &job->AdaptiveIndices);
+
+    job->Done = true;
+}
+
+// maps a staging buffer for the new terrain's texels, for the worker. Returns false (with nothing mapped) if it can't be.
+static bool MapNewTerrain(Scene* scene, WorldBuildJob& job)
+{
+    size_t texelBytes = GetTerrainTexelBytes(job.NewTerrain.gridSize);
+    job.TexelBO = scene->GLPool.AcquireBuffer(texelBytes);
+    job.Texels = scene->GLPool.MapBuffer(job.TexelBO, texelBytes);
+
+    if (!job.Texels)
+    {
+        scene->GLPool.RetireBuffer(job.TexelBO);
+        job.TexelBO = 0;
+        return false;
+    }
+    return true;
+}
+
+// returns false if the worker's texels were lost while they were mapped
+static bool UnmapNewTerrain(Scene* scene, WorldBuildJob& job)
+{
+    if (!job.Texels)
+    {
+        return true;
+    }
+
+    bool intact = scene->GLPool.UnmapBuffer(job.TexelBO);
+    job.Texels = nullptr;
+    return intact;
+}
+
+// whether the preview is still the scene's. Something else replacing the world (eg. GenerateWorld) destroys it.
+static bool IsPreviewInScene(Scene* scene, WorldBuildJob& job)
+{
+    if (job.PreviewInScene && !scene->Terrains.contains(job.PreviewID))
+    {
+        // its objects went back to the pool with it
+        job.PreviewInScene = false;
+        job.Preview = Terrain();
+        job.PreviewFillStep = 0;
+        scene->WorldRegen.PreviewStep = 0;
+    }
+    return job.PreviewInScene;
+}
+
+// hands the new terrain's GL objects back to the pool
+static void RetireNewTerrain(Scene* scene, WorldBuildJob& job)
+{
+    UnmapNewTerrain(scene, job);
+    scene->GLPool.RetireBuffer(job.TexelBO);
+    job.TexelBO = 0;
+
+    Terrain& terrain = job.NewTerrain;
+    scene->GLPool.RetireTexture2D(terrain.HeightTO);
+    scene->GLPool.RetireTexture2D(terrain.NormalTO);
+}
+
+// drops the finished or discarded job, and its hold on the grid's index buffer
+static void EndJob(Scene* scene)
+{
+    WorldRegeneration& regen = scene->WorldRegen;
+
+    if (!regen.Job->AdaptiveMesh)
+    {
+        scene->GridIndices.Release(regen.GridSize);
+    }
+    regen.Job.reset();
+}
+
+// drops the world in flight. The preview's objects are the scene's, and the preview stays up until the next world replaces it.
+static void DiscardJob(Scene* scene)
+{
+    WorldRegeneration& regen = scene->WorldRegen;
+
+    // a cached world's worker may still be meshing it
+    if (regen.Job->Worker.joinable())
+    {
+        regen.Job->Worker.join();
+    }
+
+    RetireNewTerrain(scene, *regen.Job);
+
+    EndJob(scene);
+    regen.NumSuperseded++;
+    regen.PreviewStep = 0;
+    regen.CurrentStage = WorldRegeneration::Idle;
+}
+
+// replaces the old world (and the preview, if there is one) with the given terrain, all in this frame
+static void AddNewWorld(Scene* scene, Terrain* terrain, uint32_t* newTerrainID)
+{
+    WorldRegeneration& regen = scene->WorldRegen;
+    WorldBuildJob& job = *regen.Job;
+
+    // the old world's objects go to the pool, for the next regeneration to reuse
+    FlushTerrainChunks(scene);
+    ClearTerrains(scene);
+
+    AddTerrainChunk(scene, 0, 0, terrain, newTerrainID);
+
+    uint32_t waterID;
+    GenerateWaterMesh(scene, TERRAIN_DEFAULT_GRID_SIZE, &waterID);
+
+    if (!scene->heightColorTexture)
+    {
+        scene->heightColorTexture = GenerateHeightColors();
+    }
+
+    scene->TerrainNoise = job.Noise;
+}
+
+// points the terrain's vertex array at another index buffer
+static void SetTerrainIndices(Terrain& terrain, GLuint indexBO, GLenum indexType, GLsizei indexCount)
+{
+    terrain.IndexBO = indexBO;
+    terrain.IndexType = indexType;
+    terrain.IndexCount = indexCount;
+
+    glBindVertexArray(terrain.MeshVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBO);
+    glBindVertexArray(0);
+}
+
+// fills in row k (in units of step) of a preview level: grid row min(k * step, GridSize), at every step-th column
+// (and the last), and uploads it to the preview's row for it. The preview's other columns get copies of the samples,
+// which this level's indices don't use.
+static void FillPreviewRow(Scene* scene, int step, int k)
+{
+    WorldRegeneration& regen = scene->WorldRegen;
+    WorldBuildJob& job = *regen.Job;
+    int gridSize = regen.GridSize;
+    int i = std::min(k * step, gridSize);
+
+    // the preview's grid is every PreviewMinStep-th vertex of the full one, so this level is every ratio-th vertex of it
+    int previewGridSize = job.Preview.gridSize;
+    int ratio = step / job.PreviewMinStep;
+    int previewRow = std::min(k * ratio, previewGridSize);
+
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+    float* value = scratch.Allocate<float>(gridSize + 1);
+    float* valueDx = scratch.Allocate<float>(gridSize + 1);
+    float* valueDy = scratch.Allocate<float>(gridSize + 1);
+    GLfloat (*vertices)[3] = scratch.Allocate<GLfloat[3]>(gridSize + 1);
+    GLfloat (*normals)[3] = scratch.Allocate<GLfloat[3]>(gridSize + 1);
+    GLfloat (*previewVertices)[3] = scratch.Allocate<GLfloat[3]>(previewGridSize + 1);
+    GLfloat (*previewNormals)[3] = scratch.Allocate<GLfloat[3]>(previewGridSize + 1);
+
+    // like GenerateTerrainRow, the row is a column of the noise grid
+    NoiseGrid row;
+    row.SizeX = 1;
+    if (i % step == 0)
+    {
+        // the grid scaled down by step. It's a power of two, so the samples land on exactly the full grid's coordinates.
+        row.OriginX = i / step;
+        row.SizeY = gridSize / step + 1;
+        row.SamplesPerUnit = (float)gridSize / step;
+        job.PreviewFractal(job.Noise, row, job.PreviewSpectrum, value, valueDx, valueDy);
+
+        int lastSample = GetSubgridSize(gridSize, step);
+        if (lastSample != gridSize / step)
+        {
+            // the last column isn't a multiple of step
+            NoiseGrid last;
+            last.OriginX = i;
+            last.OriginY = gridSize;
+            last.SamplesPerUnit = (float)gridSize;
+            job.PreviewFractal(job.Noise, last, job.PreviewSpectrum, value + lastSample, valueDx + lastSample, valueDy + lastSample);
+        }
+
+        // spread the samples over the row, back to front so each is read before its slot is overwritten
+        for (int j = gridSize; j >= 0; j--)
+        {
+            int sample = j == gridSize ? lastSample : j / step;
+            value[j] = value[sample];
+            valueDx[j] = valueDx[sample];
+            valueDy[j] = valueDy[sample];
+        }
+    }
+    else
+    {
+        // the last row isn't a multiple of step. It's sampled in full.
+        row.OriginX = i;
+        row.SizeY = gridSize + 1;
+        row.SamplesPerUnit = (float)gridSize;
+        job.PreviewFractal(job.Noise, row, job.PreviewSpectrum, value, valueDx, valueDy);
+    }
+
+    WriteTerrainRow(gridSize, i, job.Settings.HeightScale, job.PreviewHeightOffset, value, valueDx, valueDy, vertices, normals, nullptr);
+
+    for (int c = 0; c <= previewGridSize; c++)
+    {
+        int j = std::min(c * job.PreviewMinStep, gridSize);
+        memcpy(previewVertices[c], vertices[j], sizeof(vertices[j]));
+        memcpy(previewNormals[c], normals[j], sizeof(normals[j]));
+    }
+
+    size_t rowBytes = (size_t)(previewGridSize + 1) * 3 * sizeof(GLfloat);
+    glBindBuffer(GL_ARRAY_BUFFER, job.Preview.PositionBO);
+    glBufferSubData(GL_ARRAY_BUFFER, previewRow * rowBytes, rowBytes, previewVertices);
+    glBindBuffer(GL_ARRAY_BUFFER, job.Preview.NormalBO);
+    glBufferSubData(GL_ARRAY_BUFFER, previewRow * rowBytes, rowBytes, previewNormals);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// draws the preview as the grid of its every step-th vertex, which have all been filled in.
+// the first level shown replaces the old world.
+static void ShowPreviewLevel(Scene* scene, int step)
+{
+    WorldRegeneration& regen = scene->WorldRegen;
+    WorldBuildJob& job = *regen.Job;
+
+    int previewGridSize = job.Preview.gridSize;
+    int ratio = step / job.PreviewMinStep;
+    int subgridSize = GetSubgridSize(previewGridSize, ratio);
+    size_t indexCount = (size_t)subgridSize * subgridSize * 6;
+
+    ScratchArena& scratch = GetScratchArena();
+    ScratchScope scratchScope(scratch);
+    uint32_t* indices = scratch.Allocate<uint32_t>(indexCount);
+    GenerateSubgridIndices(previewGridSize, ratio, indices);
+
+    // like GridIndexCache, not bound to GL_ELEMENT_ARRAY_BUFFER, which would attach it to the bound vertex array
+    GLuint indexBO = scene->GLPool.AcquireBuffer(indexCount * sizeof(uint32_t));
+    glBindBuffer(GL_ARRAY_BUFFER, indexBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, indexCount * sizeof(uint32_t), indices);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    regen.PreviewStep = step;
+
+    if (!job.PreviewInScene)
+    {
+        job.Preview.IndexBO = indexBO;
+        job.Preview.IndexType = GL_UNSIGNED_INT;
+        job.Preview.IndexCount = (GLsizei)indexCount;
+        job.Preview.PreviewStep = step;
+        AddNewWorld(scene, &job.Preview, &job.PreviewID);
+        job.PreviewInScene = true;
+        return;
+    }
+
+    Terrain& terrain = scene->Terrains[job.PreviewID];
+    scene->GLPool.RetireBuffer(terrain.IndexBO);
+    SetTerrainIndices(terrain, indexBO, GL_UNSIGNED_INT, (GLsizei)indexCount);
+    terrain.PreviewStep = step;
+}
+
+// fills in the preview's next rows for up to PreviewMsPerFrame, showing each level once all its rows are in
+static void RefinePreview(Scene* scene)
+{
+    WorldRegeneration& regen = scene->WorldRegen;
+    WorldBuildJob& job = *regen.Job;
+
+    if (job.PreviewFillStep == 0 || (regen.PreviewStep != 0 && !IsPreviewInScene(scene, job)))
+    {
+        return;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    while (job.PreviewFillStep != 0)
+    {
+        FillPreviewRow(scene, job.PreviewFillStep, job.PreviewFillRow);
+        job.PreviewFillRow++;
+
+        if (job.PreviewFillRow > GetSubgridSize(regen.GridSize, job.PreviewFillStep))
+        {
+            ShowPreviewLevel(scene, job.PreviewFillStep);
+
+            int nextStep = job.PreviewFillStep / 2;
+            job.PreviewFillStep = nextStep >= job.PreviewMinStep ? nextStep : 0;
+            job.PreviewFillRow = 0;
+        }
+
+        auto now = std::chrono::high_resolution_clock::now();
+        if (regen.PreviewStep != 0 && std::chrono::duration<float, std::milli>(now - start).count() >= regen.PreviewMsPerFrame)
+        {
+            break;
+        }
+    }
+}
+
+// starts a preview of the world the worker is going to build, if it's worth one, and shows its coarsest level
+static void StartPreview(Scene* scene)
+{
+    WorldRegeneration& regen = scene->WorldRegen;
+    WorldBuildJob& job = *regen.Job;
+
+    if (job.Settings.Fractal == FractalType::Spectral)
+    {
+        return;
+    }
+
+    int step = 1;
+    while (GetSubgridSize(regen.GridSize, step) > WORLD_PREVIEW_MIN_GRID_SIZE)
+    {
+        step *= 2;
+    }
+    // small grids are built about as fast as they could be previewed
+    if (step == 1)
+    {
+        return;
+    }
+
+    // the finest level. Step 1 is the worker's.
+    int minStep = step;
+    while (minStep / 2 > 1 && GetSubgridSize(regen.GridSize, minStep / 2) <= WORLD_PREVIEW_MAX_GRID_SIZE)
+    {
+        minStep /= 2;
+    }
+
+    int previewGridSize = GetSubgridSize(regen.GridSize, minStep);
+    size_t numVertices = (size_t)(previewGridSize + 1) * (previewGridSize + 1);
+    job.Preview.gridSize = previewGridSize;
+    job.Preview.PositionBO = scene->GLPool.AcquireBuffer(numVertices * 3 * sizeof(GLfloat));
+    job.Preview.NormalBO = scene->GLPool.AcquireBuffer(numVertices * 3 * sizeof(GLfloat));
+    job.PreviewMinStep = minStep;
+
+    job.PreviewFractal = GetFractalFunction(job.Settings.Fractal, job.Settings.Octaves);
+    job.PreviewSpectrum = MakeSpectralTable(job.Settings.H, job.Settings.Lacunarity);
+    job.PreviewHeightOffset = GetTerrainHeightOffset(job.Settings);
+    job.PreviewFillStep = step;
+    job.PreviewFillRow = 0;
+
+    RefinePreview(scene);
+}
+
+static void StartUploading(Scene* scene)
+{
+    WorldRegeneration& regen = scene->WorldRegen;
+    WorldBuildJob& job = *regen.Job;
+
+    if (job.FromCache)
+    {
+        CreateTerrainObjects(scene, regen.GridSize, &job.NewTerrain);
+    }
+    else if (!UnmapNewTerrain(scene, job))
+    {
+        // the heightfield has to be built again
+        regen.HasPendingRequest = true;
+        regen.PendingSeed = regen.Seed;
+        DiscardJob(scene);
+        return;
+    }
+
+    job.NewTerrain.MinHeight = job.MinHeight;
+    job.NewTerrain.MaxHeight = job.MaxHeight;
+    job.PreviewFillStep = 0;
+
+    regen.UploadedRows = 0;
+    regen.CurrentStage = WorldRegeneration::Uploading;
+}
+
+// replaces the old world (or the preview of the new one) with the uploaded one, all in this frame
+static void SwapInWorld(Scene* scene)
+{
+    WorldRegeneration& regen = scene->WorldRegen;
+    WorldBuildJob& job = *regen.Job;
+
+    if (job.Worker.joinable())
+    {
+        job.Worker.join();
+    }
+    if (job.AdaptiveMesh)
+    {
+        SetTerrainAdaptiveIndices(scene, &job.NewTerrain, job.AdaptiveIndices);
+    }
+
+    AddNewWorld(scene, &job.NewTerrain, nullptr);
+
+    // the GPU may still be copying from it, which the pool's fence covers
+    scene->GLPool.RetireBuffer(job.TexelBO);
+    job.TexelBO = 0;
+
+    scene->TerrainGenHeightfieldMs = job.HeightfieldMs;
+    scene->TerrainGenThreadsUsed = job.FromCache ? 0 : std::min(job.MaxThreads, GetThreadPool().GetMaxThreads());
+    scene->TerrainGenOnGPU = false;
+    scene->TerrainGenFromCache = job.FromCache;
+
+    EndJob(scene);
+    regen.NumCompleted++;
+    regen.PreviewStep = 0;
+    regen.CurrentStage = WorldRegeneration::Idle;
+}
+
+void RequestWorldRegeneration(Scene* scene, int seed)
+{
+    WorldRegeneration& regen = scene->WorldRegen;
+
+    regen.HasPendingRequest = true;
+    regen.PendingSeed = seed;
+}
+
+void UpdateWorldRegeneration(Scene* scene)
+{
+    WorldRegeneration& regen = scene->WorldRegen;
+
+    if (regen.CurrentStage == WorldRegeneration::Building)
+    {
+        if (!regen.Job->Done)
+        {
+            // no point refining a world that's going to be dropped
+            if (!regen.HasPendingRequest)
+            {
+                RefinePreview(scene);
+            }
+            return;
+        }
+
+        regen.Job->Worker.join();
+
+        if (regen.HasPendingRequest)
+        {
+            DiscardJob(scene);
+        }
+        else
+        {
+            StartUploading(scene);
+        }
+    }
+
+    if (regen.CurrentStage == WorldRegeneration::Uploading)
+    {
+        if (regen.HasPendingRequest)
+        {
+            DiscardJob(scene);
+        }
+        else
+        {
+            WorldBuildJob& job = *regen.Job;
+            int totalRows = regen.GridSize + 1;
+
+            size_t rowBytes = GetTerrainTexelBytes(regen.GridSize) / totalRows;
+            int numRows = (int)std::max(regen.UploadBytesPerFrame / rowBytes, (size_t)1);
+            numRows = std::min(numRows, totalRows - regen.UploadedRows);
+
+            // from the mapped cache file, or copied on the GPU from the buffer the worker packed them into
+            if (job.FromCache)
+            {
+                UploadTerrainRows(job.NewTerrain, regen.UploadedRows, numRows, 0, job.Cached.Texels);
+            }
+            else
+            {
+                UploadTerrainRows(job.NewTerrain, regen.UploadedRows, numRows, job.TexelBO, nullptr);
+            }
+            regen.UploadedRows += numRows;
+
+            // a cached world may still be waiting for its adaptive mesh
+            if (regen.UploadedRows == totalRows && job.Done)
+            {
+                SwapInWorld(scene);
+            }
+            return;
+        }
+    }
+
+    if (regen.CurrentStage != WorldRegeneration::Idle || !regen.HasPendingRequest)
+    {
+        return;
+    }
+
+    regen.HasPendingRequest = false;
+    regen.Seed = regen.PendingSeed;
+
+    // streamed chunks are generated lazily by UpdateTerrainChunks, and the compute shaders don't keep the CPU busy,
+    // so neither has anything to do in the background
+    bool onGPU = scene->TerrainGenUseGPU && scene->TerrainHeightsCS && *scene->TerrainHeightsCS;
+    if (scene->TerrainChunks.Enabled || onGPU)
+    {
+        GenerateWorld(regen.Seed, scene);
+        regen.NumCompleted++;
+        return;
+    }
+
+    regen.GridSize = std::min(std::max(scene->TerrainGridSize, TERRAIN_MIN_GRID_SIZE), TERRAIN_MAX_GRID_SIZE);
+    regen.UploadedRows = 0;
+
+    regen.Job.reset(new WorldBuildJob());
+    WorldBuildJob& job = *regen.Job;
+    job.Noise = PermutationTable(regen.Seed);
+    job.Settings = scene->TerrainSettings;
+    job.MaxThreads = scene->TerrainGenMaxThreads;
+    job.CacheKey = GetTerrainCacheKey(scene, job.Noise.GetSeed(), regen.GridSize);
+    job.AdaptiveMesh = scene->TerrainAdaptiveMesh;
+    job.MeshMaxError = scene->TerrainMeshMaxError;
+
+    // the new world's index buffer is held until the job ends, so it isn't built again when the preview (or the old world,
+    // if it's the same size) releases it. If it has to be built, that's now rather than in the frame the world is swapped in.
+    if (!job.AdaptiveMesh)
+    {
+        scene->GridIndices.Acquire(regen.GridSize);
+    }
+
+    if (scene->HeightfieldCache.Enabled)
+    {
+        // a known world has nothing to build, it's uploaded straight from its cache file
+        auto start = std::chrono::high_resolution_clock::now();
+        if (scene->HeightfieldCache.Load(job.CacheKey, &job.Cached))
+        {
+            job.FromCache = true;
+            job.MinHeight = job.Cached.Header->MinHeight;
+            job.MaxHeight = job.Cached.Header->MaxHeight;
+            auto end = std::chrono::high_resolution_clock::now();
+            job.HeightfieldMs = std::chrono::duration<float, std::milli>(end - start).count();
+
+            job.Done = !job.AdaptiveMesh;
+            if (job.AdaptiveMesh)
+            {
+                job.Worker = std::thread(MeshCachedWorld, regen.Job.get(), regen.GridSize);
+            }
+
+            StartUploading(scene);
+            return;
+        }
+
+        job.Cache = &scene->HeightfieldCache;
+    }
+
+    // the worker packs the heightfield straight into a buffer the textures are uploaded from
+    CreateTerrainObjects(scene, regen.GridSize, &job.NewTerrain);
+    if (!MapNewTerrain(scene, job))
+    {
+        // GenerateWorld falls back to uploading from memory, at the cost of a stalled frame
+        RetireNewTerrain(scene, job);
+        GenerateWorld(regen.Seed, scene);
+        EndJob(scene);
+        regen.NumCompleted++;
+        return;
+    }
+
+    // the preview's first level is made before the worker competes with it for the cores
+    if (regen.Progressive)
+    {
+        StartPreview(scene);
+    }
+
+    job.Worker = std::thread(BuildWorld, regen.Job.get(), regen.GridSize);
+    regen.CurrentStage = WorldRegeneration::Building;
+}
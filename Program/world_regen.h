@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+class Scene;
+
+struct WorldBuildJob;
+
+// Regenerates the world in the background, so clicking "Regenerate" doesn't stall the frame.
+// A staging buffer for the new terrain's textures is mapped when the request starts, and a worker thread (with the thread pool)
+// generates the heightfield and packs it straight into it while the old world keeps rendering. Once it's done it is unmapped,
+// the height and normal textures are copied from it a slice of rows per frame, and the new terrain is swapped in for the old
+// world in a single frame. Worlds that are in Scene::HeightfieldCache skip the worker, and are uploaded from the mapped cache file.
+// The worker also makes the terrain's adaptive mesh, when Scene::TerrainAdaptiveMesh is on (for cached worlds, that's all it does).
+//
+// With Progressive on, the new world replaces the old one right away as a coarse preview instead: the frame of the request
+// samples every 2^k-th row and column of it on the main thread, and draws the preview as the coarser grid over those vertices.
+// The next frames fill in the finer levels (halving the step) a few rows at a time, each row uploaded to its range of the
+// preview's own vertex buffers, until the worker is done.
+// The spectral fractal makes its whole grid at once, so it isn't previewed.
+struct WorldRegeneration
+{
+    enum Stage
+    {
+        Idle,
+        // the worker is generating the heightfield
+        Building,
+        // the heightfield is being uploaded to the new terrain's textures
+        Uploading,
+    };
+
+    Stage CurrentStage = Idle;
+
+    // request that arrived while another one was in flight. Only the latest is kept.
+    bool HasPendingRequest = false;
+    int PendingSeed = 0;
+
+    // seed and grid size of the world in flight
+    int Seed = 0;
+    int GridSize = 0;
+
+    // grid rows uploaded so far, out of GridSize + 1
+    int UploadedRows = 0;
+    // limits the upload work per frame
+    size_t UploadBytesPerFrame = 8 * 1024 * 1024;
+
+    // whether worlds that have to be built are previewed while the worker runs
+    bool Progressive = true;
+    // limits the preview refinement per frame. The coarsest level is always filled in at once, so there's something to show.
+    float PreviewMsPerFrame = 4.0f;
+    // grid step of the preview being shown, 0 when there is none
+    int PreviewStep = 0;
+
+    // number of worlds swapped in, and number of built worlds dropped because a newer request superseded them
+    int NumCompleted = 0;
+    int NumSuperseded = 0;
+
+    std::unique_ptr<WorldBuildJob> Job;
+
+    WorldRegeneration();
+    // waits for the worker, if one is running
+    ~WorldRegeneration();
+};
+
+// asks for the world to be regenerated with the given seed. It happens over the next frames, in UpdateWorldRegeneration.
+// streamed terrain, and terrain generated by the compute shaders, is regenerated all at once at the start of the next frame instead,
+// since it has no heightfield to build in the background.
+void RequestWorldRegeneration(Scene* scene, int seed);
+
+// starts/uploads/swaps in the requested world. Call once per frame.
+void UpdateWorldRegeneration(Scene* scene);